@@ -9,12 +9,22 @@
 
 #define JSMN_STATIC
 #define JSMN_PARENT_LINKS
+#define JSMN_ELEMENT_CALLBACK
+#define JSMN_SEGMENTS
+#define JSMN_LIMITS
 #include "jsmn.h"
 #include "jser.h"
 #include <assert.h>
 #include <limits.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define JSER_DISPATCH_X86 (1) /* kernels for newer CPUs are built in and chosen at run time */
+#include <immintrin.h>
+#else
+#define JSER_DISPATCH_X86 (0)
+#endif
 
 #ifndef JSER_ENABLE_TESTS
 #define JSER_ENABLE_TESTS    (1)
@@ -28,10 +38,38 @@
 #define JSER_ENABLE_USED_SET (1)
 #endif
 
+#ifdef JSMN_LARGE /* 64-bit token offsets, set for 'jsmn.h' */
+#define JSER_ENABLE_LARGE    (1)
+#else
+#define JSER_ENABLE_LARGE    (0)
+#endif
+
+#ifdef JSMN_TOKEN_VALUES /* tokens carry key hashes and numbers, set for 'jsmn.h' */
+#define JSER_ENABLE_VALUES   (1)
+#else
+#define JSER_ENABLE_VALUES   (0)
+#endif
+
+#ifndef JSER_ENABLE_ZLIB
+#define JSER_ENABLE_ZLIB     (0) /* requires linking against zlib */
+#endif
+
+#ifndef JSER_DIGEST_BLOCK
+#define JSER_DIGEST_BLOCK (4096) /* bytes checksummed at a time, whilst still in cache */
+#endif
+
+#ifndef JSER_LINT_DEPTH
+#define JSER_LINT_DEPTH (1024) /* nesting limit of 'jser_validate', 'jser_minify' and 'jser_prettify' */
+#endif
+
 #ifndef JSER_MAX_DEPTH
 #define JSER_MAX_DEPTH (0) /* 0 = unlimited */
 #endif
 
+#ifndef JSER_STACK_DEPTH
+#define JSER_STACK_DEPTH (32) /* nesting limit when no stack is supplied */
+#endif
+
 #ifndef JSER_PRETTY_STRING
 #define JSER_PRETTY_STRING "\t"
 #endif
@@ -60,39 +98,84 @@ typedef enum {
     JSER_ERR_VERSION  = -10, /**< version not set */
     JSER_ERR_CONFIG   = -11, /**< invalid configuration structure */
     JSER_ERR_LENGTH   = -12, /**< deserialization; length too short */
+    JSER_ERR_CALLBACK = -13, /**< a user supplied callback returned an error */
+    JSER_ERR_LIMIT    = -14, /**< deserialization; input went over a limit set by the caller */
 } jsonify_error_e;
 
+typedef struct {
+    const jser_buffer_t *segments; /**< input being deserialized, in order */
+    size_t count;
+    jser_buffer_t *bounce;  /**< holds values that straddle segments, may be NULL */
+    const char *cur;        /**< segment last used... */
+    size_t lo, hi;          /**< ...and the input offsets it holds */
+    size_t window, wlen;    /**< input held in the first half of 'bounce' by the tokenizer */
+    unsigned long *crc;     /**< running CRC32C of the input, if wanted... */
+    size_t summed;          /**< ...and how much of it has been added */
+} jser_input_t;
+
 typedef struct {
     unsigned max;
     jsonify_error_e error;
-    unsigned pretty : 1, dry_run: 1;
+    jser_input_t *in;       /**< deserialization input */
+    const jser_sink_t *sink; /**< where to flush output to when the buffer is full, if anywhere */
+    unsigned long *crc;     /**< running CRC32C of the output, if wanted... */
+    size_t summed;          /**< ...and how much of the buffer has been added */
+    const jser_canonical_t *canon; /**< attribute orders, if output is canonical */
+    const jser_format_t *format;   /**< layout of pretty printed output, defaults to 'pretty_default' */
+    jser_delta_t *delta;    /**< text of the values last bound, if rebinding */
+    const jser_limits_t *limits; /**< on untrusted input, may be NULL */
+    jser_lookup_t *lookup;       /**< orders to look keys up in, may be NULL */
+    size_t frames;               /**< binder frames in use further up the C stack */
+    unsigned pretty : 1, dry_run: 1, line: 1, spill: 1; /**< 'spill': carry on binding with more frames when the stack is full */
 } jser_opts_t;
 
+typedef struct {
+    unsigned long (*crc32c)(unsigned long crc, const unsigned char *p, size_t length);
+    size_t (*string)(const unsigned char *p, size_t length); /**< bytes before a quote, backslash or control character */
+    size_t (*space)(const unsigned char *p, size_t length);  /**< white space bytes */
+    unsigned options; /**< reported by 'jser_version' */
+} jser_kernels_t; /**< the fastest loops the CPU can run, see 'jser_kernel' */
+
+static inline const jser_kernels_t *jser_kernel(void);
+
 int jser_version(unsigned long *version)
 {
     assert(version);
     BUILD_BUG_ON(JSER_ENABLE_TESTS    != 0 && JSER_ENABLE_TESTS    != 1);
     BUILD_BUG_ON(JSER_ENABLE_ESCAPE   != 0 && JSER_ENABLE_ESCAPE   != 1);
     BUILD_BUG_ON(JSER_ENABLE_USED_SET != 0 && JSER_ENABLE_USED_SET != 1);
+    BUILD_BUG_ON(JSER_ENABLE_LARGE    != 0 && JSER_ENABLE_LARGE    != 1);
+    BUILD_BUG_ON(JSER_ENABLE_VALUES   != 0 && JSER_ENABLE_VALUES   != 1);
+    BUILD_BUG_ON(JSER_ENABLE_ZLIB     != 0 && JSER_ENABLE_ZLIB     != 1);
+    BUILD_BUG_ON(JSER_ENABLE_LARGE && sizeof (jsmnint_t) < 8 && sizeof (size_t) >= 8);
     unsigned long options =
         JSER_ENABLE_TESTS    << 0 |
         JSER_ENABLE_ESCAPE   << 1 |
-        JSER_ENABLE_USED_SET << 2 ;
+        JSER_ENABLE_USED_SET << 2 |
+        JSER_ENABLE_LARGE    << 3 |
+        JSER_ENABLE_VALUES   << 4 |
+        JSER_ENABLE_ZLIB     << 5 |
+        jser_kernel()->options    << 6 ;
     *version = (options << 24) | JSER_VERSION;
     return JSER_VERSION == 0 ? JSER_ERR_VERSION : 0;
 }
 
-static inline int boolify(int x)
+static inline int jser_boolify(int x)
 {
     return !!x;
 }
 
-static inline int within(uint64_t value, uint64_t lo, uint64_t hi)
+static inline int jser_within(uint64_t value, uint64_t lo, uint64_t hi)
 {
     return (value >= lo) && (value <= hi);
 }
 
-static inline void reverse(char *const r, const size_t length)
+static inline bool jser_over(const size_t limit, const size_t n) /* a 'limit' of 0 is no limit */
+{
+    return limit != 0 && n > limit;
+}
+
+static inline void jser_reverse(char *const r, const size_t length)
 {
     assert(r);
     const size_t last = length - 1;
@@ -106,7 +189,7 @@ static inline void reverse(char *const r, const size_t length)
 static inline void u64_to_str(char b[64], uint64_t u, const uint64_t base)
 {
     assert(b);
-    assert(within(base, 2, 16));
+    assert(jser_within(base, 2, 16));
     unsigned i = 0;
     do {
         const uint64_t q = u % base;
@@ -114,7 +197,7 @@ static inline void u64_to_str(char b[64], uint64_t u, const uint64_t base)
         b[i++] = q["0123456789ABCDEF"];
         u = r;
     } while (u);
-    reverse(b, i);
+    jser_reverse(b, i);
     b[i] = '\0';
     assert(i >= 1);
 }
@@ -131,7 +214,277 @@ static inline void i64_to_str(char b[65], int64_t s, const uint64_t base)
     u64_to_str(b, s, base);
 }
 
-static inline int digit(int ch, int base)
+static inline unsigned long jser_fnv1a(unsigned long h, const void *data, size_t length)
+{
+    assert(data || length == 0);
+    const unsigned char *d = data;
+    for (size_t i = 0; i < length; i++) {
+        h ^= d[i];
+        h = (h * 0x01000193ul) & 0xFFFFFFFFul;
+    }
+    return h;
+}
+
+#define FNV1A_BASIS (0x811C9DC5ul)
+
+static inline unsigned long long jser_fnv1a64(unsigned long long h, const void *data, size_t length)
+{
+    assert(data || length == 0);
+    const unsigned char *d = data;
+    for (size_t i = 0; i < length; i++) {
+        h ^= d[i];
+        h = (h * 0x00000100000001B3ull) & 0xFFFFFFFFFFFFFFFFull;
+    }
+    return h;
+}
+
+#define FNV1A64_BASIS (0xCBF29CE484222325ull)
+
+static const uint32_t crc32c_table[256] = { /* reflected, polynomial 0x1EDC6F41 */
+    0x00000000ul, 0xF26B8303ul, 0xE13B70F7ul, 0x1350F3F4ul, 0xC79A971Ful, 0x35F1141Cul,
+    0x26A1E7E8ul, 0xD4CA64EBul, 0x8AD958CFul, 0x78B2DBCCul, 0x6BE22838ul, 0x9989AB3Bul,
+    0x4D43CFD0ul, 0xBF284CD3ul, 0xAC78BF27ul, 0x5E133C24ul, 0x105EC76Ful, 0xE235446Cul,
+    0xF165B798ul, 0x030E349Bul, 0xD7C45070ul, 0x25AFD373ul, 0x36FF2087ul, 0xC494A384ul,
+    0x9A879FA0ul, 0x68EC1CA3ul, 0x7BBCEF57ul, 0x89D76C54ul, 0x5D1D08BFul, 0xAF768BBCul,
+    0xBC267848ul, 0x4E4DFB4Bul, 0x20BD8EDEul, 0xD2D60DDDul, 0xC186FE29ul, 0x33ED7D2Aul,
+    0xE72719C1ul, 0x154C9AC2ul, 0x061C6936ul, 0xF477EA35ul, 0xAA64D611ul, 0x580F5512ul,
+    0x4B5FA6E6ul, 0xB93425E5ul, 0x6DFE410Eul, 0x9F95C20Dul, 0x8CC531F9ul, 0x7EAEB2FAul,
+    0x30E349B1ul, 0xC288CAB2ul, 0xD1D83946ul, 0x23B3BA45ul, 0xF779DEAEul, 0x05125DADul,
+    0x1642AE59ul, 0xE4292D5Aul, 0xBA3A117Eul, 0x4851927Dul, 0x5B016189ul, 0xA96AE28Aul,
+    0x7DA08661ul, 0x8FCB0562ul, 0x9C9BF696ul, 0x6EF07595ul, 0x417B1DBCul, 0xB3109EBFul,
+    0xA0406D4Bul, 0x522BEE48ul, 0x86E18AA3ul, 0x748A09A0ul, 0x67DAFA54ul, 0x95B17957ul,
+    0xCBA24573ul, 0x39C9C670ul, 0x2A993584ul, 0xD8F2B687ul, 0x0C38D26Cul, 0xFE53516Ful,
+    0xED03A29Bul, 0x1F682198ul, 0x5125DAD3ul, 0xA34E59D0ul, 0xB01EAA24ul, 0x42752927ul,
+    0x96BF4DCCul, 0x64D4CECFul, 0x77843D3Bul, 0x85EFBE38ul, 0xDBFC821Cul, 0x2997011Ful,
+    0x3AC7F2EBul, 0xC8AC71E8ul, 0x1C661503ul, 0xEE0D9600ul, 0xFD5D65F4ul, 0x0F36E6F7ul,
+    0x61C69362ul, 0x93AD1061ul, 0x80FDE395ul, 0x72966096ul, 0xA65C047Dul, 0x5437877Eul,
+    0x4767748Aul, 0xB50CF789ul, 0xEB1FCBADul, 0x197448AEul, 0x0A24BB5Aul, 0xF84F3859ul,
+    0x2C855CB2ul, 0xDEEEDFB1ul, 0xCDBE2C45ul, 0x3FD5AF46ul, 0x7198540Dul, 0x83F3D70Eul,
+    0x90A324FAul, 0x62C8A7F9ul, 0xB602C312ul, 0x44694011ul, 0x5739B3E5ul, 0xA55230E6ul,
+    0xFB410CC2ul, 0x092A8FC1ul, 0x1A7A7C35ul, 0xE811FF36ul, 0x3CDB9BDDul, 0xCEB018DEul,
+    0xDDE0EB2Aul, 0x2F8B6829ul, 0x82F63B78ul, 0x709DB87Bul, 0x63CD4B8Ful, 0x91A6C88Cul,
+    0x456CAC67ul, 0xB7072F64ul, 0xA457DC90ul, 0x563C5F93ul, 0x082F63B7ul, 0xFA44E0B4ul,
+    0xE9141340ul, 0x1B7F9043ul, 0xCFB5F4A8ul, 0x3DDE77ABul, 0x2E8E845Ful, 0xDCE5075Cul,
+    0x92A8FC17ul, 0x60C37F14ul, 0x73938CE0ul, 0x81F80FE3ul, 0x55326B08ul, 0xA759E80Bul,
+    0xB4091BFFul, 0x466298FCul, 0x1871A4D8ul, 0xEA1A27DBul, 0xF94AD42Ful, 0x0B21572Cul,
+    0xDFEB33C7ul, 0x2D80B0C4ul, 0x3ED04330ul, 0xCCBBC033ul, 0xA24BB5A6ul, 0x502036A5ul,
+    0x4370C551ul, 0xB11B4652ul, 0x65D122B9ul, 0x97BAA1BAul, 0x84EA524Eul, 0x7681D14Dul,
+    0x2892ED69ul, 0xDAF96E6Aul, 0xC9A99D9Eul, 0x3BC21E9Dul, 0xEF087A76ul, 0x1D63F975ul,
+    0x0E330A81ul, 0xFC588982ul, 0xB21572C9ul, 0x407EF1CAul, 0x532E023Eul, 0xA145813Dul,
+    0x758FE5D6ul, 0x87E466D5ul, 0x94B49521ul, 0x66DF1622ul, 0x38CC2A06ul, 0xCAA7A905ul,
+    0xD9F75AF1ul, 0x2B9CD9F2ul, 0xFF56BD19ul, 0x0D3D3E1Aul, 0x1E6DCDEEul, 0xEC064EEDul,
+    0xC38D26C4ul, 0x31E6A5C7ul, 0x22B65633ul, 0xD0DDD530ul, 0x0417B1DBul, 0xF67C32D8ul,
+    0xE52CC12Cul, 0x1747422Ful, 0x49547E0Bul, 0xBB3FFD08ul, 0xA86F0EFCul, 0x5A048DFFul,
+    0x8ECEE914ul, 0x7CA56A17ul, 0x6FF599E3ul, 0x9D9E1AE0ul, 0xD3D3E1ABul, 0x21B862A8ul,
+    0x32E8915Cul, 0xC083125Ful, 0x144976B4ul, 0xE622F5B7ul, 0xF5720643ul, 0x07198540ul,
+    0x590AB964ul, 0xAB613A67ul, 0xB831C993ul, 0x4A5A4A90ul, 0x9E902E7Bul, 0x6CFBAD78ul,
+    0x7FAB5E8Cul, 0x8DC0DD8Ful, 0xE330A81Aul, 0x115B2B19ul, 0x020BD8EDul, 0xF0605BEEul,
+    0x24AA3F05ul, 0xD6C1BC06ul, 0xC5914FF2ul, 0x37FACCF1ul, 0x69E9F0D5ul, 0x9B8273D6ul,
+    0x88D28022ul, 0x7AB90321ul, 0xAE7367CAul, 0x5C18E4C9ul, 0x4F48173Dul, 0xBD23943Eul,
+    0xF36E6F75ul, 0x0105EC76ul, 0x12551F82ul, 0xE03E9C81ul, 0x34F4F86Aul, 0xC69F7B69ul,
+    0xD5CF889Dul, 0x27A40B9Eul, 0x79B737BAul, 0x8BDCB4B9ul, 0x988C474Dul, 0x6AE7C44Eul,
+    0xBE2DA0A5ul, 0x4C4623A6ul, 0x5F16D052ul, 0xAD7D5351ul,
+};
+
+/* CRC32C (Castagnoli) a byte at a time from a table, 'jser_kernel' picks this
+ * or a faster one */
+static unsigned long crc32c_table_kernel(const unsigned long crc, const unsigned char *p, size_t length)
+{
+    assert(p || length == 0);
+    uint32_t c = ~(uint32_t)crc;
+    for (; length; length--) {
+        c = crc32c_table[(c ^ *p++) & 0xFFu] ^ (c >> 8);
+    }
+    return ~c & 0xFFFFFFFFul;
+}
+
+#if JSER_DISPATCH_X86
+__attribute__((target("sse4.2")))
+static unsigned long crc32c_sse42_kernel(const unsigned long crc, const unsigned char *p, size_t length)
+{
+    assert(p || length == 0);
+    uint64_t c = ~(uint32_t)crc;
+    for (; length >= 8; length -= 8, p += 8) {
+        uint64_t v = 0;
+        memcpy(&v, p, sizeof v);
+        c = _mm_crc32_u64(c, v);
+    }
+    uint32_t c32 = c;
+    for (; length; length--) {
+        c32 = _mm_crc32_u8(c32, *p++);
+    }
+    return ~c32 & 0xFFFFFFFFul;
+}
+#endif
+
+/* ~~~ Kernels ~~~ */
+
+/* Loops that go faster with instructions not every CPU has are built more
+ * than once, for the baseline and with those instructions enabled, and the
+ * best one the CPU supports is picked when first used. The portable kernels
+ * work eight bytes at a time within a 64-bit word. */
+
+#define SWAR_ONES  (UINT64_C(0x0101010101010101))
+#define SWAR_HIGHS (UINT64_C(0x8080808080808080))
+
+/* The top bit is set in each byte of 'v' that is equal to 'ch' */
+static inline uint64_t swar_equal(const uint64_t v, const unsigned ch)
+{
+    const uint64_t t = v ^ (SWAR_ONES * ch), low = ~SWAR_HIGHS;
+    return ~(((t & low) + low) | t) & SWAR_HIGHS;
+}
+
+/* Number of bytes before the first quote, backslash or control character */
+static size_t swar_string(const unsigned char *p, const size_t length)
+{
+    assert(p || length == 0);
+    size_t i = 0;
+    for (; (i + 8) <= length; i += 8) {
+        uint64_t v = 0;
+        memcpy(&v, &p[i], sizeof v);
+        if (swar_equal(v, '"') | swar_equal(v, '\\') | swar_equal(v & (SWAR_ONES * 0xE0u), 0)) {
+            break;
+        }
+    }
+    for (; i < length && p[i] != '"' && p[i] != '\\' && p[i] >= 0x20; i++)
+        ;
+    return i;
+}
+
+static inline int is_space(const int ch)
+{
+    return ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r';
+}
+
+/* Number of white space bytes at the start of 'p' */
+static size_t swar_space(const unsigned char *p, const size_t length)
+{
+    assert(p || length == 0);
+    size_t i = 0;
+    for (; (i + 8) <= length; i += 8) {
+        uint64_t v = 0;
+        memcpy(&v, &p[i], sizeof v);
+        if ((swar_equal(v, ' ') | swar_equal(v, '\t') | swar_equal(v, '\n') | swar_equal(v, '\r')) != SWAR_HIGHS) {
+            break;
+        }
+    }
+    for (; i < length && is_space(p[i]); i++)
+        ;
+    return i;
+}
+
+#if JSER_DISPATCH_X86
+__attribute__((target("avx2")))
+static size_t avx2_string(const unsigned char *p, const size_t length)
+{
+    assert(p || length == 0);
+    const __m256i quote = _mm256_set1_epi8('"'), slash = _mm256_set1_epi8('\\'), control = _mm256_set1_epi8(0x1F);
+    size_t i = 0;
+    for (; (i + 32) <= length; i += 32) {
+        const __m256i v = _mm256_loadu_si256((const __m256i *)&p[i]);
+        const __m256i stop = _mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi8(v, quote), _mm256_cmpeq_epi8(v, slash)),
+                _mm256_cmpeq_epi8(_mm256_max_epu8(v, control), control));
+        const unsigned bits = (unsigned)_mm256_movemask_epi8(stop);
+        if (bits) {
+            return i + (size_t)__builtin_ctz(bits);
+        }
+    }
+    return i + swar_string(&p[i], length - i);
+}
+
+__attribute__((target("avx2")))
+static size_t avx2_space(const unsigned char *p, const size_t length)
+{
+    assert(p || length == 0);
+    const __m256i sp = _mm256_set1_epi8(' '), tab = _mm256_set1_epi8('\t'), nl = _mm256_set1_epi8('\n'), cr = _mm256_set1_epi8('\r');
+    size_t i = 0;
+    for (; (i + 32) <= length; i += 32) {
+        const __m256i v = _mm256_loadu_si256((const __m256i *)&p[i]);
+        const __m256i white = _mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi8(v, sp), _mm256_cmpeq_epi8(v, tab)),
+                _mm256_or_si256(_mm256_cmpeq_epi8(v, nl), _mm256_cmpeq_epi8(v, cr)));
+        const unsigned bits = ~(unsigned)_mm256_movemask_epi8(white);
+        if (bits) {
+            return i + (size_t)__builtin_ctz(bits);
+        }
+    }
+    return i + swar_space(&p[i], length - i);
+}
+#endif
+
+static const jser_kernels_t kernels_portable = { crc32c_table_kernel, swar_string, swar_space, 0, };
+#if JSER_DISPATCH_X86
+static const jser_kernels_t kernels_sse42 = { crc32c_sse42_kernel, swar_string, swar_space, 1, };
+static const jser_kernels_t kernels_avx2  = { crc32c_sse42_kernel, avx2_string, avx2_space, 3, };
+#endif
+
+#if JSER_DISPATCH_X86
+/* Both are read and written with atomic builtins, so any thread may pick
+ * the set or force the portable one; every thread that detects the CPU
+ * stores the same pointer, and each set gives the same answers, so a call
+ * running on another thread whilst 'jser_force_portable' is called just
+ * uses one or the other. */
+static const jser_kernels_t *jser_kernels = NULL; /* best set, chosen on first use */
+static int jser_portable = 0; /* set by 'jser_force_portable' */
+
+static const jser_kernels_t *jser_detect(void)
+{
+    const char *force = getenv("JSER_PORTABLE");
+    const jser_kernels_t *k = &kernels_portable;
+    if (!force || !force[0] || !strcmp(force, "0")) {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("sse4.2")) {
+            k = &kernels_avx2;
+        } else if (__builtin_cpu_supports("sse4.2")) {
+            k = &kernels_sse42;
+        }
+    }
+    __atomic_store_n(&jser_kernels, k, __ATOMIC_RELEASE);
+    return k;
+}
+
+static inline const jser_kernels_t *jser_kernel(void)
+{
+    if (__atomic_load_n(&jser_portable, __ATOMIC_RELAXED)) {
+        return &kernels_portable;
+    }
+    const jser_kernels_t *k = __atomic_load_n(&jser_kernels, __ATOMIC_ACQUIRE);
+    return k ? k : jser_detect();
+}
+
+int jser_force_portable(const int on)
+{
+    __atomic_store_n(&jser_portable, on != 0, __ATOMIC_RELAXED);
+    return JSER_OK;
+}
+#else
+static inline const jser_kernels_t *jser_kernel(void)
+{
+    return &kernels_portable; /* the only set built */
+}
+
+int jser_force_portable(const int on)
+{
+    UNUSED(on);
+    return JSER_OK;
+}
+#endif
+
+static inline unsigned long jser_crc32c_update(const unsigned long crc, const unsigned char *p, const size_t length)
+{
+    return jser_kernel()->crc32c(crc, p, length);
+}
+
+int jser_crc32c(const unsigned char *buf, size_t length, unsigned long *crc)
+{
+    assert(buf || length == 0);
+    assert(crc);
+    *crc = jser_crc32c_update(*crc, buf, length);
+    return JSER_OK;
+}
+
+static inline int jser_digit(int ch, int base)
 {
     int r = -1;
     if (ch >= '0' && ch <= '9') {
@@ -153,77 +506,55 @@ static int str_to_u64(const char *str, const size_t length, const uint64_t base,
 {
     assert(str);
     assert(out);
-    assert(within(base, 2, 16));
+    assert(jser_within(base, 2, 16));
     *out = 0;
     if (length == 0) {
         return -1;
     }
     uint64_t t = 0;
     for (size_t i = 0; i < length; i++) {
-        const int dg = digit(str[i], base);
+        const int dg = jser_digit(str[i], base);
         if (dg < 0) {
             return -1;
         }
-        const uint64_t nt1 = t * base;
-        if (nt1 < t) { /* overflow */
-            return -1;
-        }
-        const uint64_t nt2 = nt1 + dg;
-        if (nt2 < t) {/* overflow */
+        if (t > (UINT64_MAX - dg) / base) { /* overflow */
             return -1;
         }
-        t = nt2;
+        t = (t * base) + dg;
     }
     *out = t;
     return 0;
 }
 
-static int str_to_i64(const char *str, const size_t length, const uint64_t base, int64_t *out)
-{
-    assert(str);
-    assert(out);
-    assert(within(base, 2, 16));
-    const int negative = length > 0 && str[0] == '-';
-    uint64_t t = 0;
-    if (str_to_u64(str + negative, length - negative, base, &t) < 0) {
-        return -1;
-    }
-    int64_t o = t;
-    if (negative) {
-        o = -o;
-    }
-    *out = o;
-    return 0;
-}
-
 static inline size_t base64_decoded_size(const size_t sz)
 {
     assert((sz * 3ull) >= sz);
     return (sz * 3ull) / 4ull;
 }
 
+enum { WS = 64u, /* white space */ EQ = 65u, /*equals*/ XX = 66u, /* invalid */ };
+
+static const unsigned char base64_decode_table[] = { /* 0-63 = valid chars, 64-66 = special */
+    XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, WS, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+    XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, 62, XX, XX, XX, 63, 52, 53,
+    54, 55, 56, 57, 58, 59, 60, 61, XX, XX, XX, EQ, XX, XX, XX, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9,
+    10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, XX, XX, XX, XX, XX, XX, 26, 27, 28,
+    29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40, 41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, XX, XX,
+    XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+    XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+    XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+    XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+    XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+    XX, XX, XX, XX, XX, XX
+};
+
 int jser_base64_decode(const unsigned char *ibuf, const size_t ilen, unsigned char *obuf, size_t *olen)
 {
     assert(ibuf);
     assert(obuf);
     assert(olen);
 
-    enum { WS = 64u, /* white space */ EQ = 65u, /*equals*/ XX = 66u, /* invalid */ };
-
-    static const unsigned char d[] = { /* 0-63 = valid chars, 64-66 = special */
-        XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, WS, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
-        XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, 62, XX, XX, XX, 63, 52, 53,
-        54, 55, 56, 57, 58, 59, 60, 61, XX, XX, XX, EQ, XX, XX, XX, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9,
-        10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, XX, XX, XX, XX, XX, XX, 26, 27, 28,
-        29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40, 41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, XX, XX,
-        XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
-        XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
-        XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
-        XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
-        XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
-        XX, XX, XX, XX, XX, XX
-    };
-
+    const unsigned char *d = base64_decode_table;
     unsigned iter = 0;
     uint32_t buf = 0;
     size_t len = 0;
@@ -331,13 +662,79 @@ static int on_error(jser_opts_t *sp, jsonify_error_e error)
     return error;
 }
 
+/* Add the output not yet checksummed to the running CRC */
+static void jser_checksum(jser_opts_t *sp, const jser_buffer_t *b)
+{
+    assert(sp);
+    assert(b);
+    assert(sp->summed <= b->used);
+    if (sp->crc && sp->dry_run == 0) {
+        *sp->crc = jser_crc32c_update(*sp->crc, &b->buf[sp->summed], b->used - sp->summed);
+        sp->summed = b->used;
+    }
+}
+
+/* Geometric growth, so a document is produced in a single pass with few
+ * calls to the allocator */
+static int jser_grow(jser_opts_t *sp, jser_buffer_t *b, const size_t n)
+{
+    assert(sp);
+    assert(b);
+    assert(sp->sink && sp->sink->grow);
+    if ((SIZE_MAX - b->used) < n) {
+        return on_error(sp, JSER_ERR_SPACE);
+    }
+    size_t length = b->length < 64 ? 64 : b->length;
+    while ((length - b->used) < n) {
+        if (length > (SIZE_MAX / 2)) {
+            length = SIZE_MAX;
+            break;
+        }
+        length *= 2;
+    }
+    void *r = sp->sink->grow(sp->sink->param, b->buf, length);
+    if (!r) {
+        return on_error(sp, JSER_ERR_SPACE);
+    }
+    b->buf = r;
+    b->length = length;
+    return 0;
+}
+
+/* Make sure there is room for 'n' more bytes in the output, emptying it
+ * into the sink first or growing it if there is one. */
+static int jser_reserve(jser_opts_t *sp, jser_buffer_t *b, const size_t n)
+{
+    assert(sp);
+    assert(b);
+    assert(b->used <= b->length);
+    if ((b->length - b->used) >= n) {
+        return 0;
+    }
+    if (sp->sink && !sp->sink->flush) {
+        return jser_grow(sp, b, n);
+    }
+    if (sp->sink && b->used) {
+        jser_checksum(sp, b);
+        if (sp->sink->flush(sp->sink->param, b->buf, b->used) < 0) {
+            return on_error(sp, JSER_ERR_CALLBACK);
+        }
+        b->used = 0;
+        sp->summed = 0;
+        if (b->length >= n) {
+            return 0;
+        }
+    }
+    return on_error(sp, JSER_ERR_SPACE);
+}
+
 static int add_ch(jser_opts_t *sp, jser_buffer_t *b, int ch)
 {
     assert(sp);
     assert(b);
     assert(b->used <= b->length);
-    if ((1 + b->used) > b->length) {
-        return on_error(sp, JSER_ERR_SPACE);
+    if (jser_reserve(sp, b, 1) < 0) {
+        return -1;
     }
     if (sp->dry_run == 0) {
         b->buf[b->used] = ch;
@@ -398,15 +795,20 @@ static int addstr(jser_opts_t *sp, jser_buffer_t *b, const char *str)
             }
         }
     } else {
-        const size_t slen = strlen(str);
-        if ((slen + b->used) > b->length) {
-            return on_error(sp, JSER_ERR_SPACE);
-        }
-        implies(sp->dry_run == 0, b->buf);
-        if (sp->dry_run == 0) {
-            memcpy(&b->buf[b->used], str, slen);
+        size_t slen = strlen(str);
+        while (slen) { /* in pieces if going to a sink */
+            if (jser_reserve(sp, b, sp->sink && sp->sink->flush ? 1 : slen) < 0) {
+                return -1;
+            }
+            const size_t room = b->length - b->used, n = slen < room ? slen : room;
+            implies(sp->dry_run == 0, b->buf);
+            if (sp->dry_run == 0) {
+                memcpy(&b->buf[b->used], str, n);
+            }
+            b->used += n;
+            str += n;
+            slen -= n;
         }
-        b->used += slen;
     }
     return 0;
 }
@@ -442,6 +844,41 @@ static int add_attr(jser_opts_t *sp, jser_buffer_t *b, const char *attr)
     return 0;
 }
 
+#define PRETTY_4 JSER_PRETTY_STRING JSER_PRETTY_STRING JSER_PRETTY_STRING JSER_PRETTY_STRING
+
+static const jser_format_t pretty_default = {
+    .indent      = JSER_PRETTY_STRING,
+    .newline     = "\n",
+    .colon_space = true,
+    .slab        = "\n" PRETTY_4 PRETTY_4 PRETTY_4 PRETTY_4,
+    .nlen        = 1,
+    .ilen        = sizeof (JSER_PRETTY_STRING) - 1,
+    .levels      = 16,
+};
+
+/* Bytes that may be split over more than one flush */
+static int add_span(jser_opts_t *sp, jser_buffer_t *b, const char *s, size_t n)
+{
+    assert(sp);
+    assert(b);
+    assert(s || n == 0);
+    while (n) {
+        if (jser_reserve(sp, b, 1) < 0) {
+            return -1;
+        }
+        const size_t room = b->length - b->used, k = n < room ? n : room;
+        if (sp->dry_run == 0) {
+            memcpy(&b->buf[b->used], s, k);
+        }
+        b->used += k;
+        s += k;
+        n -= k;
+    }
+    return 0;
+}
+
+/* The start of a line, a newline (if one is due) and the indentation are
+ * copied from the slab in one go */
 static int add_indent(jser_opts_t *sp, jser_buffer_t *b, size_t count)
 {
     assert(sp);
@@ -449,11 +886,19 @@ static int add_indent(jser_opts_t *sp, jser_buffer_t *b, size_t count)
     if (sp->pretty == 0) {
         return 0;
     }
-    for (size_t i = 0; i < count; i++)
-        for (size_t j = 0; JSER_PRETTY_STRING[j]; j++)
-            if (add_ch(sp, b, JSER_PRETTY_STRING[j]) < 0) {
-                return -1;
-            }
+    const jser_format_t *f = sp->format ? sp->format : &pretty_default;
+    const size_t from = sp->line ? 0 : f->nlen;
+    size_t n = count < f->levels ? count : f->levels;
+    sp->line = 0;
+    if (add_span(sp, b, &f->slab[from], (f->nlen - from) + (n * f->ilen)) < 0) {
+        return -1;
+    }
+    for (count -= n; count; count -= n) { /* deeper than the slab */
+        n = count < f->levels ? count : f->levels;
+        if (add_span(sp, b, &f->slab[f->nlen], n * f->ilen) < 0) {
+            return -1;
+        }
+    }
     return 0;
 }
 
@@ -461,20 +906,23 @@ static int add_space(jser_opts_t *sp, jser_buffer_t *b)
 {
     assert(sp);
     assert(b);
-    if (sp->pretty == 0) {
+    if (sp->pretty == 0 || !(sp->format ? sp->format : &pretty_default)->colon_space) {
         return 0;
     }
     return add_ch(sp, b, ' ');
 }
 
+/* A newline is always followed by indentation, so it is left for
+ * 'add_indent' to write */
 static int add_newline(jser_opts_t *sp, jser_buffer_t *b)
 {
     assert(sp);
     assert(b);
-    if (sp->pretty == 0) {
-        return 0;
+    UNUSED(b);
+    if (sp->pretty) {
+        sp->line = 1;
     }
-    return add_ch(sp, b, '\n');
+    return 0;
 }
 
 static int add_i64(jser_opts_t *sp, jser_buffer_t *b, const jser_long_t ld)
@@ -517,25 +965,27 @@ static int add_buffer(jser_opts_t *sp, jser_buffer_t *b, jser_buffer_t *buf)
     assert(sp);
     assert(b);
     assert(buf);
-    const size_t osz = base64_encoded_size(buf->length);
+    implies(buf->used, buf->buf);
     if (add_ch(sp, b, '"') < 0) {
         return -1;
     }
-    assert(b->length >= b->used);
-    if ((b->length - b->used) < osz) {
-        return on_error(sp, JSER_ERR_SPACE);
+    if (!(sp->sink && sp->sink->flush) && jser_reserve(sp, b, base64_encoded_size(buf->used)) < 0) {
+        return -1;
     }
-    if (sp->dry_run == 0) {
-        size_t nl = buf->length ? b->length : 0;
-        implies(buf->length, buf->buf);
-        if (buf->length) {
-            if (jser_base64_encode(buf->buf, buf->used, &b->buf[b->used], &nl) < 0) {
+    for (size_t done = 0; done < buf->used;) { /* whole groups of three bytes, unless at the end */
+        if (jser_reserve(sp, b, 4) < 0) {
+            return -1;
+        }
+        const size_t room = b->length - b->used, left = buf->used - done;
+        const size_t in = (room / 4ull) * 3ull < left ? (room / 4ull) * 3ull : left;
+        size_t nl = room;
+        if (sp->dry_run == 0) {
+            if (jser_base64_encode(&buf->buf[done], in, &b->buf[b->used], &nl) < 0) {
                 return on_error(sp, JSER_ERR_BASE64);
             }
         }
-        b->used += base64_encoded_size(buf->used);
-    } else {
-        b->used += base64_encoded_size(buf->used);
+        b->used += base64_encoded_size(in);
+        done += in;
     }
     if (add_ch(sp, b, '"') < 0) {
         return -1;
@@ -583,13 +1033,55 @@ static int add_value(jser_opts_t *sp, jser_buffer_t *b, jser_type_e type, const
     return 0;
 }
 
-static int jsonify(jser_opts_t *sp, const jser_t *j, const size_t jlen, jser_buffer_t *b, const int is_array, size_t depth);
+static int jser_jsonify(jser_opts_t *sp, const jser_t *j, const size_t jlen, jser_buffer_t *b, const int is_array, const jser_union_t *un, size_t depth);
+static int jsonify_stream(jser_opts_t *sp, const jser_stream_t *st, jser_buffer_t *b, size_t depth);
+
+/* Does an array hold only numbers, booleans and strings? */
+static int jser_flat(const jser_t *j, const size_t jlen)
+{
+    assert(j || jlen == 0);
+    for (size_t i = 0; i < jlen; i++) {
+        const jser_type_e t = j[i].type;
+        if (t == JSER_OBJECT_E || t == JSER_ARRAY_E || t == JSER_UNION_E || t == JSER_STREAM_E) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int order_compare(const void *a, const void *b)
+{
+    assert(a);
+    assert(b);
+    const jser_order_t *x = a, *y = b;
+    const uintptr_t xj = (uintptr_t)x->j, yj = (uintptr_t)y->j, xt = (uintptr_t)x->tag, yt = (uintptr_t)y->tag;
+    if (xj != yj) {
+        return xj < yj ? -1 : 1;
+    }
+    if (x->length != y->length) {
+        return x->length < y->length ? -1 : 1;
+    }
+    return (xt > yt) - (xt < yt);
+}
+
+/* Order prepared for an object table by 'jser_canonical_prepare', which
+ * leaves them sorted by table */
+static const size_t *jser_ordering(const jser_canonical_t *c, const jser_t *j, const size_t jlen, const jser_union_t *un)
+{
+    assert(c);
+    const jser_order_t key = { .j = j, .length = jlen, .tag = un ? un->attr : NULL, };
+    const jser_order_t *o = c->used ? bsearch(&key, c->orders, c->used, sizeof (*c->orders), order_compare) : NULL;
+    return o ? o->order : NULL;
+}
 
 static int addj(jser_opts_t *sp, jser_buffer_t *b, const jser_t *e, size_t depth)
 {
     assert(sp);
     assert(b);
     assert(e);
+    if (sp->crc && (b->used - sp->summed) >= JSER_DIGEST_BLOCK) {
+        jser_checksum(sp, b);
+    }
 
     if (e->type == JSER_OBJECT_E) {
         if (e->is_array) {
@@ -598,23 +1090,59 @@ static int addj(jser_opts_t *sp, jser_buffer_t *b, const jser_t *e, size_t depth
         if (add_newline(sp, b)) {
             return -1;
         }
-        if (jsonify(sp, e->data.jser, e->length, b, 0, depth + 1) < 0) {
+        if (jser_jsonify(sp, e->data.jser, e->length, b, 0, NULL, depth + 1) < 0) {
             return -1;
         }
         return 0;
     }
 
-    if (e->type == JSER_ARRAY_E) {
-        /* do not care if 'e->is_array' is set, as this is obviously an array */
+    if (e->type == JSER_UNION_E) {
+        const jser_union_t *un = e->data.un;
+        if (e->is_array || un->selected >= un->length || !un->attr) {
+            return on_error(sp, JSER_ERR_CONFIG);
+        }
+        const jser_variant_t *v = &un->variants[un->selected];
+        if (!v->tag || (v->length && !v->jser)) {
+            return on_error(sp, JSER_ERR_CONFIG);
+        }
+        if (add_newline(sp, b)) {
+            return -1;
+        }
+        if (jser_jsonify(sp, v->jser, v->length, b, 0, un, depth + 1) < 0) {
+            return -1;
+        }
+        return 0;
+    }
+
+    if (e->type == JSER_CHUNKED_E) { /* input only */
+        return on_error(sp, JSER_ERR_CONFIG);
+    }
+
+    if (e->type == JSER_STREAM_E) {
+        const jser_stream_t *st = e->data.stream;
+        if (e->is_array || !st->next || !st->record) {
+            return on_error(sp, JSER_ERR_CONFIG);
+        }
         if (add_newline(sp, b)) {
             return -1;
         }
-        if (jsonify(sp, e->data.array, e->length, b, 1, depth + 1) < 0) {
+        if (jsonify_stream(sp, st, b, depth + 1) < 0) {
             return -1;
         }
         return 0;
     }
 
+    if (e->type == JSER_ARRAY_E) {
+        /* do not care if 'e->is_array' is set, as this is obviously an array */
+        const unsigned pretty = sp->pretty;
+        if (pretty && sp->format && sp->format->compact_arrays && jser_flat(e->data.array, e->length)) {
+            sp->pretty = 0; /* on one line */
+        }
+        const int r = add_newline(sp, b) < 0 ? -1 : jser_jsonify(sp, e->data.array, e->length, b, 1, NULL, depth + 1);
+        sp->pretty = pretty;
+        return r < 0 ? -1 : 0;
+    }
+
     if (e->is_array) {
         if (add_ch(sp, b, '[') < 0) {
             return -1;
@@ -642,11 +1170,12 @@ static int addj(jser_opts_t *sp, jser_buffer_t *b, const jser_t *e, size_t depth
     return 0;
 }
 
-static int jsonify(jser_opts_t *sp, const jser_t *j, const size_t jlen, jser_buffer_t *b, const int is_array, size_t depth)
+static int jser_jsonify(jser_opts_t *sp, const jser_t *j, const size_t jlen, jser_buffer_t *b, const int is_array, const jser_union_t *un, size_t depth)
 {
     assert(sp);
-    assert(j);
+    assert(j || jlen == 0);
     assert(b);
+    implies(un, is_array == 0);
 
     if (sp->max != 0 && depth > sp->max) {
         return on_error(sp, JSER_ERR_DEPTH);
@@ -661,31 +1190,71 @@ static int jsonify(jser_opts_t *sp, const jser_t *j, const size_t jlen, jser_buf
         return -1;
     }
 
-    for (size_t i = 0; i < jlen; i++) {
-        const jser_t *e = &j[i];
-        const int last = i == jlen - 1;
-        if (e->data.lu == NULL) {
-            return on_error(sp, JSER_ERR_CONFIG);
-        }
+    const size_t *order = NULL; /* canonical output, attributes are sorted and so is a union tag */
+    if (sp->canon && !is_array && !(order = jser_ordering(sp->canon, j, jlen, un))) {
+        return on_error(sp, JSER_ERR_CONFIG);
+    }
+    const size_t n = jlen + (order && un);
 
+    if (un && !order) { /* the tag of a union always comes first */
         if (add_indent(sp, b, depth + 1)) {
             return -1;
         }
-
-        if (is_array == 0) {
-            if (add_attr(sp, b, e->attr) < 0) {
-                return -1;
-            }
-            if (add_space(sp, b)) {
-                return -1;
-            }
+        if (add_attr(sp, b, un->attr) < 0) {
+            return -1;
         }
-
-        if (addj(sp, b, e, depth) < 0) {
+        if (add_space(sp, b)) {
             return -1;
         }
-
-        if (!last) {
+        if (add_quote(sp, b, un->variants[un->selected].tag) < 0) {
+            return -1;
+        }
+        if (jlen && add_ch(sp, b, ',') < 0) {
+            return -1;
+        }
+        if (add_newline(sp, b)) {
+            return -1;
+        }
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        const size_t k = order ? order[i] : i;
+        const int last = i == n - 1;
+        if (k == jlen) { /* canonical output is never pretty printed */
+            if (add_attr(sp, b, un->attr) < 0) {
+                return -1;
+            }
+            if (add_quote(sp, b, un->variants[un->selected].tag) < 0) {
+                return -1;
+            }
+            if (!last && add_ch(sp, b, ',') < 0) {
+                return -1;
+            }
+            continue;
+        }
+        const jser_t *e = &j[k];
+        if (e->data.lu == NULL) {
+            return on_error(sp, JSER_ERR_CONFIG);
+        }
+
+        if (add_indent(sp, b, depth + 1)) {
+            return -1;
+        }
+
+        if (is_array == 0) {
+            if (add_attr(sp, b, e->attr) < 0) {
+                return -1;
+            }
+            if (add_space(sp, b)) {
+                return -1;
+            }
+        }
+
+        if (addj(sp, b, e, depth) < 0) {
+            return -1;
+        }
+
+        if (!last) {
             if (add_ch(sp, b, ',') < 0) {
                 return -1;
             }
@@ -704,17 +1273,153 @@ static int jsonify(jser_opts_t *sp, const jser_t *j, const size_t jlen, jser_buf
     return 0;
 }
 
+/* Arrays produced by a generator, we do not know which element is the last
+ * one until the generator says so, so separators come before elements. */
+static int jsonify_stream(jser_opts_t *sp, const jser_stream_t *st, jser_buffer_t *b, size_t depth)
+{
+    assert(sp);
+    assert(st);
+    assert(b);
+
+    if (sp->max != 0 && depth > sp->max) {
+        return on_error(sp, JSER_ERR_DEPTH);
+    }
+    if (add_indent(sp, b, depth)) {
+        return -1;
+    }
+    if (add_ch(sp, b, '[') < 0) {
+        return -1;
+    }
+    if (add_newline(sp, b)) {
+        return -1;
+    }
+    size_t i = 0;
+    for (;; i++) {
+        const int more = st->next(st->record, i, st->param);
+        if (more < 0) {
+            return on_error(sp, JSER_ERR_CALLBACK);
+        }
+        if (more == 0) {
+            break;
+        }
+        if (i) {
+            if (add_ch(sp, b, ',') < 0) {
+                return -1;
+            }
+            if (add_newline(sp, b)) {
+                return -1;
+            }
+        }
+        if (add_indent(sp, b, depth + 1)) {
+            return -1;
+        }
+        if (st->record->data.lu == NULL) {
+            return on_error(sp, JSER_ERR_CONFIG);
+        }
+        if (addj(sp, b, st->record, depth) < 0) {
+            return -1;
+        }
+    }
+    if (i && add_newline(sp, b)) {
+        return -1;
+    }
+    if (add_indent(sp, b, depth)) {
+        return -1;
+    }
+    if (add_ch(sp, b, ']') < 0) {
+        return -1;
+    }
+    return 0;
+}
+
 int jser_serialize_to_buffer(const jser_t *j, size_t jlen, const int pretty, jser_buffer_t *b)
 {
     assert(j);
     assert(b);
     jser_opts_t sp = {
         .max     = JSER_MAX_DEPTH,
-        .pretty  = boolify(pretty),
-        .dry_run = boolify(0),
+        .pretty  = jser_boolify(pretty),
+        .dry_run = jser_boolify(0),
         .error   = JSER_OK,
     };
-    return jsonify(&sp, j, jlen, b, 0, 0) < 0 ? sp.error : JSER_OK;
+    return jser_jsonify(&sp, j, jlen, b, 0, NULL, 0) < 0 ? sp.error : JSER_OK;
+}
+
+/* Output goes to 'sp->sink' or, if it is NULL, must fit into 'b' */
+static int jser_serialize(jser_opts_t *sp, const jser_t *j, size_t jlen, jser_buffer_t *b)
+{
+    assert(sp);
+    assert(j);
+    assert(b);
+    const jser_sink_t *sink = sp->sink;
+    sp->max    = JSER_MAX_DEPTH;
+    sp->summed = b->used;
+    if (sp->crc) {
+        *sp->crc = 0;
+    }
+    if (jser_jsonify(sp, j, jlen, b, 0, NULL, 0) < 0) {
+        return sp->error;
+    }
+    jser_checksum(sp, b);
+    if (!sink || !sink->flush) { /* the output is left in 'b' */
+        return JSER_OK;
+    }
+    if (b->used && sink->flush(sink->param, b->buf, b->used) < 0) {
+        return JSER_ERR_CALLBACK;
+    }
+    b->used = 0;
+    if (sink->flush(sink->param, b->buf, 0) < 0) { /* end of output */
+        return JSER_ERR_CALLBACK;
+    }
+    return JSER_OK;
+}
+
+int jser_serialize_to_sink(const jser_t *j, size_t jlen, const int pretty, jser_buffer_t *b, const jser_sink_t *sink)
+{
+    assert(sink);
+    assert(sink->flush || sink->grow);
+    jser_opts_t sp = { .pretty = jser_boolify(pretty), .sink = sink, };
+    return jser_serialize(&sp, j, jlen, b);
+}
+
+int jser_serialize_with_digest(const jser_t *j, size_t jlen, const int pretty, jser_buffer_t *b, const jser_sink_t *sink, unsigned long *crc)
+{
+    assert(crc);
+    assert(!sink || sink->flush || sink->grow);
+    jser_opts_t sp = { .pretty = jser_boolify(pretty), .sink = sink, .crc = crc, };
+    return jser_serialize(&sp, j, jlen, b);
+}
+
+int jser_format_prepare(jser_format_t *f, char *slab, const size_t length)
+{
+    assert(f);
+    assert(slab);
+    if (!f->indent || !f->newline) {
+        return JSER_ERR_CONFIG;
+    }
+    f->nlen = strlen(f->newline);
+    f->ilen = strlen(f->indent);
+    if (length < (f->nlen + f->ilen)) {
+        return JSER_ERR_SPACE;
+    }
+    f->levels = f->ilen ? (length - f->nlen) / f->ilen : SIZE_MAX;
+    memcpy(slab, f->newline, f->nlen);
+    for (size_t i = 0; f->ilen && i < f->levels; i++) {
+        memcpy(&slab[f->nlen + (i * f->ilen)], f->indent, f->ilen);
+    }
+    f->slab = slab;
+    return JSER_OK;
+}
+
+int jser_serialize_formatted(const jser_t *j, size_t jlen, const jser_format_t *f, jser_buffer_t *b, const jser_sink_t *sink)
+{
+    assert(f);
+    assert(!sink || sink->flush || sink->grow);
+    if (!f->slab) {
+        return JSER_ERR_CONFIG;
+    }
+    jser_opts_t sp = { .pretty = 1, .sink = sink, .format = f, };
+    return jser_serialize(&sp, j, jlen, b);
 }
 
 int jser_serialized_length(const jser_t *j, const size_t jlen, const int pretty, size_t *sz)
@@ -723,8 +1428,8 @@ int jser_serialized_length(const jser_t *j, const size_t jlen, const int pretty,
     assert(sz);
     jser_opts_t sp = {
         .max     = JSER_MAX_DEPTH,
-        .pretty  = boolify(pretty),
-        .dry_run = boolify(1),
+        .pretty  = jser_boolify(pretty),
+        .dry_run = jser_boolify(1),
         .error   = JSER_OK,
     };
     jser_buffer_t b = {
@@ -733,7 +1438,7 @@ int jser_serialized_length(const jser_t *j, const size_t jlen, const int pretty,
         .buf    = NULL,
     };
     *sz = 0;
-    if (jsonify(&sp, j, jlen, &b, 0, 0) < 0) {
+    if (jser_jsonify(&sp, j, jlen, &b, 0, NULL, 0) < 0) {
         assert(sp.error < 0);
         return sp.error;
     }
@@ -751,15 +1456,15 @@ int jser_serialize_to_asciiz(const jser_t *j, size_t jlen, int pretty, char *asc
     }
     jser_opts_t sp = {
         .max     = JSER_MAX_DEPTH,
-        .pretty  = boolify(pretty),
-        .dry_run = boolify(0),
+        .pretty  = jser_boolify(pretty),
+        .dry_run = jser_boolify(0),
     };
     jser_buffer_t b = {
         .length = length - 1ull,
         .used   = 0,
         .buf    = (unsigned char *)asciiz,
     };
-    if (jsonify(&sp, j, jlen, &b, 0, 0) < 0) {
+    if (jser_jsonify(&sp, j, jlen, &b, 0, NULL, 0) < 0) {
         asciiz[0] = '\0';
         return sp.error;
     }
@@ -767,720 +1472,5240 @@ int jser_serialize_to_asciiz(const jser_t *j, size_t jlen, int pretty, char *asc
     return JSER_OK;
 }
 
-/* ~~~ Deserialization ~~~ */
+/* ~~~ Canonical Output ~~~ */
 
-static int find_element(const jser_t *j, size_t jlen, const char *json, jsmntok_t *t)
+/* Attribute for position 'k' of an order, 'jlen' is the union tag */
+static inline const char *order_attr(const jser_t *j, const size_t jlen, const char *tag, const size_t k)
 {
-    assert(j);
-    assert(t);
-    assert(json);
-    assert(j->used <= INT_MAX);
-    const int l = t->end - t->start;
-    assert(l >= 0);
+    return k == jlen ? tag : j[k].attr;
+}
+
+/* Work out the order for one object table, unless it already has one */
+static int sort_table(jser_opts_t *sp, jser_canonical_t *c, const jser_t *j, const size_t jlen, const char *tag)
+{
+    assert(sp);
+    assert(c);
+    const size_t n = jlen + !!tag;
+    if (c->orders && c->used) { /* the elements of an array often share a table, others are merged once sorted */
+        const jser_order_t *o = &c->orders[c->used - 1];
+        if (o->j == j && o->length == jlen && o->tag == tag) {
+            return 0;
+        }
+    }
     for (size_t i = 0; i < jlen; i++) {
-        const jser_t *e = &j[i];
-        const char *attr = e->attr;
-        const size_t al = strlen(attr);
-        assert(al <= INT_MAX);
-        if ((int)al != l) {
-            continue;
+        if (!j[i].attr) {
+            return on_error(sp, JSER_ERR_CONFIG);
         }
-        if (memcmp(&json[t->start], attr, l)) {
-            continue;
+    }
+    if (!c->orders) { /* sizing only, tables used twice are counted twice */
+        c->used++;
+        c->iused += n;
+        return 0;
+    }
+    if (c->used >= c->length || (c->ilength - c->iused) < n) {
+        return on_error(sp, JSER_ERR_SPACE);
+    }
+    size_t *r = &c->indices[c->iused];
+    for (size_t i = 0; i < n; i++) { /* insertion sort, 'strcmp' compares bytes as unsigned */
+        const char *a = order_attr(j, jlen, tag, i);
+        size_t k = i;
+        for (; k > 0 && strcmp(order_attr(j, jlen, tag, r[k - 1]), a) > 0; k--) {
+            r[k] = r[k - 1];
         }
-        return i;
+        r[k] = i;
     }
-    return -1;
+    c->orders[c->used++] = (jser_order_t){ .j = j, .length = jlen, .tag = tag, .order = r, };
+    c->iused += n;
+    return 0;
 }
 
-/* A pair of mutually recursive functions, they return an error or an amount to increment through the
- * parse tokens by. */
-static int dejsonify(jser_opts_t *sp, jser_t *j, size_t jlen, jsmntok_t *token, const size_t tokens, const char *json);
+static int jser_prepare(jser_opts_t *sp, jser_canonical_t *c, const jser_t *j, const size_t jlen, const int is_array, const char *tag, size_t depth);
 
-/* TODO: Allow deserialization of arrays specified with the 'is_array' flag */
-static int json_to_element(jser_opts_t *sp, jser_t *e, jsmntok_t *token, const size_t tokens, const char *json)
+static int prepare_node(jser_opts_t *sp, jser_canonical_t *c, const jser_t *e, size_t depth)
 {
     assert(sp);
+    assert(c);
     assert(e);
-    assert(token);
-    assert(json);
-
-    int increment = 1;
-    jsmntok_t *p = &token[0];
-    const int plen = p->end - p->start;
-    if (plen < 0) {
-        return on_error(sp, JSER_ERR_UNKNOWN);
-    }
-
-    switch (p->type) {
-    case JSMN_OBJECT:
-        assert(p->size >= 0);
-        assert((p->size * 2) <= (int)tokens);
-        increment = dejsonify(sp, e->data.jser, e->used, p, p->size * 2u, json);
-        if (increment < 0) {
-            return -1;
-        }
-        break;
-    case JSMN_ARRAY: {
-        int i = 0, k = 0;
-        assert(p->size >= 0);
-        if (e->type != JSER_ARRAY_E) {
-            return -1;
-        }
-        if (JSER_ENABLE_USED_SET) {
-            e->used = 0;
+    switch (e->type) {
+    case JSER_OBJECT_E:
+        return jser_prepare(sp, c, e->data.jser, e->length, 0, NULL, depth + 1);
+    case JSER_ARRAY_E:
+        return jser_prepare(sp, c, e->data.array, e->length, 1, NULL, depth + 1);
+    case JSER_UNION_E: {
+        const jser_union_t *un = e->data.un;
+        if (!un || !un->attr) {
+            return on_error(sp, JSER_ERR_CONFIG);
         }
-        // TODO: Fix this temporary hack
-        //for (i = 1, k = 0; i < (p->size + 1); k++) {
-        for (i = 1, k = 0; i < (int)tokens; k++) {
-            assert(e->length < INT_MAX);
-            if (k > (int)e->length) {
-                return on_error(sp, JSER_ERR_SPACE);
-            }
-
-            const int r = json_to_element(sp, &e->data.jser[k], &p[i], tokens - i, json);
-            if (r < 0) {
+        for (size_t v = 0; v < un->length; v++) {
+            if (jser_prepare(sp, c, un->variants[v].jser, un->variants[v].length, 0, un->attr, depth + 1) < 0) {
                 return -1;
             }
-            if (r == 0) {
-                break;
-            }
-            i += r;
-        }
-        if (JSER_ENABLE_USED_SET) {
-            e->used = k;
-        }
-        increment = i;
-        break;
-    }
-    case JSMN_STRING: {
-        if (e->type == JSER_BUFFER_E) {
-            jser_buffer_t *buf = e->data.buf;
-            buf->used = 0;
-            size_t olen = buf->length;
-            if (jser_base64_decode((unsigned char*)&json[p->start], plen, buf->buf, &olen)) {
-                return on_error(sp, JSER_ERR_BASE64);
-            }
-            buf->used = olen;
-            assert(buf->used <= buf->length);
-        } else if (e->type == JSER_ASCIIZ_E) {
-            if (e->is_array) {
-                return on_error(sp, JSER_ERR_CONFIG);
-            }
-            if (e->length == 0) { /* A zero length ASCIIZ is invalid for deserialization, as this is a byte count */
-                return on_error(sp, JSER_ERR_TYPE); /* cannot deserialize to an ASCIIZ string without a length */
-            }
-            if (plen >= (int)e->length) {
-                return on_error(sp, JSER_ERR_TYPE);
-            }
-            memcpy(e->data.asciiz, &json[p->start], plen);
-            e->data.asciiz[plen] = '\0';
-        } else {
-            return on_error(sp, JSER_ERR_TYPE);
         }
-        break;
+        return 0;
     }
-    case JSMN_PRIMITIVE:
-        switch (json[p->start]) {
-        case 'n': /* 'null' not supported */
-            return on_error(sp, JSER_ERR_TYPE);
-        case 't':
-            if (e->type != JSER_BOOL_E) {
-                return on_error(sp, JSER_ERR_TYPE);
-            }
-            if (plen < 4 || memcmp(&json[p->start], "true", 4)) {
-                return on_error(sp, JSER_ERR_TYPE);
-            }
-            *e->data.b = true;
-            break;
-        case 'f':
-            if (e->type != JSER_BOOL_E) {
-                return on_error(sp, JSER_ERR_TYPE);
-            }
-            if (plen < 5 || memcmp(&json[p->start], "false", 5)) {
-                return on_error(sp, JSER_ERR_TYPE);
-            }
-            *e->data.b = false;
-            break;
-        case '-': case '0':
-        case '1': case '2': case '3':
-        case '4': case '5': case '6':
-        case '7': case '8': case '9': {
-            if (e->type == JSER_ULONG_E) {
-                uint64_t ud = 0;
-                if (str_to_u64(&json[p->start], plen, 10, &ud) < 0) {
-                    return on_error(sp, JSER_ERR_NUMBER);
-                }
-                *e->data.lu = ud;
-            } else if (e->type == JSER_LONG_E) {
-                int64_t ld = 0;
-                if (str_to_i64(&json[p->start], plen, 10, &ld) < 0) {
-                    return on_error(sp, JSER_ERR_NUMBER);
-                }
-                *e->data.ld = ld;
-            } else {
-                return on_error(sp, JSER_ERR_TYPE);
-            }
-            break;
-        }
-        default:
-            return on_error(sp, JSER_ERR_PARSE);
+    case JSER_STREAM_E:
+        if (!e->data.stream || !e->data.stream->record) {
+            return on_error(sp, JSER_ERR_CONFIG);
         }
-        break;
+        return prepare_node(sp, c, e->data.stream->record, depth);
     default:
-        // TODO: Fix this temporary hack
         return 0;
-        return on_error(sp, JSER_ERR_UNKNOWN);
     }
-    return increment;
 }
 
-/* We need to be able to calculate the number of tokens to skip for the parser. */
-static int distance(const jsmntok_t *t, const int ts)
+static int jser_prepare(jser_opts_t *sp, jser_canonical_t *c, const jser_t *j, const size_t jlen, const int is_array, const char *tag, size_t depth)
 {
-    assert(t);
-    assert(ts >= 0);
-    int r = 1;
-    if (ts == 0) {
+    assert(sp);
+    assert(c);
+    assert(j || jlen == 0);
+    if (sp->max != 0 && depth > sp->max) {
+        return on_error(sp, JSER_ERR_DEPTH);
+    }
+    if (!is_array && sort_table(sp, c, j, jlen, tag) < 0) {
         return -1;
     }
-    switch (t->type) {
-    case JSMN_STRING:
-    case JSMN_PRIMITIVE:
-        break;
-    case JSMN_OBJECT:
-        for (int i = 1; i < ts; i += 2) {
-            if (t[i].type != JSMN_STRING) {
-                return -1;
-            }
-            if ((i + 1) >= ts) {
-                return -1;
-            }
-            if (t[i + 1].type == JSMN_OBJECT || t[i + 1].type == JSMN_ARRAY) {
-                /* BUG: distance is not calculated correctly */
-                const int st = distance(&t[i + 1], t[i + 1].size);
-                if (st < 0) {
-                    return -1;
-                }
-                i += st;
-                r += st + 1;
-            } else {
-                r += 2;
-            }
-        }
-        break;
-    case JSMN_ARRAY:
-        for (int i = 1; i < ts; i++) {
-            if (t[i].type == JSMN_OBJECT || t[i].type == JSMN_ARRAY) {
-                const int st = distance(&t[i + 1], t[i + 1].size);
-                if (st < 0) {
-                    return -1;
-                }
-                i += st;
-                r += st;
-            }
+    for (size_t i = 0; i < jlen; i++) {
+        if (prepare_node(sp, c, &j[i], depth) < 0) {
+            return -1;
         }
-        break;
-    case JSMN_UNDEFINED:
-    default:
-        return -1;
     }
-    return r;
+    return 0;
 }
 
-static int dejsonify(jser_opts_t *sp, jser_t *j, const size_t jlen, jsmntok_t*token, const size_t tokens, const char *json)
+int jser_canonical_prepare(const jser_t *j, const size_t jlen, jser_canonical_t *c)
 {
-    assert(sp);
-    assert(j);
-    assert(token);
-
-    if (token->type == JSMN_UNDEFINED) {
-        return 0; /* End of Input */
+    assert(j || jlen == 0);
+    assert(c);
+    jser_opts_t sp = { .max = JSER_MAX_DEPTH, };
+    c->used  = 0;
+    c->iused = 0;
+    if (!c->orders != !c->indices) {
+        return JSER_ERR_CONFIG;
     }
-    if (token->type != JSMN_OBJECT && token->type != JSMN_ARRAY) {
-        return on_error(sp, JSER_ERR_PARSE);
+    if (jser_prepare(&sp, c, j, jlen, 0, NULL, 0) < 0) {
+        return sp.error;
     }
-    size_t i = 0;
-    for (i = 1; i < tokens; i++) {
-        jsmntok_t *t = &token[i];
-
-        switch (t->type) {
-        case JSMN_UNDEFINED:
-            return 0; /* done */
-        case JSMN_STRING: {
-            jsmntok_t *p = &token[i + 1];
-            const int element = find_element(j, jlen, json, t);
-            if (element < 0) { /* value not found, skip next tokens */
-                if ((i + 1) >= tokens) {
-                    return JSER_ERR_LENGTH;
-                }
-                assert((i + 1) < tokens);
-                assert(token[i + 1].type != JSMN_UNDEFINED);
-                i += distance(t, t->size);
-                break;
-            }
-            jser_t *e = &j[element];
-            const int increment = json_to_element(sp, e, p, tokens - i, json);
-            if (increment < 1) {
-                return on_error(sp, JSER_ERR_UNKNOWN);
+    if (c->orders && c->used) { /* sorted so 'jser_ordering' can search them, with tables met twice merged */
+        qsort(c->orders, c->used, sizeof (*c->orders), order_compare);
+        size_t k = 1;
+        for (size_t i = 1; i < c->used; i++) {
+            if (order_compare(&c->orders[k - 1], &c->orders[i])) {
+                c->orders[k++] = c->orders[i];
             }
-            i += increment;
-            break;
-        }
-        case JSMN_OBJECT: case JSMN_ARRAY:  case JSMN_PRIMITIVE: /* none of these values can be an attribute, only strings */
-        default:
-            return on_error(sp, JSER_ERR_UNKNOWN);
         }
+        c->used = k;
     }
+    return JSER_OK;
+}
 
-    assert(i < INT_MAX);
-    return i;
+/* Attributes in bytewise order, at every level, and no white space; the same
+ * values always produce the same bytes whatever the order of the 'jser_t'
+ * tables, so the output can be hashed and compared. */
+int jser_serialize_canonical(const jser_t *j, size_t jlen, const jser_canonical_t *c, jser_buffer_t *b, const jser_sink_t *sink)
+{
+    assert(c);
+    assert(c->orders || c->used == 0);
+    assert(!sink || sink->flush || sink->grow);
+    jser_opts_t sp = { .sink = sink, .canon = c, };
+    return jser_serialize(&sp, j, jlen, b);
 }
 
-int jser_deserialize_from_buffer(jser_t *j, size_t jlen, jsmntok_t *t, const size_t tokens, jser_buffer_t *b)
+/* ~~~ Batches ~~~ */
+
+static int batch_count(void *param, const unsigned char *buf, size_t length)
 {
-    assert(j);
-    assert(t);
-    assert(b);
-    assert(tokens <= UINT_MAX);
-    jser_opts_t sp = { .max = JSER_MAX_DEPTH, };
-    jsmn_parser jp = { 0, 0, 0 };
-    jsmn_init(&jp);
-    memset(t, 0, sizeof (*t) * tokens);
-    const int rv = jsmn_parse(&jp, (const char *)b->buf, b->used, t, tokens);
-    if (rv < 0)
-        switch (rv) {
-        case JSMN_ERROR_NOMEM: return JSER_ERR_SPACE;
-        case JSMN_ERROR_INVAL: return JSER_ERR_PARSE;
-        case JSMN_ERROR_PART:  return JSER_ERR_MORE_DAT;
-        default:               return JSER_ERR_UNKNOWN;
-        }
-    const int r = dejsonify(&sp, j, jlen, t, tokens, (char *)(b->buf));
-    if (sp.error < 0) {
-        return sp.error;
+    assert(param);
+    jser_batch_t *w = param;
+    if (w->sink->flush(w->sink->param, buf, length) < 0) {
+        return -1;
     }
-    return r;
+    w->flushed += length;
+    return 0;
 }
 
-int jser_deserialize_from_asciiz(jser_t *j, size_t jlen, jsmntok_t *t, const size_t tokens, const char *asciiz)
+/* Serialize a record without ending the output, 'sink' may be NULL */
+static int batch_record(jser_batch_t *w, const jser_t *j, const size_t jlen, const jser_sink_t *sink)
 {
-    assert(j);
-    assert(t);
-    assert(asciiz);
-    const size_t length = strlen(asciiz);
-    jser_buffer_t b = {
-        .length = length,
-        .used   = length,
-        .buf    = (unsigned char *)asciiz,
+    assert(w);
+    jser_opts_t sp = {
+        .max     = JSER_MAX_DEPTH,
+        .error   = JSER_OK,
+        .sink    = sink,
+        .canon   = w->canon,
     };
-    return jser_deserialize_from_buffer(j, jlen, t, tokens, &b);
+    if (jser_jsonify(&sp, j, jlen, w->b, 0, NULL, 0) < 0) {
+        return sp.error;
+    }
+    if (!w->prefixed && add_ch(&sp, w->b, '\n') < 0) {
+        return sp.error;
+    }
+    return JSER_OK;
 }
 
-/* ~~~ Node retrieval and Tree Walking ~~~ */
-
-static long copy(const jser_t *src, size_t slen, jser_t *pool, size_t plen)
+/* Records are written compactly, followed by a newline (NDJSON), or each
+ * preceded by its length. The length is filled in once the record has been
+ * written, so a length prefixed record must fit into 'b' in one piece if
+ * the sink flushes, when it does not the output before it is flushed and
+ * it is tried again, which means generators must be able to restart. */
+int jser_batch_append(jser_batch_t *w, const jser_t *j, size_t jlen)
 {
-    assert(src);
-    assert(pool);
-    size_t k = 0;
-    for (size_t i = 0; i < slen; i++) {
-        const jser_t *s = &src[i];
-        if (k >= plen) {
-            return -1;
+    assert(w);
+    assert(w->b);
+    assert(j || jlen == 0);
+    jser_buffer_t *b = w->b;
+    if (w->offsets && w->used >= w->length) {
+        return JSER_ERR_SPACE;
+    }
+    const jser_sink_t counter = { .flush = batch_count, .param = w, };
+    const jser_sink_t *sink = w->sink && w->sink->flush ? &counter : w->sink;
+    size_t mark = b->used, start = w->flushed + mark;
+    if (!w->prefixed) {
+        const size_t flushed = w->flushed;
+        const int r = batch_record(w, j, jlen, sink);
+        if (r < 0) {
+            if (w->flushed == flushed) { /* drop what was written of the record, unless it has been flushed */
+                b->used = mark;
+            }
+            return r;
         }
-        pool[k] = *s;
-        switch (s->type) {
-        case JSER_OBJECT_E:
-        case JSER_ARRAY_E: {
-            const long st = copy(s->data.jser, s->used, &pool[k], plen);
-            if (st < 0) {
-                return -1;
+    } else {
+        const jser_sink_t *whole = sink == &counter ? NULL : sink; /* record cannot be split */
+        for (int retry = 0;; retry++) {
+            jser_opts_t sp = { .sink = whole, };
+            int r = jser_reserve(&sp, b, 4) < 0 ? sp.error : JSER_OK;
+            if (r == JSER_OK) {
+                memset(&b->buf[b->used], 0, 4);
+                b->used += 4;
+                r = batch_record(w, j, jlen, whole);
             }
-            if (k < k + st) { /* overflow */
-                return -1;
+            if (r == JSER_OK) {
+                break;
             }
-            if (st != 0) {
-                pool[k].data.jser = &pool[k + 1];
+            b->used = mark;
+            if (r != JSER_ERR_SPACE || retry || sink != &counter || mark == 0) {
+                return r;
             }
-            k += st;
-            break;
+            if (batch_count(w, b->buf, mark) < 0) {
+                return JSER_ERR_CALLBACK;
+            }
+            b->used = 0;
+            mark  = 0;
+            start = w->flushed;
         }
-        default:
-            k++;
-            break;
+        const size_t n = b->used - mark - 4;
+        if (n > 0xFFFFFFFFul) {
+            b->used = mark;
+            return JSER_ERR_LENGTH;
+        }
+        for (size_t i = 0; i < 4; i++) {
+            b->buf[mark + i] = (n >> (24 - (8 * i))) & 0xFFu;
         }
     }
-    return k;
+    if (w->offsets) {
+        w->offsets[w->used] = start;
+    }
+    w->used++;
+    return JSER_OK;
 }
 
-int jser_copy(const jser_t *src, const size_t slen, jser_t *pool, size_t *plen)
+int jser_batch_finish(jser_batch_t *w)
 {
-    assert(src);
-    assert(pool);
-    assert(plen);
-    const long st = copy(src, slen, pool, *plen);
-    if (st < 0) {
-        *plen = 0;
-        return -1;
+    assert(w);
+    assert(w->b);
+    jser_buffer_t *b = w->b;
+    if (!w->sink || !w->sink->flush) {
+        return JSER_OK;
+    }
+    if (b->used && batch_count(w, b->buf, b->used) < 0) {
+        return JSER_ERR_CALLBACK;
+    }
+    b->used = 0;
+    if (w->sink->flush(w->sink->param, b->buf, 0) < 0) { /* end of output */
+        return JSER_ERR_CALLBACK;
+    }
+    return JSER_OK;
+}
+
+/* ~~~ Resumable Serialization ~~~ */
+
+/* The encoder writes the same compact output as 'jser_serialize_to_buffer'
+ * into as many buffers as it takes, stopping whenever one is full. Each
+ * step queues up the pieces of an attribute or value as runs of bytes
+ * pointing into the tree, and the runs are copied out as there is room;
+ * the tree must not change until the encoder is finished with it. */
+
+enum { RUN_COPY, RUN_ESCAPE, RUN_BASE64, };
+
+static int encode_fail(jser_encoder_t *w, const int error)
+{
+    assert(w);
+    assert(error < 0);
+    w->error = w->error ? w->error : error;
+    return -1;
+}
+
+static void jser_run(jser_encoder_t *w, const void *p, const size_t n, const int mode)
+{
+    assert(w);
+    assert(p || n == 0);
+    assert(w->count < ELEMENTS(w->runs));
+    w->runs[w->count++] = (jser_run_t){ .p = p, .n = n, .mode = mode, };
+}
+
+static inline void run_str(jser_encoder_t *w, const char *s)
+{
+    assert(s);
+    jser_run(w, s, strlen(s), RUN_COPY);
+}
+
+static void run_quoted(jser_encoder_t *w, const char *s, const char *after)
+{
+    assert(s);
+    assert(after);
+    run_str(w, "\"");
+    jser_run(w, s, strlen(s), JSER_ENABLE_ESCAPE ? RUN_ESCAPE : RUN_COPY);
+    run_str(w, after);
+}
+
+static inline char jser_escape(const int ch)
+{
+    switch (ch) {
+    case '\b': return 'b';
+    case '\f': return 'f';
+    case '\n': return 'n';
+    case '\r': return 'r';
+    case '\t': return 't';
+    case '\\': return '\\';
+    case '"':  return '"';
     }
-    *plen = st;
     return 0;
 }
 
-int jser_walk_tree(const jser_t *j, size_t jlen, int (*fn)(const jser_t *e, void *param), void *param)
+/* Copy queued runs into 'b' until one or the other runs out */
+static void encode_runs(jser_encoder_t *w, jser_buffer_t *b)
 {
-    assert(j);
-    assert(fn);
-    for (size_t i = 0; i < jlen; i++) {
-        const jser_t *e = &j[i];
-        switch (e->type) {
-        case JSER_OBJECT_E:
-        case JSER_ARRAY_E:
-            if (fn(e, param) < 0) {
-                return -1;
-            }
-            if (jser_walk_tree(e->data.jser, e->used, fn, param) < 0) {
-                return -1;
-            }
+    assert(w);
+    assert(b);
+    const size_t used = b->used;
+    while (b->used < b->length) {
+        if (w->cpos < w->clen) {
+            b->buf[b->used++] = w->carry[w->cpos++];
+            continue;
+        }
+        if (w->head == w->count) {
+            w->head = w->count = 0;
             break;
-        default:
-            if (fn(e, param) < 0) {
-                return -1;
+        }
+        jser_run_t *r = &w->runs[w->head];
+        if (r->n == 0) {
+            w->head++;
+            continue;
+        }
+        const size_t room = b->length - b->used;
+        size_t k = r->n < room ? r->n : room;
+        if (r->mode == RUN_ESCAPE) {
+            for (size_t i = 0; i < k; i++) {
+                const char esc = jser_escape(r->p[i]);
+                if (esc) {
+                    w->carry[0] = '\\';
+                    w->carry[1] = esc;
+                    w->clen = 2;
+                    w->cpos = 0;
+                    memcpy(&b->buf[b->used], r->p, i);
+                    b->used += i;
+                    r->p += i + 1;
+                    r->n -= i + 1;
+                    k = 0;
+                    break;
+                }
             }
+        } else if (r->mode == RUN_BASE64) {
+            size_t nl = sizeof w->carry;
+            if (room < 4) { /* a group at a time, through 'carry' */
+                k = r->n < 3 ? r->n : 3;
+                jser_base64_encode(r->p, k, w->carry, &nl);
+                w->clen = 4;
+                w->cpos = 0;
+            } else { /* whole groups of three bytes, unless at the end */
+                k = (room / 4ull) * 3ull < r->n ? (room / 4ull) * 3ull : r->n;
+                nl = room;
+                jser_base64_encode(r->p, k, &b->buf[b->used], &nl);
+                b->used += base64_encoded_size(k);
+            }
+            r->p += k;
+            r->n -= k;
+            continue;
         }
+        memcpy(&b->buf[b->used], r->p, k);
+        b->used += k;
+        r->p += k;
+        r->n -= k;
     }
-    return 0;
+    w->written += b->used - used;
 }
 
-typedef struct {
-    size_t nodes;
-} counter_t;
-
-static int fn_walk_tree_count(const jser_t *e, void *param)
+static int encode_value(jser_encoder_t *w, const jser_type_e type, const jser_type_u *u, const size_t index)
 {
-    assert(e);
-    assert(param);
-    ((counter_t *)param)->nodes++;
-    return 0;
+    assert(w);
+    assert(u);
+    switch (type) {
+    case JSER_LONG_E:
+        i64_to_str(w->number, u->ld[index], 10);
+        run_str(w, w->number);
+        return 0;
+    case JSER_ULONG_E:
+        u64_to_str(w->number, u->lu[index], 10);
+        run_str(w, w->number);
+        return 0;
+    case JSER_BOOL_E:
+        run_str(w, u->b[index] ? "true" : "false");
+        return 0;
+    case JSER_ASCIIZ_E:
+        if (index != 0) { /* cannot be indexed */
+            return encode_fail(w, JSER_ERR_CONFIG);
+        }
+        run_quoted(w, u->asciiz, "\"");
+        return 0;
+    case JSER_BUFFER_E: {
+        const jser_buffer_t *buf = &u->buf[index];
+        implies(buf->used, buf->buf);
+        run_str(w, "\"");
+        jser_run(w, buf->buf, buf->used, RUN_BASE64);
+        run_str(w, "\"");
+        return 0;
+    }
+    default:
+        break;
+    }
+    return encode_fail(w, JSER_ERR_TYPE);
 }
 
-int jser_node_count(const jser_t *j, size_t *jlen)
+static int encode_push(jser_encoder_t *w, const jser_t *e, const jser_t *j, const size_t jlen, const char *open)
 {
-    assert(j);
-    assert(jlen);
-    counter_t c = { .nodes = 0 };
-    const int r = jser_walk_tree(j, *jlen, fn_walk_tree_count, &c);
-    if (r < 0) {
-        *jlen = 0;
-        return -1;
+    assert(w);
+    assert(open);
+    if (w->top >= w->depth || (JSER_MAX_DEPTH != 0 && w->top > JSER_MAX_DEPTH)) {
+        return encode_fail(w, JSER_ERR_DEPTH);
     }
-    *jlen = c.nodes;
+    w->stack[w->top++] = (jser_level_t){ .e = e, .j = j, .jlen = jlen, };
+    run_str(w, open);
     return 0;
 }
 
-static int jser_node_finder(jser_opts_t *sp, const jser_t *j, size_t jlen, jser_t **const found, const char *path, size_t depth)
+/* Start writing the element 'e', its attribute has already been queued */
+static int encode_element(jser_encoder_t *w, const jser_t *e)
 {
-    assert(j);
-    assert(found);
-    assert(path);
-
-    if (sp->max != 0 && depth > JSER_MAX_DEPTH) {
-        return on_error(sp, JSER_ERR_DEPTH);
+    assert(w);
+    assert(e);
+    if (e->data.lu == NULL) {
+        return encode_fail(w, JSER_ERR_CONFIG);
+    }
+    switch (e->type) {
+    case JSER_OBJECT_E:
+        if (e->is_array) {
+            return encode_fail(w, JSER_ERR_CONFIG);
+        }
+        return encode_push(w, e, e->data.jser, e->length, "{");
+    case JSER_UNION_E: {
+        const jser_union_t *un = e->data.un;
+        if (e->is_array || un->selected >= un->length || !un->attr) {
+            return encode_fail(w, JSER_ERR_CONFIG);
+        }
+        const jser_variant_t *v = &un->variants[un->selected];
+        if (!v->tag || (v->length && !v->jser)) {
+            return encode_fail(w, JSER_ERR_CONFIG);
+        }
+        if (encode_push(w, e, v->jser, v->length, "{") < 0) {
+            return -1;
+        }
+        run_quoted(w, un->attr, "\":"); /* the tag of a union always comes first */
+        run_quoted(w, v->tag, "\"");
+        w->stack[w->top - 1].n = 1;
+        return 0;
+    }
+    case JSER_CHUNKED_E: /* input only */
+        return encode_fail(w, JSER_ERR_CONFIG);
+    case JSER_STREAM_E: {
+        const jser_stream_t *st = e->data.stream;
+        if (e->is_array || !st->next || !st->record) {
+            return encode_fail(w, JSER_ERR_CONFIG);
+        }
+        return encode_push(w, e, NULL, 0, "[");
+    }
+    case JSER_ARRAY_E:
+        return encode_push(w, e, e->data.array, e->length, "[");
+    default:
+        break;
     }
+    if (e->is_array) { /* values written one per step */
+        return encode_push(w, e, NULL, 0, "[");
+    }
+    return encode_value(w, e->type, &e->data, 0);
+}
 
-    *found = NULL;
-    if (*path == '\0') {
+/* Queue up the next piece of output for the innermost level */
+static int encode_step(jser_encoder_t *w)
+{
+    assert(w);
+    assert(w->top);
+    jser_level_t *l = &w->stack[w->top - 1];
+    const jser_t *e = l->e;
+    const jser_type_e type = e ? e->type : JSER_OBJECT_E;
+    const bool object = type == JSER_OBJECT_E || type == JSER_UNION_E;
+    const bool values = !object && type != JSER_ARRAY_E && type != JSER_STREAM_E;
+    bool end = false;
+    if (type == JSER_STREAM_E) {
+        const jser_stream_t *st = e->data.stream;
+        const int more = st->next(st->record, l->k, st->param);
+        if (more < 0) {
+            return encode_fail(w, JSER_ERR_CALLBACK);
+        }
+        end = more == 0;
+    } else {
+        end = l->k >= (values ? e->used : l->jlen);
+    }
+    if (end) {
+        run_str(w, object ? "}" : "]");
+        w->top--;
         return 0;
     }
-    while (*path == '/') {
-        path++;
+    if (l->n++) {
+        run_str(w, ",");
+    }
+    const size_t k = l->k++;
+    if (type == JSER_STREAM_E) {
+        return encode_element(w, e->data.stream->record);
+    }
+    if (values) {
+        return encode_value(w, type, &e->data, k);
     }
+    if (object) {
+        run_quoted(w, l->j[k].attr, "\":");
+    }
+    return encode_element(w, &l->j[k]);
+}
 
-    const char *end = strchr(path, '/');
-    if (end == NULL) {
-        end = path + strlen(path);
+int jser_encoder_init(jser_encoder_t *w, const jser_t *j, size_t jlen, jser_level_t *stack, size_t depth)
+{
+    assert(w);
+    assert(j || jlen == 0);
+    assert(stack || depth == 0);
+    memset(w, 0, sizeof (*w));
+    w->stack = stack;
+    w->depth = depth;
+    return encode_push(w, NULL, j, jlen, "{") < 0 ? w->error : JSER_OK;
+}
+
+int jser_encode(jser_encoder_t *w, jser_buffer_t *b)
+{
+    assert(w);
+    assert(b);
+    assert(b->used <= b->length);
+    if (w->error) {
+        return w->error;
     }
-    const size_t nl = end - path;
-    for (size_t i = 0; i < jlen; i++) {
-        const jser_t *e = &j[i];
-        const char *attr = e->attr;
-        const size_t al = strlen(attr);
-        if (al != nl) {
-            continue;
-        }
-        if (memcmp(attr, path, al)) {
-            continue;
-        }
-        if (*end == '\0') {
-            *found = (jser_t *)e;
+    for (;;) {
+        encode_runs(w, b);
+        if (w->cpos < w->clen || w->count) {
             return 1;
         }
-        if (e->type != JSER_OBJECT_E) {
-            return 0;
+        if (w->top == 0) {
+            return JSER_OK;
+        }
+        if (encode_step(w) < 0) {
+            return w->error;
         }
-        /* NB. We could retrieve an array element by processing
-         * a node name as a number.  */
-        return jser_node_finder(sp, e->data.jser, e->used, found, end + 1, depth + 1);
     }
-    return 0;
 }
 
-int jser_retrieve_node(const jser_t *j, const size_t jlen, jser_t **found, const char *path)
+/* Output is the only work the encoder does, each step of it queues at
+ * least a byte, so 'budget' bounds the time taken as well */
+int jser_encode_step(jser_encoder_t *w, jser_buffer_t *b, size_t budget, jser_progress_t *progress)
 {
-    assert(j);
-    assert(found);
-    assert(path);
-    jser_opts_t sp = {
-        .max     = JSER_MAX_DEPTH,
-    };
-    return jser_node_finder(&sp, j, jlen, found, path, 0);
+    assert(w);
+    assert(b);
+    assert(b->used <= b->length);
+    const size_t length = b->length;
+    if (budget < (length - b->used)) {
+        b->length = b->used + budget;
+    }
+    const int r = jser_encode(w, b);
+    b->length = length;
+    if (progress) {
+        progress->bytes  = w->written;
+        progress->tokens = 0;
+        progress->total  = 0;
+    }
+    return r;
 }
 
-/* ~~~ Tests ~~~ */
+/* ~~~ Deserialization ~~~ */
 
-/* NB. Might want to export this function under a different name */
-static inline int test_json_element(const jser_t *j, const size_t jlen, const int pretty, char *asciiz, size_t asciiz_length)
+/* Copy 'length' bytes of input starting at 'offset' into 'dst' */
+static void jser_gather(const jser_input_t *in, size_t offset, unsigned char *dst, size_t length)
 {
-    assert(j);
-    assert(asciiz);
-    jser_opts_t sp = {
-        .pretty  = boolify(pretty),
-        .max     = JSER_MAX_DEPTH,
-        .dry_run = 0,
-    };
-    jser_buffer_t buf = {
-        .used   = 0,
+    assert(in);
+    assert(dst || length == 0);
+    for (size_t i = 0; i < in->count && length; i++) {
+        const jser_buffer_t *s = &in->segments[i];
+        if (offset >= s->used) {
+            offset -= s->used;
+            continue;
+        }
+        const size_t n = length < (s->used - offset) ? length : s->used - offset;
+        memcpy(dst, &s->buf[offset], n);
+        dst += n;
+        length -= n;
+        offset = 0;
+    }
+    assert(length == 0);
+}
+
+/* Add the input up to 'offset' to the running CRC */
+static void jser_digest(jser_input_t *in, const size_t offset)
+{
+    assert(in);
+    assert(in->crc);
+    size_t base = 0;
+    for (size_t i = 0; i < in->count && in->summed < offset; i++) {
+        const jser_buffer_t *s = &in->segments[i];
+        const size_t hi = base + s->used;
+        if (in->summed < hi) {
+            const size_t to = offset < hi ? offset : hi;
+            *in->crc = jser_crc32c_update(*in->crc, &s->buf[in->summed - base], to - in->summed);
+            in->summed = to;
+        }
+        base = hi;
+    }
+}
+
+/* The bytes of a token not within the segment last used, they may be
+ * spread over more than one segment of input, in which case they are copied
+ * into the second half of the bounce buffer. */
+static const char *text_search(jser_opts_t *sp, const size_t start, const size_t end)
+{
+    assert(sp);
+    assert(sp->in);
+    assert(start <= end);
+    jser_input_t *in = sp->in;
+    if (start == end) {
+        return "";
+    }
+    size_t seg = 0, base = 0;
+    for (; seg < in->count && start >= (base + in->segments[seg].used); seg++) {
+        base += in->segments[seg].used;
+    }
+    if (seg < in->count && end <= (base + in->segments[seg].used)) {
+        in->cur = (const char *)in->segments[seg].buf;
+        in->lo  = base;
+        in->hi  = base + in->segments[seg].used;
+        return &in->cur[start - base];
+    }
+    jser_buffer_t *b = in->bounce;
+    if (b && start >= in->window && end <= (in->window + in->wlen)) {
+        return (const char *)&b->buf[start - in->window];
+    }
+    const size_t half = b ? b->length / 2 : 0;
+    if ((end - start) > half) {
+        (void)on_error(sp, JSER_ERR_SPACE);
+        return NULL;
+    }
+    jser_gather(in, start, &b->buf[half], end - start);
+    return (const char *)&b->buf[half];
+}
+
+static inline const char *jser_text(jser_opts_t *sp, const jsmntok_t *t)
+{
+    assert(sp);
+    assert(sp->in);
+    assert(t);
+    const jser_input_t *in = sp->in;
+    const size_t start = t->start, end = t->end;
+    if (start >= in->lo && end <= in->hi) {
+        return &in->cur[start - in->lo];
+    }
+    return text_search(sp, start, end);
+}
+
+/* Is the key at 't', 'l' bytes long, the attribute of 'e'? */
+static inline bool is_key(jser_opts_t *sp, const jser_t *e, const jsmntok_t *t, const size_t l)
+{
+    assert(sp);
+    assert(e);
+    assert(t);
+    const char *attr = e->attr;
+    if (!attr) {
+        return false;
+    }
+    const size_t al = strlen(attr);
+    if (al != l) {
+        return false;
+    }
+    const jser_input_t *in = sp->in;
+    const size_t start = t->start, end = t->end;
+    if (start >= in->lo && end <= in->hi) { /* comparing is cheaper than hashing the attribute */
+        return !memcmp(&in->cur[start - in->lo], attr, l);
+    }
+#if JSER_ENABLE_VALUES
+    if ((t->flags & JSMN_VALUE) && jser_fnv1a(FNV1A_BASIS, attr, al) != t->value) {
+        return false; /* the key is only gathered from the input to confirm a match */
+    }
+#endif
+    const char *key = jser_text(sp, t);
+    return key && !memcmp(key, attr, l);
+}
+
+static int find_element(jser_opts_t *sp, const jser_t *j, size_t jlen, const jsmntok_t *t)
+{
+    assert(sp);
+    assert(j || jlen == 0);
+    assert(t);
+    const jsmnint_t l = t->end - t->start;
+    assert(l >= 0);
+    for (size_t i = 0; i < jlen; i++) {
+        if (is_key(sp, &j[i], t, l)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* Like 'find_element', but the attributes of the frame 'f' are tried in the
+ * order in 'f->probe', starting after the last one found, and the position
+ * the key arrived at in its object is noted against the attribute it matches
+ * when learning that order. Once the order is the one keys arrive in each
+ * lookup takes a single comparison. */
+static int find_probed(jser_opts_t *sp, jser_frame_t *f, const jsmntok_t *t)
+{
+    assert(sp);
+    assert(sp->lookup);
+    assert(f);
+    assert(f->probe);
+    assert(t);
+    jser_lookup_t *l = sp->lookup;
+    jser_probe_t *p = f->probe;
+    const jsmnint_t kl = t->end - t->start;
+    assert(kl >= 0);
+    const size_t position = f->keys++;
+    l->lookups++;
+    for (size_t n = 0, i = f->next; n < f->jlen; n++, i = i + 1 < f->jlen ? i + 1 : 0) {
+        const size_t k = p->order[i];
+        l->probes++;
+        if (is_key(sp, &f->j[k], t, kl)) {
+            if (l->learn) {
+                p->sum[k] += position;
+                p->seen[k]++;
+            }
+            f->next = i + 1 < f->jlen ? i + 1 : 0;
+            return k;
+        }
+    }
+    return -1;
+}
+
+/* The number of tokens taken up by the value at 't', including all of its
+ * children. Children always start before their parent ends, this avoids
+ * having to recurse and copes with the lax input that 'jsmn' accepts (such
+ * as missing commas). */
+static jsmnint_t jser_skip(const jsmntok_t *t, const size_t tokens)
+{
+    assert(t);
+    assert(tokens <= JSMNINT_MAX);
+    if (tokens == 0) {
+        return -1;
+    }
+    size_t i = 1;
+    if (t->type == JSMN_OBJECT || t->type == JSMN_ARRAY) {
+        while (i < tokens && t[i].start < t->end) {
+            i++;
+        }
+    }
+    return i;
+}
+
+static int find_variant(jser_opts_t *sp, jser_union_t *un, const jsmntok_t *token, const size_t tokens)
+{
+    assert(sp);
+    assert(un);
+    assert(token);
+    assert(token->type == JSMN_OBJECT);
+    if (!un->attr) {
+        return on_error(sp, JSER_ERR_CONFIG);
+    }
+    const jser_t tag = { .attr = un->attr, };
+    for (size_t i = 1; i < tokens && token[i].start < token->end;) {
+        const jsmntok_t *key = &token[i], *value = &token[i + 1];
+        if ((i + 1) >= tokens || key->type != JSMN_STRING) {
+            return on_error(sp, JSER_ERR_PARSE);
+        }
+        if (find_element(sp, &tag, 1, key) == 0) {
+            if (value->type != JSMN_STRING) {
+                return on_error(sp, JSER_ERR_TYPE);
+            }
+            const jsmnint_t vl = value->end - value->start;
+            const char *v = jser_text(sp, value);
+            if (!v) {
+                return -1;
+            }
+            for (size_t k = 0; k < un->length; k++) {
+                const char *t = un->variants[k].tag;
+                if (t && strlen(t) == (size_t)vl && !memcmp(t, v, vl)) {
+                    return k;
+                }
+            }
+            return on_error(sp, JSER_ERR_TYPE); /* unknown tag */
+        }
+        const jsmnint_t st = jser_skip(value, tokens - i - 1);
+        if (st < 0) {
+            return on_error(sp, JSER_ERR_LENGTH);
+        }
+        i += 1 + st;
+    }
+    return on_error(sp, JSER_ERR_TYPE); /* no tag */
+}
+
+static int chunk_flush(jser_opts_t *sp, const jser_chunked_t *c, const bool last)
+{
+    assert(sp);
+    assert(c);
+    jser_buffer_t *buf = c->buf;
+    if (c->chunk(c->param, buf->buf, buf->used, last) < 0) {
+        return on_error(sp, JSER_ERR_CALLBACK);
+    }
+    buf->used = 0;
+    return 0;
+}
+
+/* Room for at least 'n' more bytes of decoded output */
+static int chunk_room(jser_opts_t *sp, const jser_chunked_t *c, const size_t n)
+{
+    assert(sp);
+    assert(c);
+    assert(c->buf->used <= c->buf->length);
+    if ((c->buf->length - c->buf->used) >= n) {
+        return 0;
+    }
+    return chunk_flush(sp, c, false);
+}
+
+/* Decode base64 into the scratch buffer of 'c'. If more of the value is to
+ * follow 'taken' is set to the input used, which ends after the last whole
+ * group of four. */
+static int chunk_base64(jser_opts_t *sp, const jser_chunked_t *c, const unsigned char *in, const size_t len, size_t *taken)
+{
+    assert(sp);
+    assert(c);
+    assert(in);
+    jser_buffer_t *b = c->buf;
+    uint32_t buf = 0;
+    unsigned iter = 0;
+    size_t group = 0;
+    for (size_t i = 0; i < len; i++) {
+        const unsigned char d = base64_decode_table[in[i]];
+        if (d == WS) {
+            continue;
+        }
+        if (d == XX) {
+            return on_error(sp, JSER_ERR_BASE64);
+        }
+        if (d == EQ) {
+            break;
+        }
+        buf = (buf << 6) | d;
+        if (++iter == 4) {
+            if (chunk_room(sp, c, 3) < 0) {
+                return -1;
+            }
+            b->buf[b->used++] = (buf >> 16) & 0xFFul;
+            b->buf[b->used++] = (buf >>  8) & 0xFFul;
+            b->buf[b->used++] = (buf >>  0) & 0xFFul;
+            buf   = 0;
+            iter  = 0;
+            group = i + 1;
+        }
+    }
+    if (taken) {
+        *taken = group;
+        return 0;
+    }
+    if (chunk_room(sp, c, 2) < 0) {
+        return -1;
+    }
+    if (iter == 3) {
+        b->buf[b->used++] = (buf >> 10) & 0xFFul;
+        b->buf[b->used++] = (buf >>  2) & 0xFFul;
+    } else if (iter == 2) {
+        b->buf[b->used++] = (buf >> 4) & 0xFFul;
+    }
+    return 0;
+}
+
+static long jser_hex4(const char *s)
+{
+    assert(s);
+    long r = 0;
+    for (int i = 0; i < 4; i++) {
+        const int d = jser_digit(s[i], 16);
+        if (d < 0) {
+            return -1;
+        }
+        r = (r << 4) | d;
+    }
+    return r;
+}
+
+static size_t jser_utf8(unsigned char b[4], const unsigned long cp)
+{
+    assert(b);
+    if (cp < 0x80ul) {
+        b[0] = cp;
+        return 1;
+    }
+    if (cp < 0x800ul) {
+        b[0] = 0xC0 | (cp >> 6);
+        b[1] = 0x80 | (cp & 0x3F);
+        return 2;
+    }
+    if (cp < 0x10000ul) {
+        b[0] = 0xE0 | (cp >> 12);
+        b[1] = 0x80 | ((cp >> 6) & 0x3F);
+        b[2] = 0x80 | (cp & 0x3F);
+        return 3;
+    }
+    b[0] = 0xF0 | (cp >> 18);
+    b[1] = 0x80 | ((cp >> 12) & 0x3F);
+    b[2] = 0x80 | ((cp >> 6) & 0x3F);
+    b[3] = 0x80 | (cp & 0x3F);
+    return 4;
+}
+
+/* Unescape a string into the scratch buffer of 'c'. If more of the value is
+ * to follow 'taken' is set to the input used, which stops short of an escape
+ * cut off at the end, or a surrogate there that may be the first of a pair. */
+static int chunk_string(jser_opts_t *sp, const jser_chunked_t *c, const char *in, const size_t len, size_t *taken)
+{
+    assert(sp);
+    assert(c);
+    assert(in);
+    jser_buffer_t *b = c->buf;
+    for (size_t i = 0; i < len;) {
+        if (chunk_room(sp, c, 4) < 0) {
+            return -1;
+        }
+        const size_t at = i;
+        const char ch = in[i++];
+        if (ch != '\\') {
+            b->buf[b->used++] = ch;
+            continue;
+        }
+        if (taken && (i >= len || (in[i] == 'u' && (i + 5) > len))) { /* the rest of it is to follow */
+            *taken = at;
+            return 0;
+        }
+        if (i >= len) {
+            return on_error(sp, JSER_ERR_PARSE);
+        }
+        switch (in[i++]) {
+        case '"':  b->buf[b->used++] = '"';  break;
+        case '\\': b->buf[b->used++] = '\\'; break;
+        case '/':  b->buf[b->used++] = '/';  break;
+        case 'b':  b->buf[b->used++] = '\b'; break;
+        case 'f':  b->buf[b->used++] = '\f'; break;
+        case 'n':  b->buf[b->used++] = '\n'; break;
+        case 'r':  b->buf[b->used++] = '\r'; break;
+        case 't':  b->buf[b->used++] = '\t'; break;
+        case 'u': {
+            long cp = (i + 4) <= len ? jser_hex4(&in[i]) : -1;
+            if (cp < 0) {
+                return on_error(sp, JSER_ERR_PARSE);
+            }
+            i += 4;
+            if (taken && jser_within(cp, 0xD800, 0xDBFF) && (i + 6) > len) {
+                *taken = at;
+                return 0;
+            }
+            if (jser_within(cp, 0xD800, 0xDBFF) && (i + 6) <= len && in[i] == '\\' && in[i + 1] == 'u') { /* surrogate pair */
+                const long lo = jser_hex4(&in[i + 2]);
+                if (jser_within(lo, 0xDC00, 0xDFFF)) {
+                    cp = 0x10000l + ((cp - 0xD800l) << 10) + (lo - 0xDC00l);
+                    i += 6;
+                }
+            }
+            b->used += jser_utf8(&b->buf[b->used], cp);
+            break;
+        }
+        default:
+            return on_error(sp, JSER_ERR_PARSE);
+        }
+    }
+    if (taken) {
+        *taken = len;
+    }
+    return 0;
+}
+
+static int chunk_ready(jser_opts_t *sp, const jser_chunked_t *c)
+{
+    assert(sp);
+    assert(c);
+    if (!c->buf || !c->buf->buf || c->buf->length < 4 || !c->chunk) {
+        return on_error(sp, JSER_ERR_CONFIG);
+    }
+    return 0;
+}
+
+/* Decode a string token into the scratch buffer of 'c', handing it over
+ * whenever it fills up, the last piece is always delivered even if empty. */
+static int chunk_value(jser_opts_t *sp, const jser_chunked_t *c, const char *in, const size_t len)
+{
+    assert(sp);
+    assert(c);
+    assert(in);
+    if (chunk_ready(sp, c) < 0) {
+        return -1;
+    }
+    c->buf->used = 0;
+    const int r = c->base64 ?
+        chunk_base64(sp, c, (const unsigned char *)in, len, NULL) :
+        chunk_string(sp, c, in, len, NULL);
+    if (r < 0) {
+        return -1;
+    }
+    return chunk_flush(sp, c, true);
+}
+
+static int json_to_number(jser_opts_t *sp, jser_t *e, const uint64_t magnitude, const int negative, const int valid)
+{
+    assert(sp);
+    assert(e);
+    if (e->type == JSER_ULONG_E) {
+        if (!valid || negative) {
+            return on_error(sp, JSER_ERR_NUMBER);
+        }
+        *e->data.lu = magnitude;
+    } else if (e->type == JSER_LONG_E) {
+        if (!valid) {
+            return on_error(sp, JSER_ERR_NUMBER);
+        }
+        int64_t o = magnitude;
+        if (negative) {
+            o = -o;
+        }
+        *e->data.ld = o;
+    } else {
+        return on_error(sp, JSER_ERR_TYPE);
+    }
+    return 0;
+}
+
+/* Bind a string or primitive token to the element 'e' */
+static int json_to_element(jser_opts_t *sp, jser_t *e, const jsmntok_t *p)
+{
+    assert(sp);
+    assert(e);
+    assert(p);
+
+    const jsmnint_t plen = p->end - p->start;
+    if (plen < 0) {
+        return on_error(sp, JSER_ERR_UNKNOWN);
+    }
+#if JSER_ENABLE_VALUES
+    if (p->type == JSMN_PRIMITIVE && (p->flags & JSMN_VALUE)) { /* converted whilst tokenizing */
+        return json_to_number(sp, e, p->value, p->flags & JSMN_NEGATIVE, 1);
+    }
+#endif
+    const char *json = jser_text(sp, p);
+    if (!json) {
+        return -1;
+    }
+
+    switch (p->type) {
+    case JSMN_STRING: {
+        if (e->type == JSER_BUFFER_E) {
+            jser_buffer_t *buf = e->data.buf;
+            buf->used = 0;
+            size_t olen = buf->length;
+            if (jser_base64_decode((unsigned char*)json, plen, buf->buf, &olen)) {
+                return on_error(sp, JSER_ERR_BASE64);
+            }
+            buf->used = olen;
+            assert(buf->used <= buf->length);
+        } else if (e->type == JSER_ASCIIZ_E) {
+            if (e->is_array) {
+                return on_error(sp, JSER_ERR_CONFIG);
+            }
+            if (e->length == 0) { /* A zero length ASCIIZ is invalid for deserialization, as this is a byte count */
+                return on_error(sp, JSER_ERR_TYPE); /* cannot deserialize to an ASCIIZ string without a length */
+            }
+            if ((size_t)plen >= e->length) {
+                return on_error(sp, JSER_ERR_TYPE);
+            }
+            memcpy(e->data.asciiz, json, plen);
+            e->data.asciiz[plen] = '\0';
+        } else if (e->type == JSER_CHUNKED_E) {
+            if (chunk_value(sp, e->data.chunked, json, plen) < 0) {
+                return -1;
+            }
+        } else {
+            return on_error(sp, JSER_ERR_TYPE);
+        }
+        break;
+    }
+    case JSMN_PRIMITIVE:
+        switch (json[0]) {
+        case 'n': /* 'null' not supported */
+            return on_error(sp, JSER_ERR_TYPE);
+        case 't':
+            if (e->type != JSER_BOOL_E) {
+                return on_error(sp, JSER_ERR_TYPE);
+            }
+            if (plen < 4 || memcmp(json, "true", 4)) {
+                return on_error(sp, JSER_ERR_TYPE);
+            }
+            *e->data.b = true;
+            break;
+        case 'f':
+            if (e->type != JSER_BOOL_E) {
+                return on_error(sp, JSER_ERR_TYPE);
+            }
+            if (plen < 5 || memcmp(json, "false", 5)) {
+                return on_error(sp, JSER_ERR_TYPE);
+            }
+            *e->data.b = false;
+            break;
+        case '-': case '0':
+        case '1': case '2': case '3':
+        case '4': case '5': case '6':
+        case '7': case '8': case '9': {
+            const int negative = json[0] == '-';
+            uint64_t magnitude = 0;
+            const int valid = str_to_u64(&json[negative], plen - negative, 10, &magnitude) == 0;
+            return json_to_number(sp, e, magnitude, negative, valid);
+        }
+        default:
+            return on_error(sp, JSER_ERR_PARSE);
+        }
+        break;
+    default:
+        return on_error(sp, JSER_ERR_PARSE);
+    }
+    return 0;
+}
+
+#define DELTA_NUMBER (24) /* text kept for a number or boolean, the longest 64-bit integer is 20 digits and a sign */
+
+static inline size_t slot_hash(const jser_t *e)
+{
+    uintptr_t h = (uintptr_t)e / sizeof (*e);
+    h ^= h >> 16;
+    h *= 0x45D9F3Bu;
+    h ^= h >> 16;
+    return h;
+}
+
+/* The slot for 'e' in the table built by 'jser_delta_prepare', or NULL */
+static jser_slot_t *delta_slot(const jser_delta_t *d, const jser_t *e)
+{
+    assert(d);
+    assert(e);
+    if (d->length == 0) {
+        return NULL;
+    }
+    const size_t mask = d->length - 1;
+    for (size_t i = slot_hash(e) & mask, n = 0; n < d->length; i = (i + 1) & mask, n++) {
+        jser_slot_t *s = &d->slots[i];
+        if (s->e == e) {
+            return s;
+        }
+        if (!s->e) {
+            return NULL;
+        }
+    }
+    return NULL;
+}
+
+/* Like 'json_to_element', but a value whose text is the same as when it was
+ * last bound is not converted or written again; the text is compared with
+ * the copy kept for its slot, whatever its storage now holds. */
+static int jser_rebind(jser_opts_t *sp, jser_t *e, const jsmntok_t *p)
+{
+    assert(sp);
+    assert(sp->delta);
+    assert(e);
+    assert(p);
+    jser_delta_t *d = sp->delta;
+    jser_slot_t *s = delta_slot(d, e);
+    if (!s) {
+        return json_to_element(sp, e, p);
+    }
+    const jsmnint_t plen = p->end - p->start;
+    if (plen < 0) {
+        return on_error(sp, JSER_ERR_UNKNOWN);
+    }
+    const char *json = jser_text(sp, p);
+    if (!json) {
+        return -1;
+    }
+    if (s->bound && s->type == (int)p->type && s->used == (size_t)plen && !memcmp(&d->text[s->offset], json, plen)) {
+        return 0;
+    }
+    s->bound = false;
+    if ((size_t)plen <= s->capacity) { /* kept before converting, as a segment may not outlive it */
+        memcpy(&d->text[s->offset], json, plen);
+        s->used = plen;
+        s->type = p->type;
+    }
+    if (json_to_element(sp, e, p) < 0) {
+        return -1;
+    }
+    s->bound = (size_t)plen <= s->capacity; /* text too long to keep is converted every time */
+    if ((s->index / CHAR_BIT) < d->clength) {
+        d->changed[s->index / CHAR_BIT] |= 1u << (s->index % CHAR_BIT);
+    }
+    return 0;
+}
+
+static int probe_compare(const void *a, const void *b)
+{
+    assert(a);
+    assert(b);
+    const jser_probe_t *x = a, *y = b;
+    const uintptr_t xj = (uintptr_t)x->j, yj = (uintptr_t)y->j;
+    if (xj != yj) {
+        return xj < yj ? -1 : 1;
+    }
+    return (x->length > y->length) - (x->length < y->length);
+}
+
+/* Lookup order prepared for an object table by 'jser_lookup_prepare', which
+ * leaves them sorted by table */
+static jser_probe_t *jser_probing(const jser_lookup_t *l, const jser_t *j, const size_t jlen)
+{
+    assert(l);
+    const jser_probe_t key = { .j = j, .length = jlen, };
+    return l->used ? bsearch(&key, l->tables, l->used, sizeof (*l->tables), probe_compare) : NULL;
+}
+
+/* Start binding the object or array at 'p' to the element 'e' */
+static int jser_enter(jser_opts_t *sp, jser_frame_t *f, jser_t *e, const jsmntok_t *p, const size_t tokens)
+{
+    assert(sp);
+    assert(f);
+    assert(e);
+    assert(p);
+    f->e     = e;
+    f->token = p;
+    f->j     = e->data.jser;
+    f->jlen  = e->used;
+    f->k     = 0;
+    f->probe = NULL;
+    f->keys  = 0;
+    f->next  = 0;
+    if (p->type == JSMN_OBJECT) {
+        if (e->type == JSER_UNION_E) {
+            const int k = find_variant(sp, e->data.un, p, tokens);
+            if (k < 0) {
+                return -1;
+            }
+            f->j    = e->data.un->variants[k].jser;
+            f->jlen = e->data.un->variants[k].length;
+            f->k    = k;
+        } else if (e->type != JSER_OBJECT_E) {
+            return on_error(sp, JSER_ERR_TYPE);
+        }
+        if (sp->lookup) {
+            f->probe = jser_probing(sp->lookup, f->j, f->jlen);
+        }
+        return 0;
+    }
+    assert(p->type == JSMN_ARRAY);
+    if (e->type == JSER_STREAM_E) { /* elements not already streamed whilst tokenizing */
+        return e->data.stream->record ? 0 : on_error(sp, JSER_ERR_CONFIG);
+    }
+    return e->type == JSER_ARRAY_E ? 0 : on_error(sp, JSER_ERR_TYPE);
+}
+
+/* Called when a value within the frame 'f' has been bound */
+static inline int jser_bound(jser_opts_t *sp, const jser_frame_t *f)
+{
+    assert(sp);
+    assert(f);
+    if (f->e->type == JSER_STREAM_E) {
+        jser_stream_t *st = f->e->data.stream;
+        assert(f->k > 0);
+        if (st->each && st->each(st->record, f->k - 1, st->param) < 0) {
+            return on_error(sp, JSER_ERR_CALLBACK);
+        }
+    }
+    return 0;
+}
+
+static jsmnint_t jser_spill(jser_opts_t *sp, size_t top, jser_t *e, const jsmntok_t *token, size_t tokens);
+
+/* Bind the value at 'token[*at]' to the element '*next', returning an
+ * error or the number of tokens the outermost value takes up. Nested objects
+ * and arrays are tracked in 'stack' instead of by recursion, so the nesting
+ * of the input is limited by 'depth', the number of frames available, and
+ * not by the size of the C stack. Each token costs one, a string or
+ * primitive value its length in bytes, and once 'budget' would be spent it
+ * stops and returns 0, leaving 'next', 'at' and 'used' (the frames in use)
+ * ready to carry on from where it got to. At least one token is bound if
+ * 'budget' is not zero, however long it is. */
+static jsmnint_t jser_resume(jser_opts_t *sp, jser_frame_t *stack, const size_t depth, jser_t **next, size_t *at, size_t *used, jsmnint_t *skip, const jsmntok_t *token, const size_t tokens, const size_t budget)
+{
+    assert(sp);
+    assert(stack || depth == 0);
+    assert(next);
+    assert(at);
+    assert(used);
+    assert(skip);
+    assert(*next || *skip);
+    assert(token);
+    assert(tokens <= JSMNINT_MAX);
+    if (tokens == 0) {
+        return on_error(sp, JSER_ERR_UNKNOWN);
+    }
+    jser_t *e = *next;
+    size_t pos = *at, top = *used;
+    jsmnint_t until = *skip; /* end of the value of an unknown attribute, 0 if not skipping one */
+    for (size_t first = pos, bytes = 0;;) { /* a token is a unit, and each byte of a value past its first */
+        const jsmntok_t *p = &token[pos];
+        const size_t spent = (pos - first) + bytes;
+        const size_t cost = p->type == JSMN_OBJECT || p->type == JSMN_ARRAY || p->end <= p->start ? 1 : (size_t)(p->end - p->start);
+        if (spent >= budget || (spent && (budget - spent) < cost)) {
+            *next = e;
+            *at   = pos;
+            *used = top;
+            *skip = until;
+            return 0;
+        }
+        bytes += cost - 1;
+        if (until) { /* skipped a token at a time, as 'jser_skip' does, so it is charged like the rest */
+            pos++;
+            if (pos < tokens && token[pos].start < until) {
+                continue;
+            }
+            until = 0;
+        } else if (p->type == JSMN_OBJECT || p->type == JSMN_ARRAY) {
+            if (top >= depth && !sp->spill) {
+                return on_error(sp, JSER_ERR_DEPTH);
+            }
+            if (sp->limits && jser_over(sp->limits->depth, sp->frames + top + 1)) {
+                return on_error(sp, JSER_ERR_LIMIT);
+            }
+            if (top >= depth) {
+                const jsmnint_t r = jser_spill(sp, top, e, p, tokens - pos);
+                if (r < 0 || (top && jser_bound(sp, &stack[top - 1]) < 0)) {
+                    return -1;
+                }
+                pos += r;
+            } else {
+                if (jser_enter(sp, &stack[top], e, p, tokens - pos) < 0) {
+                    return -1;
+                }
+                top++;
+                pos++;
+            }
+        } else {
+            if ((sp->delta ? jser_rebind(sp, e, p) : json_to_element(sp, e, p)) < 0) {
+                return -1;
+            }
+            if (top && jser_bound(sp, &stack[top - 1]) < 0) {
+                return -1;
+            }
+            pos++;
+        }
+
+        for (e = NULL; !e && !until;) { /* find the next value, leaving finished frames */
+            if (top == 0) {
+                return pos;
+            }
+            jser_frame_t *f = &stack[top - 1];
+            jser_t *fe = f->e;
+            if (pos >= tokens || token[pos].start >= f->token->end) {
+                if (fe->type == JSER_ARRAY_E && JSER_ENABLE_USED_SET) {
+                    fe->used = f->k;
+                } else if (fe->type == JSER_UNION_E) {
+                    fe->data.un->selected = f->k;
+                }
+                if (--top && jser_bound(sp, &stack[top - 1]) < 0) {
+                    return -1;
+                }
+                continue;
+            }
+            switch (fe->type) {
+            case JSER_OBJECT_E:
+            case JSER_UNION_E: {
+                const jsmntok_t *key = &token[pos];
+                if (key->type != JSMN_STRING) { /* only strings can be attributes */
+                    return on_error(sp, JSER_ERR_PARSE);
+                }
+                if ((pos + 1) >= tokens) {
+                    return on_error(sp, JSER_ERR_LENGTH);
+                }
+                const int element = f->probe ? find_probed(sp, f, key) : find_element(sp, f->j, f->jlen, key);
+                pos++;
+                if (element < 0) { /* value not found, skip its tokens */
+                    until = token[pos].end;
+                    continue;
+                }
+                e = &f->j[element];
+                break;
+            }
+            case JSER_ARRAY_E:
+                if (f->k >= fe->length) {
+                    return on_error(sp, JSER_ERR_SPACE);
+                }
+                e = &fe->data.array[f->k++];
+                break;
+            case JSER_STREAM_E:
+                if (sp->limits && jser_over(sp->limits->array, f->k + 1)) {
+                    return on_error(sp, JSER_ERR_LIMIT);
+                }
+                e = fe->data.stream->record;
+                f->k++;
+                break;
+            default:
+                assert(0);
+                return on_error(sp, JSER_ERR_UNKNOWN);
+            }
+        }
+    }
+}
+
+static jsmnint_t jser_bind(jser_opts_t *sp, jser_frame_t *stack, const size_t depth, jser_t *e, const jsmntok_t *token, const size_t tokens)
+{
+    size_t pos = 0, top = 0;
+    jsmnint_t skip = 0;
+    return jser_resume(sp, stack, depth, &e, &pos, &top, &skip, token, tokens, SIZE_MAX);
+}
+
+/* The stack is full, with 'top' frames, so the value at 'token' is bound
+ * with another stack further down the C stack. Nesting is then only limited
+ * by the C stack, as it was when binding recursed, for the deserialization
+ * functions not given a stack by the caller. */
+static jsmnint_t jser_spill(jser_opts_t *sp, const size_t top, jser_t *e, const jsmntok_t *token, const size_t tokens)
+{
+    assert(sp);
+    assert(sp->spill);
+    jser_frame_t more[JSER_STACK_DEPTH];
+    sp->frames += top;
+    const jsmnint_t r = jser_bind(sp, more, ELEMENTS(more), e, token, tokens);
+    sp->frames -= top;
+    return r;
+}
+
+static jsmnint_t jser_dejsonify(jser_opts_t *sp, jser_frame_t *stack, const size_t depth, jser_t *j, const size_t jlen, const jsmntok_t *token, const size_t tokens)
+{
+    assert(sp);
+    assert(j || jlen == 0);
+    assert(token);
+    if (tokens == 0 || token->type != JSMN_OBJECT) {
+        return on_error(sp, JSER_ERR_PARSE);
+    }
+    jser_t root = { .type = JSER_OBJECT_E, .data.jser = j, .length = jlen, .used = jlen, };
+    return jser_bind(sp, stack, depth, &root, token, tokens);
+}
+
+/* Bind one element of a stream into its record and hand it to the user */
+static jsmnint_t stream_element(jser_opts_t *sp, jser_frame_t *stack, const size_t depth, jser_stream_t *s, const jsmntok_t *token, const size_t tokens, const size_t index)
+{
+    assert(sp);
+    assert(s);
+    assert(token);
+    if (!s->record) {
+        return on_error(sp, JSER_ERR_CONFIG);
+    }
+    const jsmnint_t r = jser_bind(sp, stack, depth, s->record, token, tokens);
+    if (r < 0) {
+        return -1;
+    }
+    if (s->each && s->each(s->record, index, s->param) < 0) {
+        return on_error(sp, JSER_ERR_CALLBACK);
+    }
+    return r;
+}
+
+typedef struct {
+    jser_opts_t *sp;
+    jser_t *j;             /**< root of the tree being deserialized */
+    size_t jlen;
+    jser_frame_t *stack;   /**< binder stack, free whilst tokenizing */
+    size_t depth;
+    jsmnint_t start;       /**< input offset of the last array seen, identifies it even if tokens are reused */
+    jser_stream_t *stream; /**< stream node for that array, or NULL if it is not one */
+    size_t index;          /**< number of elements streamed so far */
+} jser_streamer_t;
+
+/* Find the node the value of the attribute 'tokens[key]' will be bound to
+ * whilst the input is still being tokenized. Only values reached through a
+ * chain of object attributes from the root can be resolved this early, a
+ * value within an array or a union is left to the binder. */
+static jser_t *value_node(const jser_streamer_t *s, const jsmntok_t *tokens, const jsmnint_t key)
+{
+    assert(s);
+    assert(tokens);
+    int depth = 0;
+    for (jsmnint_t k = key; k != -1; k = tokens[tokens[k].parent].parent) {
+        const jsmntok_t *t = &tokens[k];
+        if (t->type != JSMN_STRING || t->parent == -1 || tokens[t->parent].type != JSMN_OBJECT) {
+            return NULL;
+        }
+        depth++;
+    }
+    jser_t *j = s->j, *e = NULL;
+    size_t jlen = s->jlen;
+    for (int level = depth; level > 0; level--) {
+        jsmnint_t k = key;
+        for (int up = 1; up < level; up++) {
+            k = tokens[tokens[k].parent].parent;
+        }
+        const int i = find_element(s->sp, j, jlen, &tokens[k]);
+        if (i < 0) {
+            return NULL;
+        }
+        e = &j[i];
+        if (level > 1) {
+            if (e->type != JSER_OBJECT_E) {
+                return NULL;
+            }
+            j = e->data.jser;
+            jlen = e->used;
+        }
+    }
+    return e;
+}
+
+/* The node the array 'tokens[array]' will be bound to, see 'value_node' */
+static jser_t *stream_node(const jser_streamer_t *s, const jsmntok_t *tokens, const jsmnint_t array)
+{
+    assert(s);
+    assert(tokens);
+    return tokens[array].parent == -1 ? NULL : value_node(s, tokens, tokens[array].parent);
+}
+
+/* Is the array 'tokens[array]' within an element of the stream being
+ * streamed? Its offset is what identifies the stream, as tokens are handed
+ * back and moved. */
+static bool in_stream(const jser_streamer_t *s, const jsmntok_t *tokens, const jsmnint_t array)
+{
+    assert(s);
+    assert(tokens);
+    if (!s->stream) {
+        return false;
+    }
+    for (jsmnint_t t = tokens[array].parent; t != -1; t = tokens[t].parent) {
+        if (tokens[t].type == JSMN_ARRAY && tokens[t].start == s->start) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Called by the tokenizer as each array element is completed, elements of
+ * a stream are bound and passed on immediately and their tokens are handed
+ * back to the tokenizer, so a stream of any length only ever needs enough
+ * tokens for a single element. Arrays within an element are left to be
+ * bound along with it, and do not disturb the count of elements streamed. */
+static int stream_hook(jsmn_parser *parser, jsmntok_t *tokens, const jsmnint_t array)
+{
+    assert(parser);
+    assert(tokens);
+    jser_streamer_t *s = parser->param;
+    assert(s);
+    if (in_stream(s, tokens, array)) {
+        return 0;
+    }
+    if (s->start != tokens[array].start) {
+        const jser_t *e = stream_node(s, tokens, array);
+        s->start  = tokens[array].start;
+        s->stream = e && e->type == JSER_STREAM_E ? e->data.stream : NULL;
+        s->index  = 0;
+    }
+    if (!s->stream) {
+        return 0;
+    }
+    const jsmnint_t first = array + 1;
+    assert(parser->toknext > (jsmnuint_t)array);
+    if (s->sp->limits && jser_over(s->sp->limits->array, s->index + 1)) { /* the tokenizer only sees one element at a time */
+        return on_error(s->sp, JSER_ERR_LIMIT);
+    }
+    if (stream_element(s->sp, s->stack, s->depth, s->stream, &tokens[first], parser->toknext - first, s->index++) < 0) {
+        return JSER_ERR_CALLBACK;
+    }
+    parser->toknext = first;
+    tokens[array].size = 0;
+    return 0;
+}
+
+/* Tokenize input that may be split into segments, a token that straddles
+ * two segments is parsed from a copy of the input around it held in the
+ * first half of the bounce buffer, along with any tokens following it that
+ * also fit. */
+static jsmnint_t jser_tokenize(jser_opts_t *sp, jsmn_parser *jp, jsmntok_t *t, const size_t tokens)
+{
+    assert(sp);
+    assert(sp->in);
+    assert(jp);
+    assert(t);
+    jser_input_t *in = sp->in;
+    size_t total = 0, at = 0, seg = 0, base = 0;
+    for (size_t i = 0; i < in->count; i++) {
+        total += in->segments[i].used;
+    }
+    jsmnint_t rv = 0;
+    while (at < total) {
+        for (; at >= (base + in->segments[seg].used); seg++) {
+            base += in->segments[seg].used;
+        }
+        const jser_buffer_t *s = &in->segments[seg];
+        size_t end = s->used;
+        if (in->crc) { /* checksum a block at a time, just before tokenizing it */
+            if ((in->summed + JSER_DIGEST_BLOCK - base) < end) {
+                end = in->summed + JSER_DIGEST_BLOCK - base;
+            }
+            jser_digest(in, base + end);
+        }
+        jp->base = base;
+        jp->pos  = at - base;
+        jp->more = (base + end) < total;
+        rv = jsmn_parse(jp, (const char *)s->buf, end, t, tokens);
+        if ((rv < 0 && rv != JSMN_ERROR_PART) || sp->error) {
+            return rv;
+        }
+        if (jp->pos < end && (rv >= 0 || !jp->more || s->buf[jp->pos] == '\0')) {
+            return rv; /* stopped at a NUL terminator */
+        }
+        at = base + jp->pos;
+        if (jp->pos == s->used || end < s->used) {
+            continue;
+        }
+        jser_buffer_t *b = in->bounce; /* token straddles a segment */
+        const size_t half = b ? b->length / 2 : 0, n = (total - at) < half ? total - at : half;
+        if (n == 0) {
+            return JSMN_ERROR_NOMEM;
+        }
+        jser_gather(in, at, b->buf, n);
+        if (in->crc) {
+            jser_digest(in, at + n);
+        }
+        in->window = at;
+        in->wlen   = n;
+        jp->base = at;
+        jp->pos  = 0;
+        jp->more = (at + n) < total;
+        rv = jsmn_parse(jp, (const char *)b->buf, n, t, tokens);
+        if ((rv < 0 && rv != JSMN_ERROR_PART) || sp->error) {
+            return rv;
+        }
+        if (jp->pos < n && (rv >= 0 || !jp->more || b->buf[jp->pos] == '\0')) {
+            return rv;
+        }
+        if (jp->pos == 0) {
+            return JSMN_ERROR_NOMEM; /* value does not fit in the bounce buffer */
+        }
+        at += jp->pos;
+    }
+    return rv;
+}
+
+/* Everything but the size of the input is checked by the tokenizer as it
+ * goes, against counters it keeps */
+static void jser_limit(jsmn_parser *jp, const jser_limits_t *l)
+{
+    assert(jp);
+    assert(l);
+    jp->max_tokens = l->tokens;
+    jp->max_string = l->string;
+    jp->max_size   = l->array;
+    jp->max_depth  = l->depth;
+}
+
+/* How did tokenizing go? */
+static int jser_tokenized(const jser_opts_t *sp, const jsmn_parser *jp, const jsmnint_t rv)
+{
+    assert(sp);
+    assert(jp);
+    if (sp->error < 0) {
+        return sp->error;
+    }
+    if (rv < 0)
+        switch (rv) {
+        case JSMN_ERROR_NOMEM: return JSER_ERR_SPACE;
+        case JSMN_ERROR_INVAL: return JSER_ERR_PARSE;
+        case JSMN_ERROR_PART:  return JSER_ERR_MORE_DAT;
+        case JSMN_ERROR_LIMIT: return JSER_ERR_LIMIT;
+        default:               return JSER_ERR_UNKNOWN;
+        }
+    return jp->toknext == 0 ? JSER_ERR_MORE_DAT : JSER_OK;
+}
+
+/* Check how tokenizing went, then bind whatever was not streamed */
+static int jser_complete(jser_opts_t *sp, const jser_streamer_t *s, const jsmn_parser *jp, const jsmntok_t *t, const jsmnint_t rv)
+{
+    assert(sp);
+    assert(s);
+    assert(jp);
+    assert(t);
+    const int r = jser_tokenized(sp, jp, rv);
+    if (r < 0) {
+        return r;
+    }
+    if (jser_dejsonify(sp, s->stack, s->depth, s->j, s->jlen, t, jp->toknext) < 0 || sp->error) {
+        return sp->error ? sp->error : JSER_ERR_UNKNOWN;
+    }
+    return JSER_OK;
+}
+
+static int jser_deserialize(jser_t *j, size_t jlen, jsmntok_t *t, const size_t tokens, jser_input_t *in, jser_frame_t *stack, size_t depth, jser_delta_t *delta, const jser_limits_t *limits, jser_lookup_t *lookup)
+{
+    assert(j);
+    assert(t);
+    assert(in);
+    assert(stack || depth == 0);
+    assert(tokens <= JSMNINT_MAX);
+    jser_opts_t sp = { .max = JSER_MAX_DEPTH, .in = in, .delta = delta, .limits = limits, .lookup = lookup, };
+    jser_frame_t frames[JSER_STACK_DEPTH];
+    if (!stack) { /* no limit on nesting but the C stack, as the caller did not set one */
+        stack    = frames;
+        depth    = ELEMENTS(frames);
+        sp.spill = 1;
+    }
+    jser_streamer_t streamer = {
+        .sp    = &sp,
+        .j     = j,
+        .jlen  = jlen,
+        .stack = stack,
+        .depth = depth,
+        .start = -1,
+    };
+    jsmn_parser jp;
+    jsmn_init(&jp);
+    jp.element = stream_hook;
+    jp.param   = &streamer;
+    if (limits) {
+        size_t total = 0;
+        for (size_t i = 0; i < in->count; i++) {
+            total += in->segments[i].used;
+        }
+        if (jser_over(limits->bytes, total)) {
+            return JSER_ERR_LIMIT;
+        }
+        jser_limit(&jp, limits);
+    }
+    memset(t, 0, sizeof (*t) * tokens);
+    const jsmnint_t rv = jser_tokenize(&sp, &jp, t, tokens);
+    if (in->crc) {
+        jser_digest(in, SIZE_MAX);
+    }
+    return jser_complete(&sp, &streamer, &jp, t, rv);
+}
+
+int jser_deserialize_with_stack(jser_t *j, size_t jlen, jsmntok_t *t, const size_t tokens, jser_buffer_t *b, jser_frame_t *stack, const size_t depth)
+{
+    assert(b);
+    jser_input_t in = { .segments = b, .count = 1, .cur = (const char *)b->buf, .hi = b->used, };
+    return jser_deserialize(j, jlen, t, tokens, &in, stack, depth, NULL, NULL, NULL);
+}
+
+int jser_deserialize_with_limits(jser_t *j, size_t jlen, jsmntok_t *t, const size_t tokens, jser_buffer_t *b, const jser_limits_t *limits)
+{
+    assert(b);
+    assert(limits);
+    jser_input_t in = { .segments = b, .count = 1, .cur = (const char *)b->buf, .hi = b->used, };
+    return jser_deserialize(j, jlen, t, tokens, &in, NULL, 0, NULL, limits, NULL);
+}
+
+int jser_deserialize_with_digest(jser_t *j, size_t jlen, jsmntok_t *t, const size_t tokens, jser_buffer_t *b, unsigned long *crc)
+{
+    assert(b);
+    assert(crc);
+    jser_input_t in = { .segments = b, .count = 1, .cur = (const char *)b->buf, .hi = b->used, .crc = crc, };
+    *crc = 0;
+    return jser_deserialize(j, jlen, t, tokens, &in, NULL, 0, NULL, NULL, NULL);
+}
+
+int jser_deserialize_from_segments(jser_t *j, size_t jlen, jsmntok_t *t, const size_t tokens, const jser_buffer_t *segments, const size_t count, jser_buffer_t *bounce)
+{
+    assert(segments || count == 0);
+    if (count == 0) {
+        return JSER_ERR_MORE_DAT;
+    }
+    jser_input_t in = {
+        .segments = segments,
+        .count    = count,
+        .bounce   = bounce,
+        .cur      = (const char *)segments[0].buf,
+        .hi       = segments[0].used,
+    };
+    return jser_deserialize(j, jlen, t, tokens, &in, NULL, 0, NULL, NULL, NULL);
+}
+
+/* Give every number, boolean, string and buffer in a tree a slot in 'd'.
+ * Values in streams and chunked values are left out, they are handed on
+ * to callbacks as they are bound so there is nothing to keep. */
+static int delta_node(jser_opts_t *sp, jser_delta_t *d, const jser_t *e, const size_t depth)
+{
+    assert(sp);
+    assert(d);
+    assert(e);
+    if (sp->max != 0 && depth > sp->max) {
+        return on_error(sp, JSER_ERR_DEPTH);
+    }
+    switch (e->type) {
+    case JSER_OBJECT_E:
+    case JSER_ARRAY_E: /* 'data.jser' and 'data.array' are the same */
+        for (size_t i = 0; i < e->length; i++) {
+            if (delta_node(sp, d, &e->data.jser[i], depth + 1) < 0) {
+                return -1;
+            }
+        }
+        return 0;
+    case JSER_UNION_E: {
+        const jser_union_t *un = e->data.un;
+        if (!un) {
+            return on_error(sp, JSER_ERR_CONFIG);
+        }
+        for (size_t v = 0; v < un->length; v++) {
+            for (size_t i = 0; i < un->variants[v].length; i++) {
+                if (delta_node(sp, d, &un->variants[v].jser[i], depth + 1) < 0) {
+                    return -1;
+                }
+            }
+        }
+        return 0;
+    }
+    case JSER_STREAM_E:
+    case JSER_CHUNKED_E:
+        return 0;
+    default:
+        break;
+    }
+    if (e->is_array) {
+        return 0; /* cannot be deserialized anyway */
+    }
+    size_t capacity = 0; /* the longest text that can be bound to it */
+    switch (e->type) {
+    case JSER_LONG_E:
+    case JSER_ULONG_E:
+    case JSER_BOOL_E:
+        capacity = DELTA_NUMBER;
+        break;
+    case JSER_ASCIIZ_E:
+        capacity = e->length ? e->length - 1 : 0;
+        break;
+    case JSER_BUFFER_E:
+        capacity = e->data.buf ? base64_encoded_size(e->data.buf->length) : 0;
+        break;
+    default:
+        break;
+    }
+    const size_t index = d->used++, offset = d->tused;
+    d->tused += capacity;
+    if (!d->slots) {
+        return 0;
+    }
+    if (d->used >= d->length) {
+        return on_error(sp, JSER_ERR_SPACE);
+    }
+    const size_t mask = d->length - 1;
+    size_t i = slot_hash(e) & mask;
+    for (; d->slots[i].e; i = (i + 1) & mask) {
+        if (d->slots[i].e == e) {
+            return on_error(sp, JSER_ERR_CONFIG); /* the same element twice */
+        }
+    }
+    d->slots[i] = (jser_slot_t){ .e = e, .offset = offset, .capacity = capacity, .index = index, };
+    return 0;
+}
+
+int jser_delta_prepare(const jser_t *j, size_t jlen, jser_delta_t *d)
+{
+    assert(j || jlen == 0);
+    assert(d);
+    jser_opts_t sp = { .max = JSER_MAX_DEPTH, };
+    if (d->slots) {
+        if (d->length == 0 || (d->length & (d->length - 1))) {
+            return JSER_ERR_CONFIG;
+        }
+        memset(d->slots, 0, sizeof (*d->slots) * d->length);
+    }
+    d->used = 0;
+    d->tused = 0;
+    for (size_t i = 0; i < jlen; i++) {
+        if (delta_node(&sp, d, &j[i], 0) < 0) {
+            return sp.error;
+        }
+    }
+    if (d->slots && (!d->text || d->tlength < d->tused)) {
+        return JSER_ERR_SPACE;
+    }
+    if (d->changed && d->clength < ((d->used + CHAR_BIT - 1) / CHAR_BIT)) {
+        return JSER_ERR_SPACE;
+    }
+    return JSER_OK;
+}
+
+/* Deserialize a message that is likely to differ only a little from the
+ * last one, as a periodic status update would; the values that are the same
+ * are not converted again and the bits of those that were are set in
+ * 'd->changed'. */
+int jser_deserialize_delta(jser_t *j, size_t jlen, jsmntok_t *t, const size_t tokens, jser_buffer_t *b, jser_delta_t *d)
+{
+    assert(b);
+    assert(d);
+    assert(d->slots || d->length == 0);
+    if (d->changed) {
+        memset(d->changed, 0, d->clength);
+    }
+    jser_input_t in = { .segments = b, .count = 1, .cur = (const char *)b->buf, .hi = b->used, };
+    return jser_deserialize(j, jlen, t, tokens, &in, NULL, 0, d, NULL, NULL);
+}
+
+int jser_delta_changed(const jser_delta_t *d, const jser_t *e)
+{
+    assert(d);
+    assert(e);
+    const jser_slot_t *s = delta_slot(d, e);
+    if (!s || !d->changed || (s->index / CHAR_BIT) >= d->clength) {
+        return JSER_ERR_CONFIG;
+    }
+    return (d->changed[s->index / CHAR_BIT] >> (s->index % CHAR_BIT)) & 1;
+}
+
+/* Do two tables have the same attributes in the same order? */
+static bool same_layout(const jser_t *a, const jser_t *b, const size_t n)
+{
+    assert(a || n == 0);
+    assert(b || n == 0);
+    for (size_t i = 0; i < n; i++) {
+        if (a[i].attr != b[i].attr && (!a[i].attr || !b[i].attr || strcmp(a[i].attr, b[i].attr))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Give the table 'j' an order, the one of the table before it at the same
+ * level if that has the same layout, as the records of an array usually
+ * do; they then learn from each other and take up no more indices. */
+static int lookup_table(jser_opts_t *sp, jser_lookup_t *l, jser_probe_t *sibling, const jser_t *j, const size_t jlen)
+{
+    assert(sp);
+    assert(l);
+    assert(sibling);
+    const bool share = sibling->j && sibling->length == jlen && (sibling->j == j || same_layout(sibling->j, j, jlen));
+    if (!l->tables) { /* sizing only, tables met twice are counted twice */
+        l->used++;
+        l->iused += share ? 0 : 3 * jlen;
+        *sibling = (jser_probe_t){ .j = j, .length = jlen, };
+        return 0;
+    }
+    if (l->used >= l->length || (!share && (l->ilength - l->iused) / 3 < jlen)) {
+        return on_error(sp, JSER_ERR_SPACE);
+    }
+    if (share) {
+        *sibling = (jser_probe_t){ .j = j, .length = jlen, .order = sibling->order, .sum = sibling->sum, .seen = sibling->seen, };
+    } else {
+        size_t *r = &l->indices[l->iused];
+        for (size_t i = 0; i < jlen; i++) {
+            r[i] = i;
+        }
+        memset(&r[jlen], 0, sizeof (*r) * 2 * jlen);
+        *sibling = (jser_probe_t){ .j = j, .length = jlen, .order = r, .sum = &r[jlen], .seen = &r[2 * jlen], };
+        l->iused += 3 * jlen;
+    }
+    l->tables[l->used++] = *sibling;
+    return 0;
+}
+
+static int lookup_node(jser_opts_t *sp, jser_lookup_t *l, jser_probe_t *sibling, const jser_t *j, const size_t jlen, const int is_array, size_t depth)
+{
+    assert(sp);
+    assert(l);
+    assert(sibling);
+    assert(j || jlen == 0);
+    if (sp->max != 0 && depth > sp->max) {
+        return on_error(sp, JSER_ERR_DEPTH);
+    }
+    if (!is_array && lookup_table(sp, l, sibling, j, jlen) < 0) {
+        return -1;
+    }
+    jser_probe_t last = { .j = NULL, }; /* table of the previous object within this one */
+    for (size_t i = 0; i < jlen; i++) {
+        const jser_t *e = &j[i];
+        if (e->type == JSER_STREAM_E) {
+            if (!e->data.stream || !e->data.stream->record) {
+                return on_error(sp, JSER_ERR_CONFIG);
+            }
+            e = e->data.stream->record;
+        }
+        int r = 0;
+        switch (e->type) {
+        case JSER_OBJECT_E: /* bound up to 'used', as 'jser_enter' does */
+            r = lookup_node(sp, l, &last, e->data.jser, e->used, 0, depth + 1);
+            break;
+        case JSER_ARRAY_E: /* 'data.jser' and 'data.array' are the same */
+            r = lookup_node(sp, l, &last, e->data.jser, e->length, 1, depth + 1);
+            break;
+        case JSER_UNION_E: {
+            const jser_union_t *un = e->data.un;
+            if (!un) {
+                return on_error(sp, JSER_ERR_CONFIG);
+            }
+            for (size_t v = 0; r >= 0 && v < un->length; v++) {
+                r = lookup_node(sp, l, &last, un->variants[v].jser, un->variants[v].length, 0, depth + 1);
+            }
+            break;
+        }
+        default:
+            break;
+        }
+        if (r < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Each object table in the tree starts off being looked up in the order its
+ * attributes are in, which is also what 'find_element' does. */
+int jser_lookup_prepare(const jser_t *j, size_t jlen, jser_lookup_t *l)
+{
+    assert(j || jlen == 0);
+    assert(l);
+    jser_opts_t sp = { .max = JSER_MAX_DEPTH, };
+    jser_probe_t top = { .j = NULL, };
+    l->used    = 0;
+    l->iused   = 0;
+    l->lookups = 0;
+    l->probes  = 0;
+    if (!l->tables != !l->indices) {
+        return JSER_ERR_CONFIG;
+    }
+    if (lookup_node(&sp, l, &top, j, jlen, 0, 0) < 0) {
+        return sp.error;
+    }
+    if (l->tables && l->used) { /* sorted so 'jser_probing' can search them, with tables met twice merged */
+        qsort(l->tables, l->used, sizeof (*l->tables), probe_compare);
+        size_t k = 1;
+        for (size_t i = 1; i < l->used; i++) {
+            if (probe_compare(&l->tables[k - 1], &l->tables[i])) {
+                l->tables[k++] = l->tables[i];
+            }
+        }
+        l->used = k;
+    }
+    return JSER_OK;
+}
+
+/* Deserialize trying the attributes of each object in the order in 'l',
+ * counting the keys looked up and the attributes compared with them, and if
+ * 'l->learn' is set noting where each key arrived. Producers often write
+ * their keys in the same order every time, which need not be the order of
+ * the 'jser_t' tables. */
+int jser_deserialize_adaptive(jser_t *j, size_t jlen, jsmntok_t *t, const size_t tokens, jser_buffer_t *b, jser_lookup_t *l)
+{
+    assert(b);
+    assert(l);
+    assert(l->tables || l->used == 0);
+    jser_input_t in = { .segments = b, .count = 1, .cur = (const char *)b->buf, .hi = b->used, };
+    return jser_deserialize(j, jlen, t, tokens, &in, NULL, 0, NULL, NULL, l);
+}
+
+/* Does the attribute 'a' of 'p' arrive before 'b' on average? */
+static inline bool jser_earlier(const jser_probe_t *p, const size_t a, const size_t b)
+{
+    assert(p);
+    if (!p->seen[a] || !p->seen[b]) {
+        return p->seen[a] && !p->seen[b];
+    }
+    return (unsigned long long)p->sum[a] * p->seen[b] < (unsigned long long)p->sum[b] * p->seen[a];
+}
+
+/* Sort the attributes of each table by the average position their keys
+ * arrived at since the last call, those that never arrived go last and ties
+ * keep their order, then start counting again. The orders only depend on
+ * the tables, so they can be saved and copied back after preparing the same
+ * tree later on. */
+int jser_lookup_learn(jser_lookup_t *l)
+{
+    assert(l);
+    assert(l->tables || l->used == 0);
+    for (size_t t = 0; t < l->used; t++) {
+        jser_probe_t *p = &l->tables[t];
+        size_t *r = p->order;
+        for (size_t i = 1; i < p->length; i++) { /* insertion sort, tables are small */
+            const size_t a = r[i];
+            size_t k = i;
+            for (; k > 0 && jser_earlier(p, a, r[k - 1]); k--) {
+                r[k] = r[k - 1];
+            }
+            r[k] = a;
+        }
+        memset(p->sum, 0, sizeof (*p->sum) * p->length);
+        memset(p->seen, 0, sizeof (*p->seen) * p->length);
+    }
+    l->lookups = 0;
+    l->probes  = 0;
+    return JSER_OK;
+}
+
+static inline size_t jser_kept(const jsmntok_t *t)
+{
+    assert(t);
+    return t->type == JSMN_OBJECT || t->type == JSMN_ARRAY ? 1 : (size_t)(t->end - t->start);
+}
+
+/* Where input 'offset' ends up after 'jser_compact' */
+static size_t jser_compacted(const jsmntok_t *t, const jsmnint_t count, const size_t tail, const size_t offset)
+{
+    assert(t);
+    size_t at = 0;
+    for (jsmnint_t i = 0; i < count; i++) {
+        const size_t start = t[i].start, n = jser_kept(&t[i]);
+        if (offset < start) {
+            return at;
+        }
+        if (offset < (start + n)) {
+            return at + (offset - start);
+        }
+        at += n;
+    }
+    return offset < tail ? at : at + (offset - tail);
+}
+
+/* Make room in a full window by throwing away input that is no longer
+ * needed, which is everything but the text of the tokens still in use and
+ * the input not yet tokenized. Only the first byte of an object or array is
+ * kept, so it can still be told apart from the others. Tokens, and the
+ * position of the tokenizer, are moved to match. */
+static void jser_compact(jsmn_parser *jp, jsmntok_t *t, jser_streamer_t *s, jser_buffer_t *w)
+{
+    assert(jp);
+    assert(t);
+    assert(s);
+    assert(w);
+    const jsmnint_t count = jp->toknext;
+    const size_t tail = jp->pos;
+    for (jsmnint_t i = 0; i < count; i++) {
+        if ((t[i].type == JSMN_OBJECT || t[i].type == JSMN_ARRAY) && t[i].end != -1) {
+            t[i].end = jser_compacted(t, count, tail, t[i].end);
+        }
+    }
+    jsmnint_t start = -1;
+    size_t at = 0;
+    for (jsmnint_t i = 0; i < count; i++) {
+        const size_t n = jser_kept(&t[i]);
+        memmove(&w->buf[at], &w->buf[t[i].start], n);
+        if (t[i].type == JSMN_ARRAY && t[i].start == s->start) {
+            start = at;
+        }
+        if (t[i].type != JSMN_OBJECT && t[i].type != JSMN_ARRAY) {
+            t[i].end = at + n;
+        }
+        t[i].start = at;
+        at += n;
+    }
+    s->start = start;
+    memmove(&w->buf[at], &w->buf[tail], w->used - tail);
+    w->used = at + (w->used - tail);
+    jp->pos = at;
+    if (jp->partial >= 0 && (size_t)jp->partial == tail) { /* a token it stopped within moves with the rest */
+        jp->checked -= tail - at;
+        jp->partial = at;
+    } else {
+        jp->partial = -1;
+    }
+}
+
+/* The decoder is handed input a piece at a time, which is read straight
+ * into the window and tokenized as it arrives; when the window fills up it
+ * is compacted. Elements of a stream are bound as they complete, so a
+ * document much larger than the window can be deserialized if most of it is
+ * a stream. Everything else is bound once the document is complete. */
+int jser_decoder_init(jser_decoder_t *d, jser_t *j, size_t jlen, jsmntok_t *t, const size_t tokens, jser_buffer_t *window, jser_frame_t *stack, const size_t depth)
+{
+    assert(d);
+    assert(j);
+    assert(t);
+    assert(window);
+    assert(stack || depth == 0);
+    assert(tokens <= JSMNINT_MAX);
+    memset(d, 0, sizeof (*d));
+    if (window->length > JSMNINT_MAX) {
+        return d->result = JSER_ERR_CONFIG;
+    }
+    d->j      = j;
+    d->jlen   = jlen;
+    d->t      = t;
+    d->tokens = tokens;
+    d->window = window;
+    d->stack  = stack;
+    d->depth  = depth;
+    d->start  = -1;
+    d->chunk  = -1;
+    d->result = 1;
+    jsmn_init(&d->jp);
+    d->jp.element = stream_hook;
+    memset(t, 0, sizeof (*t) * tokens);
+    window->used = 0;
+    return JSER_OK;
+}
+
+int jser_decoder_limit(jser_decoder_t *d, const jser_limits_t *limits)
+{
+    assert(d);
+    assert(limits);
+    if (d->result <= 0 || d->read) {
+        return d->result < 0 ? d->result : JSER_ERR_CONFIG;
+    }
+    d->limits = limits;
+    jser_limit(&d->jp, limits);
+    return JSER_OK;
+}
+
+/* Hand on what has been checked of a chunked value that a full window
+ * stopped within, so all of it need not fit at once; the rest stays in the
+ * window and is bound as usual. Only a value reached through object
+ * attributes from the root can be found this early. */
+static int decoder_drain(jser_decoder_t *d)
+{
+    assert(d);
+    jsmn_parser *jp = &d->jp;
+    jser_buffer_t *w = d->window;
+    const jsmnint_t key = jp->toksuper;
+    if (jp->partial < 0 || (size_t)jp->partial != jp->pos || w->buf[jp->partial] != '"' || key < 0 || d->t[key].size != 0) {
+        return JSER_OK;
+    }
+    jser_input_t in = { .segments = w, .count = 1, .cur = (const char *)w->buf, .hi = w->used, };
+    jser_opts_t sp = { .max = JSER_MAX_DEPTH, .in = &in, .limits = d->limits, };
+    const jser_streamer_t streamer = { .sp = &sp, .j = d->j, .jlen = d->jlen, };
+    const jser_t *e = value_node(&streamer, d->t, key);
+    if (!e || e->type != JSER_CHUNKED_E) {
+        return JSER_OK;
+    }
+    const jser_chunked_t *c = e->data.chunked;
+    const size_t from = jp->partial + 1, limit = d->limits ? d->limits->string : 0;
+    size_t n = (size_t)jp->checked > from ? jp->checked - from : 0, taken = 0;
+    if (limit && d->drained + n > limit) {
+        return JSER_ERR_LIMIT;
+    }
+    if (limit && d->drained + n == limit) { /* leave the tokenizer something to check */
+        n--;
+    }
+    if (chunk_ready(&sp, c) < 0) {
+        return sp.error;
+    }
+    c->buf->used = 0;
+    const int r = c->base64 ?
+        chunk_base64(&sp, c, &w->buf[from], n, &taken) :
+        chunk_string(&sp, c, (const char *)&w->buf[from], n, &taken);
+    if (r < 0 || (c->buf->used && chunk_flush(&sp, c, false) < 0)) {
+        return sp.error;
+    }
+    memmove(&w->buf[from], &w->buf[from + taken], w->used - (from + taken));
+    w->used     -= taken;
+    jp->checked -= taken;
+    d->drained  += taken;
+    d->scanned  += taken;
+    d->chunk     = jp->partial;
+    if (limit) {
+        jp->max_string = limit - d->drained;
+    }
+    return JSER_OK;
+}
+
+int jser_decoder_space(jser_decoder_t *d, unsigned char **buf, size_t *length)
+{
+    assert(d);
+    assert(buf);
+    assert(length);
+    jser_buffer_t *w = d->window;
+    if (d->result <= 0) {
+        return d->result < 0 ? d->result : JSER_ERR_CONFIG;
+    }
+    if (w->used == w->length) {
+        const int r = decoder_drain(d);
+        if (r < 0) {
+            return d->result = r;
+        }
+    }
+    if (w->used == w->length) {
+        jser_streamer_t streamer = { .start = d->start, };
+        const jsmnint_t partial = d->jp.partial;
+        jser_compact(&d->jp, d->t, &streamer, w);
+        d->start = streamer.start;
+        d->chunk = d->chunk == partial ? d->jp.partial : -1;
+        if (w->used == w->length) {
+            return d->result = JSER_ERR_SPACE;
+        }
+    }
+    *buf    = &w->buf[w->used];
+    *length = w->length - w->used;
+    return JSER_OK;
+}
+
+/* Tokenize up to 'budget' bytes of the input pushed so far, or all of it at
+ * the end of the input, then once the document is complete bind it with
+ * whatever is left of the budget, a byte of a value being a unit of work.
+ * A token is only produced once all of it has been seen, the tokenizer
+ * remembers how far it got through one that is longer than the budget so
+ * each byte is only checked once; but a value is bound in one go, so the
+ * longest string the caller's limits allow bounds the work of a step. */
+static int decoder_run(jser_decoder_t *d, size_t budget, const bool eof)
+{
+    assert(d);
+    jser_buffer_t *w = d->window;
+    jser_input_t in = { .segments = w, .count = 1, .cur = (const char *)w->buf, .hi = w->used, };
+    jser_opts_t sp = { .max = JSER_MAX_DEPTH, .in = &in, .limits = d->limits, .spill = d->spill, };
+    if (!d->binding) {
+        jser_streamer_t streamer = {
+            .sp     = &sp,
+            .j      = d->j,
+            .jlen   = d->jlen,
+            .stack  = d->stack,
+            .depth  = d->depth,
+            .start  = d->start,
+            .stream = d->stream,
+            .index  = d->index,
+        };
+        const size_t k = eof || budget > d->pending ? d->pending : budget, pos = d->jp.pos;
+        d->jp.param = &streamer;
+        d->jp.more  = !eof;
+        const jsmnint_t rv = jsmn_parse(&d->jp, (const char *)w->buf, w->used - d->pending + k, d->t, d->tokens);
+        d->jp.param = NULL;
+        d->start    = streamer.start;
+        d->stream   = streamer.stream;
+        d->index    = streamer.index;
+        d->pending -= k;
+        d->scanned += d->jp.pos - pos;
+        if (d->drained && !(d->jp.partial == d->chunk && (size_t)d->jp.partial == d->jp.pos)) { /* the value handed on has ended */
+            d->drained = 0;
+            d->chunk   = -1;
+            d->jp.max_string = d->limits ? d->limits->string : 0;
+        }
+        budget = eof ? SIZE_MAX : budget - k;
+        const bool closed = rv >= 0 && d->jp.toknext > 0; /* the first token is the root */
+        if (eof || closed || (rv < 0 && rv != JSMN_ERROR_PART) || sp.error) {
+            const int r = jser_tokenized(&sp, &d->jp, rv);
+            if (r < 0) {
+                return d->result = r;
+            }
+        }
+        if (!closed) {
+            return d->pending ? 2 : 1;
+        }
+        if (d->t[0].type != JSMN_OBJECT) {
+            return d->result = JSER_ERR_PARSE;
+        }
+        d->root = (jser_t){ .type = JSER_OBJECT_E, .data.jser = d->j, .length = d->jlen, .used = d->jlen, };
+        d->next = &d->root;
+        d->binding = true;
+    }
+    const jsmnint_t r = jser_resume(&sp, d->stack, d->depth, &d->next, &d->pos, &d->top, &d->skip, d->t, d->jp.toknext, budget);
+    if (r < 0 || sp.error) {
+        return d->result = sp.error ? sp.error : JSER_ERR_UNKNOWN;
+    }
+    if (r == 0) {
+        return 2;
+    }
+    d->pos = r;
+    return d->result = JSER_OK;
+}
+
+int jser_decoder_step(jser_decoder_t *d, size_t n, size_t budget, jser_progress_t *progress)
+{
+    assert(d);
+    jser_buffer_t *w = d->window;
+    int r = d->result;
+    if (r > 0 && n > (w->length - w->used)) {
+        r = d->result = JSER_ERR_CONFIG;
+    }
+    if (r > 0 && d->limits && jser_over(d->limits->bytes, d->read + n)) {
+        r = d->result = JSER_ERR_LIMIT;
+    }
+    if (r > 0) {
+        w->used    += n;
+        d->read    += n;
+        d->pending += n;
+        r = decoder_run(d, budget, false);
+    }
+    if (progress) {
+        progress->bytes  = d->scanned;
+        progress->tokens = d->pos;
+        progress->total  = d->binding ? (size_t)d->jp.toknext : 0;
+    }
+    return r;
+}
+
+int jser_decoder_push(jser_decoder_t *d, size_t n)
+{
+    assert(d);
+    if (d->result <= 0) {
+        return d->result;
+    }
+    return n ? jser_decoder_step(d, n, SIZE_MAX, NULL) : decoder_run(d, SIZE_MAX, true);
+}
+
+int jser_deserialize_from_source(jser_t *j, size_t jlen, jsmntok_t *t, const size_t tokens, const jser_source_t *source, jser_buffer_t *window)
+{
+    assert(source);
+    assert(source->read);
+    jser_frame_t stack[JSER_STACK_DEPTH];
+    jser_decoder_t d;
+    int r = jser_decoder_init(&d, j, jlen, t, tokens, window, stack, ELEMENTS(stack));
+    if (r < 0) {
+        return r;
+    }
+    d.spill = true; /* all of the input is pushed without a budget, so nesting need not be limited */
+    for (;;) {
+        unsigned char *buf = NULL;
+        size_t room = 0;
+        if ((r = jser_decoder_space(&d, &buf, &room)) < 0) {
+            return r;
+        }
+        size_t n = room;
+        if (source->read(source->param, buf, &n) < 0 || n > room) {
+            return JSER_ERR_CALLBACK;
+        }
+        if ((r = jser_decoder_push(&d, n)) <= 0) {
+            return r;
+        }
+    }
+}
+
+int jser_deserialize_from_buffer(jser_t *j, size_t jlen, jsmntok_t *t, const size_t tokens, jser_buffer_t *b)
+{
+    return jser_deserialize_with_stack(j, jlen, t, tokens, b, NULL, 0);
+}
+
+int jser_deserialize_from_asciiz(jser_t *j, size_t jlen, jsmntok_t *t, const size_t tokens, const char *asciiz)
+{
+    assert(j);
+    assert(t);
+    assert(asciiz);
+    const size_t length = strlen(asciiz);
+    jser_buffer_t b = {
+        .length = length,
+        .used   = length,
+        .buf    = (unsigned char *)asciiz,
+    };
+    return jser_deserialize_from_buffer(j, jlen, t, tokens, &b);
+}
+
+/* ~~~ Validation and Reformatting ~~~ */
+
+/* These work on the bytes of a document directly, with no tokens and no
+ * schema. White space and the bodies of strings, where most of the bytes
+ * usually are, are skipped over by the scanning kernels. */
+
+typedef struct {
+    jser_opts_t *sp;
+    const jser_kernels_t *k; /**< scanners to use */
+    const unsigned char *in;
+    size_t length, pos;
+    jser_buffer_t *out;     /**< NULL if only validating, may be the same buffer as the input if minifying */
+    size_t depth;
+    unsigned char objects[JSER_LINT_DEPTH / 8]; /**< a bit for each level of nesting, set for objects */
+} jser_lint_t;
+
+static int lint_emit(jser_lint_t *l, const size_t start)
+{
+    assert(l);
+    assert(start <= l->pos);
+    jser_buffer_t *b = l->out;
+    const size_t n = l->pos - start;
+    if (!b) {
+        return 0;
+    }
+    if (jser_reserve(l->sp, b, n) < 0) {
+        return -1;
+    }
+    memmove(&b->buf[b->used], &l->in[start], n); /* output never overtakes input */
+    b->used += n;
+    return 0;
+}
+
+static int lint_newline(jser_lint_t *l)
+{
+    assert(l);
+    if (!l->out) {
+        return 0;
+    }
+    return add_newline(l->sp, l->out) < 0 ? -1 : add_indent(l->sp, l->out, l->depth);
+}
+
+static int lint_string(jser_lint_t *l)
+{
+    assert(l);
+    assert(l->in[l->pos] == '"');
+    const unsigned char *p = l->in;
+    const size_t start = l->pos++;
+    for (;;) {
+        l->pos += l->k->string(&p[l->pos], l->length - l->pos);
+        if (l->pos >= l->length) {
+            return on_error(l->sp, JSER_ERR_MORE_DAT);
+        }
+        if (p[l->pos] == '"') {
+            break;
+        }
+        if (p[l->pos] < 0x20) {
+            return on_error(l->sp, JSER_ERR_PARSE);
+        }
+        const size_t n = (l->length - l->pos) - 1; /* after the backslash */
+        if (n < 1) {
+            return on_error(l->sp, JSER_ERR_MORE_DAT);
+        }
+        switch (p[l->pos + 1]) {
+        case '"': case '\\': case '/': case 'b': case 'f': case 'n': case 'r': case 't':
+            l->pos += 2;
+            break;
+        case 'u':
+            if (n < 5) {
+                return on_error(l->sp, JSER_ERR_MORE_DAT);
+            }
+            if (jser_hex4((const char *)&p[l->pos + 2]) < 0) {
+                return on_error(l->sp, JSER_ERR_PARSE);
+            }
+            l->pos += 6;
+            break;
+        default:
+            return on_error(l->sp, JSER_ERR_PARSE);
+        }
+    }
+    l->pos++;
+    return lint_emit(l, start);
+}
+
+static inline size_t lint_digits(const jser_lint_t *l, size_t i)
+{
+    assert(l);
+    for (; i < l->length && l->in[i] >= '0' && l->in[i] <= '9'; i++)
+        ;
+    return i;
+}
+
+static int lint_number(jser_lint_t *l)
+{
+    assert(l);
+    const unsigned char *p = l->in;
+    const size_t n = l->length, start = l->pos;
+    size_t i = start + (p[start] == '-');
+    if (i >= n) {
+        return on_error(l->sp, JSER_ERR_MORE_DAT);
+    }
+    if (p[i] == '0') {
+        i++;
+    } else if (p[i] >= '1' && p[i] <= '9') {
+        i = lint_digits(l, i);
+    } else {
+        return on_error(l->sp, JSER_ERR_PARSE);
+    }
+    if (i < n && p[i] == '.') {
+        const size_t d = ++i;
+        if ((i = lint_digits(l, i)) == d) {
+            return on_error(l->sp, i >= n ? JSER_ERR_MORE_DAT : JSER_ERR_PARSE);
+        }
+    }
+    if (i < n && (p[i] == 'e' || p[i] == 'E')) {
+        i++;
+        i += i < n && (p[i] == '+' || p[i] == '-');
+        const size_t d = i;
+        if ((i = lint_digits(l, i)) == d) {
+            return on_error(l->sp, i >= n ? JSER_ERR_MORE_DAT : JSER_ERR_PARSE);
+        }
+    }
+    l->pos = i;
+    return lint_emit(l, start);
+}
+
+static int lint_literal(jser_lint_t *l)
+{
+    assert(l);
+    static const char *literals[] = { "true", "false", "null", };
+    const size_t left = l->length - l->pos, start = l->pos;
+    for (size_t i = 0; i < ELEMENTS(literals); i++) {
+        const size_t n = strlen(literals[i]);
+        if (memcmp(&l->in[start], literals[i], left < n ? left : n)) {
+            continue;
+        }
+        if (left < n) {
+            return on_error(l->sp, JSER_ERR_MORE_DAT);
+        }
+        l->pos += n;
+        return lint_emit(l, start);
+    }
+    return on_error(l->sp, JSER_ERR_PARSE);
+}
+
+/* An attribute of an object, up to and including its colon */
+static int lint_key(jser_lint_t *l)
+{
+    assert(l);
+    if (l->pos >= l->length) {
+        return on_error(l->sp, JSER_ERR_MORE_DAT);
+    }
+    if (l->in[l->pos] != '"') {
+        return on_error(l->sp, JSER_ERR_PARSE);
+    }
+    if (lint_string(l) < 0) {
+        return -1;
+    }
+    l->pos += l->k->space(&l->in[l->pos], l->length - l->pos);
+    if (l->pos >= l->length) {
+        return on_error(l->sp, JSER_ERR_MORE_DAT);
+    }
+    if (l->in[l->pos] != ':') {
+        return on_error(l->sp, JSER_ERR_PARSE);
+    }
+    l->pos++;
+    if (lint_emit(l, l->pos - 1) < 0) {
+        return -1;
+    }
+    return l->out ? add_space(l->sp, l->out) : 0;
+}
+
+/* Check a single JSON value, copying it to the output (if any) with the
+ * white space removed or, if pretty printing, replaced. Nesting is tracked
+ * with a bit per level rather than recursion. */
+static int jser_lint(jser_lint_t *l)
+{
+    assert(l);
+    jser_opts_t *sp = l->sp;
+    const unsigned char *p = l->in;
+    for (int value = 1;;) {
+        l->pos += l->k->space(&p[l->pos], l->length - l->pos);
+        if (l->depth == 0 && !value) {
+            return l->pos == l->length ? 0 : on_error(sp, JSER_ERR_PARSE);
+        }
+        if (l->pos >= l->length) {
+            return on_error(sp, JSER_ERR_MORE_DAT);
+        }
+        const int ch = p[l->pos];
+        if (!value) {
+            const int object = (l->objects[(l->depth - 1) / 8] >> ((l->depth - 1) % 8)) & 1;
+            l->pos++;
+            if (ch == ',') {
+                if (lint_emit(l, l->pos - 1) < 0 || lint_newline(l) < 0) {
+                    return -1;
+                }
+                if (object) {
+                    l->pos += l->k->space(&p[l->pos], l->length - l->pos);
+                    if (lint_key(l) < 0) {
+                        return -1;
+                    }
+                }
+                value = 1;
+                continue;
+            }
+            if (ch != (object ? '}' : ']')) {
+                return on_error(sp, JSER_ERR_PARSE);
+            }
+            l->depth--;
+            if (lint_newline(l) < 0 || lint_emit(l, l->pos - 1) < 0) {
+                return -1;
+            }
+            continue;
+        }
+        int r = 0;
+        switch (ch) {
+        case '{':
+        case '[': {
+            if (l->depth >= JSER_LINT_DEPTH) {
+                return on_error(sp, JSER_ERR_DEPTH);
+            }
+            const unsigned char bit = 1u << (l->depth % 8);
+            l->objects[l->depth / 8] = ch == '{' ? l->objects[l->depth / 8] | bit : l->objects[l->depth / 8] & ~bit;
+            l->pos++;
+            if (lint_emit(l, l->pos - 1) < 0) {
+                return -1;
+            }
+            l->pos += l->k->space(&p[l->pos], l->length - l->pos);
+            if (l->pos < l->length && p[l->pos] == (ch == '{' ? '}' : ']')) { /* empty */
+                l->pos++;
+                r = lint_emit(l, l->pos - 1);
+                break;
+            }
+            l->depth++;
+            if (lint_newline(l) < 0) {
+                return -1;
+            }
+            if (ch == '{' && lint_key(l) < 0) {
+                return -1;
+            }
+            continue;
+        }
+        case '"':
+            r = lint_string(l);
+            break;
+        case '-': case '0': case '1': case '2': case '3': case '4':
+        case '5': case '6': case '7': case '8': case '9':
+            r = lint_number(l);
+            break;
+        default:
+            r = lint_literal(l);
+            break;
+        }
+        if (r < 0) {
+            return -1;
+        }
+        value = 0;
+    }
+}
+
+static int jser_reformat(const jser_buffer_t *in, jser_buffer_t *out, const int pretty)
+{
+    assert(in);
+    jser_opts_t sp = { .pretty = jser_boolify(pretty), };
+    jser_lint_t l = { .sp = &sp, .k = jser_kernel(), .in = in->buf, .length = in->used, .out = out, };
+    if (out) {
+        out->used = 0;
+    }
+    return jser_lint(&l) < 0 ? sp.error : JSER_OK;
+}
+
+int jser_validate(const jser_buffer_t *b)
+{
+    assert(b);
+    return jser_reformat(b, NULL, 0);
+}
+
+int jser_minify(const jser_buffer_t *in, jser_buffer_t *out)
+{
+    assert(in);
+    assert(out);
+    return jser_reformat(in, out, 0);
+}
+
+int jser_prettify(const jser_buffer_t *in, jser_buffer_t *out)
+{
+    assert(in);
+    assert(out);
+    if (in->buf == out->buf) {
+        return JSER_ERR_CONFIG;
+    }
+    return jser_reformat(in, out, 1);
+}
+
+/* ~~~ Compression ~~~ */
+
+/* The built in codec is a byte oriented LZ77 variant; each sequence is a
+ * token byte holding the number of literals in its top nibble and the
+ * match length less three in the bottom nibble (zero for no match), a
+ * nibble of 15 is followed by bytes that are added to it until one is not
+ * 255. Then come the literals and, if there is a match, a two byte little
+ * endian offset back into the data already produced. */
+
+enum { LZ_TOKEN, LZ_LITERALS, LZ_LITERAL, LZ_OFFSET_LO, LZ_OFFSET_HI, LZ_MATCHES, LZ_MATCH, };
+
+#define LZ_MIN_MATCH (4)
+
+static inline unsigned lz_hash(const unsigned char *p)
+{
+    assert(p);
+    const uint32_t v = (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+    return (v * 2654435761ul) >> 22 & 1023u;
+}
+
+static int lz_drain(jser_lz_t *lz)
+{
+    assert(lz);
+    if (lz->ilen && lz->sink->flush(lz->sink->param, lz->io, lz->ilen) < 0) {
+        return -1;
+    }
+    lz->ilen = 0;
+    return 0;
+}
+
+static int lz_put(jser_lz_t *lz, const unsigned char *p, size_t n)
+{
+    assert(lz);
+    assert(p || n == 0);
+    while (n) {
+        if (lz->ilen == sizeof (lz->io) && lz_drain(lz) < 0) {
+            return -1;
+        }
+        const size_t room = sizeof (lz->io) - lz->ilen, m = n < room ? n : room;
+        memcpy(&lz->io[lz->ilen], p, m);
+        lz->ilen += m;
+        p += m;
+        n -= m;
+    }
+    return 0;
+}
+
+static int lz_count(jser_lz_t *lz, size_t n)
+{
+    assert(lz);
+    for (; n >= 255; n -= 255) {
+        const unsigned char c = 255;
+        if (lz_put(lz, &c, 1) < 0) {
+            return -1;
+        }
+    }
+    const unsigned char c = n;
+    return lz_put(lz, &c, 1);
+}
+
+static int lz_sequence(jser_lz_t *lz, const unsigned char *literals, const size_t nlit, const size_t match, const size_t offset)
+{
+    assert(lz);
+    assert(match == 0 || match >= LZ_MIN_MATCH);
+    const size_t ml = match ? match - 3 : 0;
+    const unsigned char token = (nlit < 15 ? nlit : 15) << 4 | (ml < 15 ? ml : 15);
+    if (lz_put(lz, &token, 1) < 0) {
+        return -1;
+    }
+    if (nlit >= 15 && lz_count(lz, nlit - 15) < 0) {
+        return -1;
+    }
+    if (lz_put(lz, literals, nlit) < 0) {
+        return -1;
+    }
+    if (match == 0) {
+        return 0;
+    }
+    const unsigned char off[2] = { offset & 0xFF, offset >> 8 };
+    if (lz_put(lz, off, sizeof off) < 0) {
+        return -1;
+    }
+    return ml >= 15 ? lz_count(lz, ml - 15) : 0;
+}
+
+/* Compress 'history[from, to)', earlier history can be referred back to */
+static int lz_compress(jser_lz_t *lz, const size_t from, const size_t to)
+{
+    assert(lz);
+    assert(from <= to);
+    const unsigned char *h = lz->history;
+    size_t literal = from, i = from;
+    while ((i + LZ_MIN_MATCH) <= to) {
+        const unsigned slot = lz_hash(&h[i]);
+        const size_t candidate = lz->table[slot];
+        lz->table[slot] = i + 1;
+        if (candidate == 0 || (i - (candidate - 1)) > JSER_LZ_WINDOW || memcmp(&h[candidate - 1], &h[i], LZ_MIN_MATCH)) {
+            i++;
+            continue;
+        }
+        const size_t c = candidate - 1;
+        size_t n = LZ_MIN_MATCH;
+        while ((i + n) < to && h[c + n] == h[i + n]) {
+            n++;
+        }
+        if (lz_sequence(lz, &h[literal], i - literal, n, i - c) < 0) {
+            return -1;
+        }
+        i += n;
+        literal = i;
+    }
+    return to > literal ? lz_sequence(lz, &h[literal], to - literal, 0, 0) : 0;
+}
+
+/* Only the last window of history is needed, slide it to the front */
+static void lz_slide(jser_lz_t *lz)
+{
+    assert(lz);
+    assert(lz->hlen >= JSER_LZ_WINDOW);
+    const size_t drop = lz->hlen - JSER_LZ_WINDOW;
+    memmove(lz->history, &lz->history[drop], JSER_LZ_WINDOW);
+    lz->hlen = JSER_LZ_WINDOW;
+    for (size_t i = 0; i < ELEMENTS(lz->table); i++) {
+        lz->table[i] = lz->table[i] > drop ? lz->table[i] - drop : 0;
+    }
+}
+
+static int lz_flush(void *param, const unsigned char *buf, size_t length)
+{
+    assert(param);
+    assert(buf || length == 0);
+    jser_lz_t *lz = param;
+    if (length == 0) { /* end of output, pass it on */
+        if (lz_drain(lz) < 0) {
+            return -1;
+        }
+        return lz->sink->flush(lz->sink->param, lz->io, 0);
+    }
+    while (length) {
+        if (lz->hlen == sizeof (lz->history)) {
+            lz_slide(lz);
+        }
+        const size_t room = sizeof (lz->history) - lz->hlen, n = length < room ? length : room;
+        memcpy(&lz->history[lz->hlen], buf, n);
+        if (lz_compress(lz, lz->hlen, lz->hlen + n) < 0) {
+            return -1;
+        }
+        lz->hlen += n;
+        buf += n;
+        length -= n;
+    }
+    return 0;
+}
+
+int jser_lz_encoder(jser_lz_t *lz, const jser_sink_t *next, jser_sink_t *stage)
+{
+    assert(lz);
+    assert(next);
+    assert(stage);
+    BUILD_BUG_ON((2 * JSER_LZ_WINDOW) > 65535);
+    if (!next->flush) {
+        return JSER_ERR_CONFIG;
+    }
+    memset(lz, 0, sizeof (*lz));
+    lz->sink = next;
+    stage->flush = lz_flush;
+    stage->grow  = NULL;
+    stage->param = lz;
+    return JSER_OK;
+}
+
+/* Next byte of compressed input, -1 at the end of it, -2 on error */
+static int lz_get(jser_lz_t *lz)
+{
+    assert(lz);
+    if (lz->ipos == lz->ilen) {
+        size_t n = sizeof (lz->io);
+        if (lz->source->read(lz->source->param, lz->io, &n) < 0 || n > sizeof (lz->io)) {
+            return -2;
+        }
+        lz->ipos = 0;
+        lz->ilen = n;
+        if (n == 0) {
+            return -1;
+        }
+    }
+    return lz->io[lz->ipos++];
+}
+
+static void lz_emit(jser_lz_t *lz, const int ch)
+{
+    assert(lz);
+    if (lz->hlen == sizeof (lz->history)) {
+        lz_slide(lz);
+    }
+    lz->history[lz->hlen++] = ch;
+}
+
+static int lz_read(void *param, unsigned char *buf, size_t *length)
+{
+    assert(param);
+    assert(buf);
+    assert(length);
+    jser_lz_t *lz = param;
+    size_t n = 0;
+    while (n < *length) {
+        if (lz->state == LZ_MATCH) {
+            if (lz->match == 0) {
+                lz->state = LZ_TOKEN;
+                continue;
+            }
+            if (lz->offset == 0 || lz->offset > lz->hlen) {
+                return -1;
+            }
+            const int ch = lz->history[lz->hlen - lz->offset];
+            lz_emit(lz, ch);
+            buf[n++] = ch;
+            lz->match--;
+            continue;
+        }
+        if (lz->state == LZ_LITERAL && lz->literals == 0) {
+            lz->state = lz->match ? LZ_OFFSET_LO : LZ_TOKEN;
+            continue;
+        }
+        const int ch = lz_get(lz);
+        if (ch == -1 && lz->state == LZ_TOKEN) {
+            break; /* end of input */
+        }
+        if (ch < 0) {
+            return -1; /* error or truncated input */
+        }
+        switch (lz->state) {
+        case LZ_TOKEN:
+            lz->literals = ch >> 4;
+            lz->match    = ch & 0xF;
+            lz->state    = lz->literals == 15 ? LZ_LITERALS : LZ_LITERAL;
+            break;
+        case LZ_LITERALS:
+            lz->literals += ch;
+            lz->state = ch == 255 ? LZ_LITERALS : LZ_LITERAL;
+            break;
+        case LZ_LITERAL:
+            lz_emit(lz, ch);
+            buf[n++] = ch;
+            lz->literals--;
+            break;
+        case LZ_OFFSET_LO:
+            lz->offset = ch;
+            lz->state = LZ_OFFSET_HI;
+            break;
+        case LZ_OFFSET_HI:
+            lz->offset |= (size_t)ch << 8;
+            lz->state = lz->match == 15 ? LZ_MATCHES : LZ_MATCH;
+            lz->match += 3;
+            break;
+        case LZ_MATCHES:
+            lz->match += ch;
+            lz->state = ch == 255 ? LZ_MATCHES : LZ_MATCH;
+            break;
+        default:
+            return -1;
+        }
+    }
+    *length = n;
+    return 0;
+}
+
+int jser_lz_decoder(jser_lz_t *lz, const jser_source_t *next, jser_source_t *stage)
+{
+    assert(lz);
+    assert(next);
+    assert(stage);
+    if (!next->read) {
+        return JSER_ERR_CONFIG;
+    }
+    memset(lz, 0, sizeof (*lz));
+    lz->source = next;
+    lz->state  = LZ_TOKEN;
+    stage->read  = lz_read;
+    stage->param = lz;
+    return JSER_OK;
+}
+
+#if JSER_ENABLE_ZLIB
+static int zlib_flush(void *param, const unsigned char *buf, size_t length)
+{
+    assert(param);
+    assert(buf || length == 0);
+    jser_zlib_t *zs = param;
+    const int end = length == 0;
+    zs->z.next_in  = (unsigned char *)buf;
+    zs->z.avail_in = length;
+    for (;;) {
+        zs->z.next_out  = zs->io;
+        zs->z.avail_out = sizeof (zs->io);
+        const int r = deflate(&zs->z, end ? Z_FINISH : Z_NO_FLUSH);
+        if (r != Z_OK && r != Z_STREAM_END && r != Z_BUF_ERROR) {
+            return -1;
+        }
+        const size_t n = sizeof (zs->io) - zs->z.avail_out;
+        if (n && zs->sink->flush(zs->sink->param, zs->io, n) < 0) {
+            return -1;
+        }
+        if (end ? r == Z_STREAM_END : (zs->z.avail_in == 0 && zs->z.avail_out != 0)) {
+            break;
+        }
+    }
+    return end ? zs->sink->flush(zs->sink->param, zs->io, 0) : 0;
+}
+
+int jser_zlib_encoder(jser_zlib_t *zs, int level, const jser_sink_t *next, jser_sink_t *stage)
+{
+    assert(zs);
+    assert(next);
+    assert(stage);
+    if (!next->flush) {
+        return JSER_ERR_CONFIG;
+    }
+    memset(zs, 0, sizeof (*zs));
+    if (deflateInit(&zs->z, level) != Z_OK) {
+        return JSER_ERR_CONFIG;
+    }
+    zs->sink = next;
+    stage->flush = zlib_flush;
+    stage->grow  = NULL;
+    stage->param = zs;
+    return JSER_OK;
+}
+
+static int zlib_read(void *param, unsigned char *buf, size_t *length)
+{
+    assert(param);
+    assert(buf);
+    assert(length);
+    jser_zlib_t *zs = param;
+    if (*length == 0) {
+        return 0;
+    }
+    zs->z.next_out  = buf;
+    zs->z.avail_out = *length;
+    while (!zs->eof && zs->z.avail_out == *length) {
+        if (zs->z.avail_in == 0) {
+            size_t n = sizeof (zs->io);
+            if (zs->source->read(zs->source->param, zs->io, &n) < 0 || n == 0 || n > sizeof (zs->io)) {
+                return -1; /* error or truncated input */
+            }
+            zs->z.next_in  = zs->io;
+            zs->z.avail_in = n;
+        }
+        const int r = inflate(&zs->z, Z_NO_FLUSH);
+        if (r != Z_OK && r != Z_STREAM_END) {
+            return -1;
+        }
+        zs->eof = r == Z_STREAM_END;
+    }
+    *length -= zs->z.avail_out;
+    return 0;
+}
+
+int jser_zlib_decoder(jser_zlib_t *zs, const jser_source_t *next, jser_source_t *stage)
+{
+    assert(zs);
+    assert(next);
+    assert(stage);
+    if (!next->read) {
+        return JSER_ERR_CONFIG;
+    }
+    memset(zs, 0, sizeof (*zs));
+    if (inflateInit(&zs->z) != Z_OK) {
+        return JSER_ERR_CONFIG;
+    }
+    zs->source = next;
+    stage->read  = zlib_read;
+    stage->param = zs;
+    return JSER_OK;
+}
+
+int jser_zlib_end(jser_zlib_t *zs)
+{
+    assert(zs);
+    if (zs->sink) {
+        (void)deflateEnd(&zs->z);
+    }
+    if (zs->source) {
+        (void)inflateEnd(&zs->z);
+    }
+    memset(zs, 0, sizeof (*zs));
+    return JSER_OK;
+}
+#endif
+
+/* ~~~ Node retrieval and Tree Walking ~~~ */
+
+static long jser_copy_tree(const jser_t *src, size_t slen, jser_t *pool, size_t plen)
+{
+    assert(src);
+    assert(pool);
+    size_t k = 0;
+    for (size_t i = 0; i < slen; i++) {
+        const jser_t *s = &src[i];
+        if (k >= plen) {
+            return -1;
+        }
+        pool[k] = *s;
+        switch (s->type) {
+        case JSER_OBJECT_E:
+        case JSER_ARRAY_E: {
+            const long st = jser_copy_tree(s->data.jser, s->used, &pool[k], plen);
+            if (st < 0) {
+                return -1;
+            }
+            if (k < k + st) { /* overflow */
+                return -1;
+            }
+            if (st != 0) {
+                pool[k].data.jser = &pool[k + 1];
+            }
+            k += st;
+            break;
+        }
+        default:
+            k++;
+            break;
+        }
+    }
+    return k;
+}
+
+int jser_copy(const jser_t *src, const size_t slen, jser_t *pool, size_t *plen)
+{
+    assert(src);
+    assert(pool);
+    assert(plen);
+    const long st = jser_copy_tree(src, slen, pool, *plen);
+    if (st < 0) {
+        *plen = 0;
+        return -1;
+    }
+    *plen = st;
+    return 0;
+}
+
+int jser_walk_tree(const jser_t *j, size_t jlen, int (*fn)(const jser_t *e, void *param), void *param)
+{
+    assert(j);
+    assert(fn);
+    for (size_t i = 0; i < jlen; i++) {
+        const jser_t *e = &j[i];
+        switch (e->type) {
+        case JSER_OBJECT_E:
+        case JSER_ARRAY_E:
+            if (fn(e, param) < 0) {
+                return -1;
+            }
+            if (jser_walk_tree(e->data.jser, e->used, fn, param) < 0) {
+                return -1;
+            }
+            break;
+        default:
+            if (fn(e, param) < 0) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+typedef struct {
+    size_t nodes;
+} counter_t;
+
+static int fn_walk_tree_count(const jser_t *e, void *param)
+{
+    assert(e);
+    assert(param);
+    ((counter_t *)param)->nodes++;
+    return 0;
+}
+
+int jser_node_count(const jser_t *j, size_t *jlen)
+{
+    assert(j);
+    assert(jlen);
+    counter_t c = { .nodes = 0 };
+    const int r = jser_walk_tree(j, *jlen, fn_walk_tree_count, &c);
+    if (r < 0) {
+        *jlen = 0;
+        return -1;
+    }
+    *jlen = c.nodes;
+    return 0;
+}
+
+static int jser_node_finder(jser_opts_t *sp, const jser_t *j, size_t jlen, jser_t **const found, const char *path, size_t depth)
+{
+    assert(j);
+    assert(found);
+    assert(path);
+
+    if (sp->max != 0 && depth > sp->max) {
+        return on_error(sp, JSER_ERR_DEPTH);
+    }
+
+    *found = NULL;
+    if (*path == '\0') {
+        return 0;
+    }
+    while (*path == '/') {
+        path++;
+    }
+
+    const char *end = strchr(path, '/');
+    if (end == NULL) {
+        end = path + strlen(path);
+    }
+    const size_t nl = end - path;
+    for (size_t i = 0; i < jlen; i++) {
+        const jser_t *e = &j[i];
+        const char *attr = e->attr;
+        const size_t al = strlen(attr);
+        if (al != nl) {
+            continue;
+        }
+        if (memcmp(attr, path, al)) {
+            continue;
+        }
+        if (*end == '\0') {
+            *found = (jser_t *)e;
+            return 1;
+        }
+        if (e->type != JSER_OBJECT_E) {
+            return 0;
+        }
+        /* NB. We could retrieve an array element by processing
+         * a node name as a number.  */
+        return jser_node_finder(sp, e->data.jser, e->used, found, end + 1, depth + 1);
+    }
+    return 0;
+}
+
+int jser_retrieve_node(const jser_t *j, const size_t jlen, jser_t **found, const char *path)
+{
+    assert(j);
+    assert(found);
+    assert(path);
+    jser_opts_t sp = {
+        .max     = JSER_MAX_DEPTH,
+    };
+    return jser_node_finder(&sp, j, jlen, found, path, 0);
+}
+
+/* ~~~ Snapshots ~~~ */
+
+/* The image starts with this header, followed by the leaf values of the
+ * tree in the order they appear in it. Values are stored in the native
+ * format of the machine, the fingerprint covers that as well as the
+ * schema, so an image is only ever loaded back into the program (or one
+ * with an identical schema) that made it. */
+typedef struct {
+    unsigned char magic[4];
+    unsigned long long fingerprint;
+    unsigned long hash;
+    size_t length; /* of the values following the header */
+} snapshot_header_t; /* zeroed before use, so its padding is too */
+
+static const unsigned char snapshot_magic[4] = { 'J', 'S', 'N', '1' };
+
+int jser_hash(const unsigned char *buf, size_t length, unsigned long *hash)
+{
+    assert(buf || length == 0);
+    assert(hash);
+    *hash = jser_fnv1a(FNV1A_BASIS, buf, length);
+    return 0;
+}
+
+/* Mix a number into a fingerprint, the same way whatever its native width */
+static inline void jser_mix(unsigned long long *h, const unsigned long long n)
+{
+    assert(h);
+    unsigned char b[8];
+    for (size_t i = 0; i < sizeof b; i++) {
+        b[i] = (n >> (i * CHAR_BIT)) & 0xFFu;
+    }
+    *h = jser_fnv1a64(*h, b, sizeof b);
+}
+
+/* Every node contributes its type, attribute (a missing one is told apart
+ * from an empty one) and lengths, each table its number of nodes, so that
+ * moving, adding or removing a node changes the fingerprint. */
+static int jser_fingerprint_tree(jser_opts_t *sp, const jser_t *j, const size_t jlen, unsigned long long *h, size_t depth)
+{
+    assert(sp);
+    assert(j || jlen == 0);
+    assert(h);
+    if (sp->max != 0 && depth > sp->max) {
+        return on_error(sp, JSER_ERR_DEPTH);
+    }
+    jser_mix(h, jlen);
+    for (size_t i = 0; i < jlen; i++) {
+        const jser_t *e = &j[i];
+        jser_mix(h, e->type);
+        jser_mix(h, e->is_array);
+        jser_mix(h, e->length);
+        jser_mix(h, e->attr ? strlen(e->attr) : ~0ull);
+        *h = jser_fnv1a64(*h, e->attr ? e->attr : "", e->attr ? strlen(e->attr) : 0);
+        switch (e->type) {
+        case JSER_OBJECT_E:
+        case JSER_ARRAY_E:
+            if (jser_fingerprint_tree(sp, e->data.jser, e->length, h, depth + 1) < 0) {
+                return -1;
+            }
+            break;
+        case JSER_UNION_E:
+            if (!e->data.un || !e->data.un->attr) {
+                return on_error(sp, JSER_ERR_CONFIG);
+            }
+            *h = jser_fnv1a64(*h, e->data.un->attr, strlen(e->data.un->attr) + 1);
+            jser_mix(h, e->data.un->length);
+            for (size_t k = 0; k < e->data.un->length; k++) {
+                const jser_variant_t *v = &e->data.un->variants[k];
+                if (!v->tag) {
+                    return on_error(sp, JSER_ERR_CONFIG);
+                }
+                *h = jser_fnv1a64(*h, v->tag, strlen(v->tag) + 1);
+                if (jser_fingerprint_tree(sp, v->jser, v->length, h, depth + 1) < 0) {
+                    return -1;
+                }
+            }
+            break;
+        case JSER_BUFFER_E:
+            for (size_t k = 0; k < (e->is_array ? e->length : 1); k++) {
+                jser_mix(h, e->data.buf[k].length);
+            }
+            break;
+        case JSER_STREAM_E:
+        case JSER_CHUNKED_E: /* the values are not held in memory */
+            return on_error(sp, JSER_ERR_CONFIG);
+        default:
+            break;
+        }
+    }
+    return 0;
+}
+
+int jser_fingerprint(const jser_t *j, size_t jlen, unsigned long long *fp)
+{
+    assert(j);
+    assert(fp);
+    jser_opts_t sp = { .max = JSER_MAX_DEPTH, };
+    const union { uint16_t u16; unsigned char b[2]; } endian = { .u16 = 1, };
+    *fp = FNV1A64_BASIS;
+    jser_mix(fp, sizeof (jser_long_t));
+    jser_mix(fp, sizeof (jser_ulong_t));
+    jser_mix(fp, sizeof (bool));
+    jser_mix(fp, sizeof (size_t));
+    jser_mix(fp, endian.b[0]);
+    return jser_fingerprint_tree(&sp, j, jlen, fp, 0) < 0 ? sp.error : JSER_OK;
+}
+
+/* Copy 'n' bytes between a variable and the image in the direction given
+ * by 'load', nothing is copied on a dry run but the image is still checked. */
+static int snap_bytes(jser_opts_t *sp, jser_buffer_t *image, void *p, const size_t n, const int load)
+{
+    assert(sp);
+    assert(image);
+    assert(image->used <= image->length);
+    if ((image->length - image->used) < n) {
+        return on_error(sp, load ? JSER_ERR_LENGTH : JSER_ERR_SPACE);
+    }
+    if (sp->dry_run == 0) {
+        assert(p || n == 0);
+        if (load) {
+            memcpy(p, &image->buf[image->used], n);
+        } else {
+            memcpy(&image->buf[image->used], p, n);
+        }
+    }
+    image->used += n;
+    return 0;
+}
+
+/* Counts are copied on a dry run as they are needed to walk the image, the
+ * count is left in '*count' for the caller to store when it is not a dry run */
+static int snap_count(jser_opts_t *sp, jser_buffer_t *image, size_t *count, const size_t max, const int load)
+{
+    assert(sp);
+    assert(image);
+    assert(count);
+    size_t c = *count;
+    const unsigned dry_run = sp->dry_run;
+    sp->dry_run = dry_run && !load;
+    const int r = snap_bytes(sp, image, &c, sizeof c, load);
+    sp->dry_run = dry_run;
+    if (r < 0) {
+        return -1;
+    }
+    if (c > max) {
+        return on_error(sp, JSER_ERR_LENGTH);
+    }
+    *count = c;
+    return 0;
+}
+
+static int jser_snap(jser_opts_t *sp, jser_t *j, const size_t jlen, jser_buffer_t *image, const int load, size_t depth)
+{
+    assert(sp);
+    assert(j || jlen == 0);
+    assert(image);
+    if (sp->max != 0 && depth > sp->max) {
+        return on_error(sp, JSER_ERR_DEPTH);
+    }
+    for (size_t i = 0; i < jlen; i++) {
+        jser_t *e = &j[i];
+        size_t count = 1;
+        if (e->is_array && e->type != JSER_OBJECT_E && e->type != JSER_ARRAY_E) {
+            count = e->used;
+            if (snap_count(sp, image, &count, e->length, load) < 0) {
+                return -1;
+            }
+            if (load && sp->dry_run == 0) {
+                e->used = count;
+            }
+        }
+        switch (e->type) {
+        case JSER_LONG_E:
+            if (snap_bytes(sp, image, e->data.ld, count * sizeof (*e->data.ld), load) < 0) {
+                return -1;
+            }
+            break;
+        case JSER_ULONG_E:
+            if (snap_bytes(sp, image, e->data.lu, count * sizeof (*e->data.lu), load) < 0) {
+                return -1;
+            }
+            break;
+        case JSER_BOOL_E:
+            if (snap_bytes(sp, image, e->data.b, count * sizeof (*e->data.b), load) < 0) {
+                return -1;
+            }
+            break;
+        case JSER_ASCIIZ_E: {
+            if (e->is_array) {
+                return on_error(sp, JSER_ERR_CONFIG);
+            }
+            size_t sl = load ? 0 : strlen(e->data.asciiz);
+            if (load && e->length == 0) { /* cannot write to a string without a length */
+                return on_error(sp, JSER_ERR_TYPE);
+            }
+            if (snap_count(sp, image, &sl, load ? e->length - 1 : sl, load) < 0) {
+                return -1;
+            }
+            if (snap_bytes(sp, image, e->data.asciiz, sl, load) < 0) {
+                return -1;
+            }
+            if (load && sp->dry_run == 0) {
+                e->data.asciiz[sl] = '\0';
+            }
+            break;
+        }
+        case JSER_BUFFER_E:
+            for (size_t k = 0; k < count; k++) {
+                jser_buffer_t *buf = &e->data.buf[k];
+                size_t used = buf->used;
+                if (snap_count(sp, image, &used, buf->length, load) < 0) {
+                    return -1;
+                }
+                if (snap_bytes(sp, image, buf->buf, used, load) < 0) {
+                    return -1;
+                }
+                if (load && sp->dry_run == 0) {
+                    buf->used = used;
+                }
+            }
+            break;
+        case JSER_ARRAY_E: {
+            size_t used = e->used;
+            if (snap_count(sp, image, &used, e->length, load) < 0) {
+                return -1;
+            }
+            if (load && sp->dry_run == 0) {
+                e->used = used;
+            }
+        }
+            /* fall through */
+        case JSER_OBJECT_E:
+            if (jser_snap(sp, e->data.jser, e->length, image, load, depth + 1) < 0) {
+                return -1;
+            }
+            break;
+        case JSER_UNION_E: {
+            jser_union_t *un = e->data.un;
+            size_t selected = un->selected;
+            if (un->length == 0) {
+                return on_error(sp, JSER_ERR_CONFIG);
+            }
+            if (snap_count(sp, image, &selected, un->length - 1, load) < 0) {
+                return -1;
+            }
+            if (load && sp->dry_run == 0) {
+                un->selected = selected;
+            }
+            if (jser_snap(sp, un->variants[selected].jser, un->variants[selected].length, image, load, depth + 1) < 0) {
+                return -1;
+            }
+            break;
+        }
+        default:
+            return on_error(sp, JSER_ERR_CONFIG);
+        }
+    }
+    return 0;
+}
+
+int jser_snapshot_save(const jser_t *j, size_t jlen, unsigned long hash, jser_buffer_t *image)
+{
+    assert(j);
+    assert(image);
+    snapshot_header_t h;
+    memset(&h, 0, sizeof h);
+    h.hash = hash;
+    memcpy(h.magic, snapshot_magic, sizeof h.magic);
+    const int fp = jser_fingerprint(j, jlen, &h.fingerprint);
+    if (fp < 0) {
+        return fp;
+    }
+    jser_opts_t sp = { .max = JSER_MAX_DEPTH, .dry_run = image->buf == NULL, };
+    jser_buffer_t img = { .length = image->buf ? image->length : SIZE_MAX, .used = sizeof h, .buf = image->buf, };
+    image->used = 0;
+    if (img.length < img.used) {
+        return JSER_ERR_SPACE;
+    }
+    if (jser_snap(&sp, (jser_t *)j, jlen, &img, 0, 0) < 0) {
+        return sp.error;
+    }
+    h.length = img.used - sizeof h;
+    if (image->buf) {
+        memcpy(image->buf, &h, sizeof h);
+    }
+    image->used = img.used;
+    return JSER_OK;
+}
+
+int jser_snapshot_load(jser_t *j, size_t jlen, unsigned long hash, const jser_buffer_t *image)
+{
+    assert(j);
+    assert(image);
+    snapshot_header_t h;
+    if (image->used < sizeof h) {
+        return 0;
+    }
+    memcpy(&h, image->buf, sizeof h);
+    unsigned long long fp = 0;
+    const int r = jser_fingerprint(j, jlen, &fp);
+    if (r < 0) {
+        return r;
+    }
+    if (memcmp(h.magic, snapshot_magic, sizeof h.magic) || h.fingerprint != fp || h.hash != hash) {
+        return 0; /* stale, the JSON needs to be deserialized instead */
+    }
+    if (h.length != (image->used - sizeof h)) {
+        return JSER_ERR_LENGTH;
+    }
+    for (int dry_run = 1; dry_run >= 0; dry_run--) { /* check it all before touching anything */
+        jser_opts_t sp = { .max = JSER_MAX_DEPTH, .dry_run = dry_run, };
+        jser_buffer_t img = { .length = image->used, .used = sizeof h, .buf = image->buf, };
+        if (jser_snap(&sp, j, jlen, &img, 1, 0) < 0) {
+            return sp.error;
+        }
+        if (img.used != image->used) {
+            return JSER_ERR_LENGTH;
+        }
+    }
+    return 1;
+}
+
+/* ~~~ Tests ~~~ */
+
+/* NB. Might want to export this function under a different name */
+static inline int test_json_element(const jser_t *j, const size_t jlen, const int pretty, char *asciiz, size_t asciiz_length)
+{
+    assert(j);
+    assert(asciiz);
+    jser_opts_t sp = {
+        .pretty  = jser_boolify(pretty),
+        .max     = JSER_MAX_DEPTH,
+        .dry_run = 0,
+    };
+    jser_buffer_t buf = {
+        .used   = 0,
         .length = asciiz_length,
         .buf    = (unsigned char *)asciiz,
     };
-    return jsonify(&sp, j, jlen, &buf, 0, 0);
+    return jser_jsonify(&sp, j, jlen, &buf, 0, NULL, 0);
+}
+
+static inline int test_json_length(jser_t *j, const size_t jlen, const int pretty, const char *expected)
+{
+    assert(j);
+    assert(expected);
+    size_t sz = 0;
+    if (jser_serialized_length(j, jlen, pretty, &sz) < 0) {
+        return -1;
+    }
+    const size_t elen = strlen(expected);
+    if (sz != elen) {
+        return -1;
+    }
+    return 0;
+}
+
+static inline int test_json_serializer(jser_t *j, size_t jlen, const int pretty, const char *expected)
+{
+    assert(j);
+    assert(expected);
+    char t[512] = { 0 };
+    if (strlen(expected) > ((sizeof t) - 1)) {
+        return -1;
+    }
+    if (test_json_element(j, jlen, pretty, t, sizeof t) < 0) {
+        return -2;
+    }
+    return strcmp(expected, t) ? -3 : 0;
+}
+
+static inline int test_json_serialization(void)
+{
+    int r = 0;
+
+    typedef struct {
+        jser_t *element;
+        const char *expect;
+        int pretty;
+    } test_t;
+
+    jser_long_t l1 = 123, l2 = 0, l3 = -123;
+    char str1[] = "HELLO", str2[] = "";
+    jser_buffer_t buf1 = { .length = sizeof str1, .used = sizeof str1, .buf = (unsigned char *)str1};
+    jser_buffer_t buf2 = { .length = 0, .used = 0, .buf = NULL };
+
+    test_t tests[] = {
+        {  &(jser_t)MK_LONG(l1),     "{\"l1\":123}",             0,  },
+        {  &(jser_t)MK_LONG(l2),     "{\"l2\":0}",               0,  },
+        {  &(jser_t)MK_LONG(l3),     "{\"l3\":-123}",            0,  },
+        {  &(jser_t)MK_BUF(buf1),    "{\"buf1\":\"SEVMTE8A\"}",  0,  },
+        {  &(jser_t)MK_BUF(buf2),    "{\"buf2\":\"\"}",          0,  },
+        {  &(jser_t)MK_ASCIIZ(str2), "{\"str2\":\"\"}",          0,  },
+        {  &(jser_t)MK_ASCIIZ(str1), "{\"str1\":\"HELLO\"}",     0,  },
+    };
+
+    for (size_t i = 0; i < ELEMENTS(tests); i++) {
+        test_t *t = &tests[i];
+        jser_t *ele = t->element;
+        const char *exp = t->expect;
+        if (test_json_serializer(ele, 1, t->pretty, exp) < 0) {
+            r = -1;
+        }
+        if (test_json_length(ele, 1, t->pretty, exp) < 0) {
+            r = -1;
+        }
+    }
+
+    /* some minimal path retrieval tests as well...*/
+    jser_t *found = NULL;
+    if (jser_retrieve_node(tests[0].element, 1, &found, "l1") != 1) {
+        return -1;
+    }
+
+    if (jser_retrieve_node(tests[0].element, 1, &found, "l2") == 1) {
+        return -1;
+    }
+
+    return r;
+}
+
+static inline int test_json_deserialization(void)
+{
+
+    jser_long_t a = 0, b = 0, c = 0;
+
+    jser_t j[] = { MK_LONG(a), MK_LONG(b), MK_LONG(c), };
+
+    jsmntok_t t[16];
+
+    static const char *i1 = "{\"a\":1,\"b\":2,\"c\":3}";
+    if (jser_deserialize_from_asciiz(j, ELEMENTS(j), t, ELEMENTS(t), i1) < 0) {
+        return -1;
+    }
+
+    if (a != 1 || b != 2 || c != 3) {
+        return -1;
+    }
+
+    static const char *i2 = "{}";
+    if (jser_deserialize_from_asciiz(j, ELEMENTS(j), t, ELEMENTS(t), i2) < 0) {
+        return -1;
+    }
+
+    if (a != 1 || b != 2 || c != 3) {
+        return -1;
+    }
+
+    static const char *i3 = "{\"a\":4"; /* an invalid string */
+    if (jser_deserialize_from_asciiz(j, ELEMENTS(j), t, ELEMENTS(t), i3) == 0) { /* should fail */
+        return -1;
+    }
+
+    if (a != 1 || b != 2 || c != 3) { /* variables are untouched */
+        return -1;
+    }
+
+    static const char *i4 = "{\"a\":4}";
+    if (jser_deserialize_from_asciiz(j, ELEMENTS(j), t, ELEMENTS(t), i4) < 0) {
+        return -1;
+    }
+    if (a != 4 || b != 2 || c != 3) { /* only 'a' has been changed */
+        return -1;
+    }
+
+    return 0;
+}
+
+static inline int test_jser_complex(void)
+{
+    jser_long_t l1 = 123, l2 = -456, l3 = -1;
+    jser_ulong_t lu1 = 123, lu2 = 456, ul3 = 0, ul4 = 999;
+
+    char str1[] = "HI";
+    char str2[] = "BYE";
+    char str3[] = "ABC";
+    char str4[] = "A\tB\n\rC\\  \" escaped";
+
+    bool b1 = true, b2 = false, b3 = false;
+    unsigned char buffer[512] = { 0 };
+    jser_buffer_t b = { .length = sizeof buffer, .used = 0, .buf = buffer, };
+
+    jser_t jnested[] = {
+        MK_ULONG(ul3),
+        MK_ULONG(ul4),
+        {  .attr  =  "l2",    .type  =  JSER_LONG_E,    .data.ld      =  &l3   },
+        MK_ASCIIZ(str3),
+    };
+
+    jser_t jarray[] = { MK_ULONG(lu1), MK_ULONG(lu2), MK_LONG(l2), MK_ASCIIZ(str3), };
+
+    unsigned char bstr1[] = "HELLO";
+    jser_buffer_t buf1 = { .used = sizeof (bstr1) - 1, .length = sizeof (bstr1), .buf = bstr1, };
+
+    jser_t js[] = {
+        MK_ULONG(lu1),
+        {  .attr  =  "lu2",   .type  =  JSER_ULONG_E,   .data.lu      =  &lu2      },
+        {  .attr  =  "ld1",   .type  =  JSER_LONG_E,    .data.ld      =  &l1       },
+        {  .attr  =  "ld2",   .type  =  JSER_LONG_E,    .data.ld      =  &l2       },
+        {  .attr  =  "j1",    .type  =  JSER_OBJECT_E,  .data.jser    =  jnested,  .length  =  ELEMENTS(jnested),  .used  =  ELEMENTS(jnested)  },
+        {  .attr  =  "s1",    .type  =  JSER_ASCIIZ_E,  .data.asciiz  =  str1      },
+        {  .attr  =  "s2",    .type  =  JSER_ASCIIZ_E,  .data.asciiz  =  str2      },
+        {  .attr  =  "a1",    .type  =  JSER_ARRAY_E,   .data.array   =  jarray,   .length  =  ELEMENTS(jarray),   .used  =  ELEMENTS(jarray),  },
+        {  .attr  =  "b1",    .type  =  JSER_BOOL_E,    .data.b       =  &b1       },
+        {  .attr  =  "b2",    .type  =  JSER_BOOL_E,    .data.b       =  &b2       },
+        {  .attr  =  "b3",    .type  =  JSER_BOOL_E,    .data.b       =  &b3       },
+        {  .attr  =  "s4",    .type  =  JSER_ASCIIZ_E,  .data.asciiz  =  str4      },
+        {  .attr  =  "buf1",  .type  =  JSER_BUFFER_E,  .data.buf     =  &buf1     },
+    };
+
+    size_t nodes = ELEMENTS(js);
+    if (jser_node_count(js, &nodes) < 0) {
+        return -1;
+    }
+
+    if (nodes != (ELEMENTS(js) + ELEMENTS(jarray) + ELEMENTS(jnested))) {
+        return -1;
+    }
+
+    if (jser_serialize_to_buffer(js, ELEMENTS(js), 0, &b) < 0) {
+        return -1;
+    }
+
+    static const char result[] = "{\"lu1\":123,\"lu2\":456,\"\
+ld1\":123,\"ld2\":-456,\"j1\":{\"ul3\":0,\"ul4\":999,\"\
+l2\":-1,\"str3\":\"ABC\"},\"s1\":\"HI\",\"s2\":\"BYE\",\
+\"a1\":[123,456,-456,\"ABC\"],\"b1\":true,\"b2\":false,\
+\"b3\":false,\"s4\":\"A\\tB\\n\\rC\\\\  \\\" escaped\",\
+\"buf1\":\"SEVMTE8=\"}";
+
+    if (memcmp(result, buffer, sizeof (result) - 1)) {
+        return -1;
+    }
+
+    static const char *new_data = "{\n\
+	\"lu1\" : 888,\n\
+	\"lu2\" : 111,\n\
+	\"not-found\"  : { \"ul3\" : 222 }\n\
+	\"also-not-found\" : 111,\n\
+	\"j1\"  : { \"ul3\" : 222 }\n\
+}";
+
+    jsmntok_t tokens[16] = { { 0 }, };
+    if (jser_deserialize_from_asciiz(js, ELEMENTS(js), tokens, ELEMENTS(tokens), new_data) < 0) {
+        return -1;
+    }
+
+    if (lu1 != 888  || lu2 != 111 || ul3 != 222) {
+        return -1;
+    }
+
+    jser_t *found = NULL;
+    const int st = jser_retrieve_node(js, ELEMENTS(js), &found, "j1/ul3");
+    if (st != 1) {
+        return -1;
+    }
+
+    return 0;
+}
+
+static inline int test_jser_union(void)
+{
+    jser_long_t x = 0, y = 0, r = 0;
+    char name[16] = "";
+
+    jser_t point[]  = { MK_LONG(x), MK_LONG(y), };
+    jser_t circle[] = { MK_LONG(r), { .attr = "name", .type = JSER_ASCIIZ_E, .data.asciiz = name, .length = sizeof name, }, };
+    jser_variant_t variants[] = { MK_VARIANT("point", point), MK_VARIANT("circle", circle), };
+    jser_union_t shape = { .attr = "type", .variants = variants, .length = ELEMENTS(variants), .selected = 0, };
+    jser_long_t id = 0;
+    jser_t js[] = { MK_LONG(id), MK_UNION(shape), };
+
+    jsmntok_t t[32];
+    static const char *i1 = "{\"shape\":{\"r\":3,\"name\":\"ring\",\"type\":\"circle\"},\"id\":7}";
+    if (jser_deserialize_from_asciiz(js, ELEMENTS(js), t, ELEMENTS(t), i1) < 0) {
+        return -1;
+    }
+    if (shape.selected != 1 || r != 3 || strcmp(name, "ring") || id != 7) {
+        return -1;
+    }
+
+    static const char *i2 = "{\"shape\":{\"type\":\"square\",\"x\":1}}";
+    if (jser_deserialize_from_asciiz(js, ELEMENTS(js), t, ELEMENTS(t), i2) == 0) { /* unknown tag */
+        return -1;
+    }
+
+    shape.selected = 0;
+    x = 1;
+    y = -2;
+    if (test_json_serializer(js, ELEMENTS(js), 0, "{\"id\":7,\"shape\":{\"type\":\"point\",\"x\":1,\"y\":-2}}") < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+typedef struct {
+    jser_long_t sum;
+    size_t count;
+} test_stream_t;
+
+static int test_stream_each(jser_t *record, size_t index, void *param)
+{
+    assert(record);
+    assert(param);
+    test_stream_t *t = param;
+    if (index != t->count++) {
+        return -1;
+    }
+    t->sum += *record->data.jser[0].data.ld;
+    return 0;
+}
+
+static inline int test_jser_stream(void)
+{
+    jser_long_t id = 0, n = 0;
+    char name[8] = "";
+    jser_t fields[] = { MK_LONG(id), { .attr = "name", .type = JSER_ASCIIZ_E, .data.asciiz = name, .length = sizeof name, }, };
+    jser_t record = { .type = JSER_OBJECT_E, .data.jser = fields, .length = ELEMENTS(fields), .used = ELEMENTS(fields), };
+    test_stream_t result = { .sum = 0, .count = 0, };
+    jser_stream_t records = { .record = &record, .each = test_stream_each, .param = &result, };
+    jser_t js[] = { MK_LONG(n), MK_STREAM(records), };
+
+    /* far more elements than tokens, the pool is reused for each element */
+    static const char *i1 = "{\"records\":[{\"id\":1,\"name\":\"a\"},{\"id\":2},{\"name\":\"c\",\"id\":3},\
+{\"id\":4},{\"id\":5},{\"id\":6},{\"id\":7},{\"id\":8},{\"id\":9},{\"id\":10}],\"n\":10}";
+    jsmntok_t t[12];
+    if (jser_deserialize_from_asciiz(js, ELEMENTS(js), t, ELEMENTS(t), i1) < 0) {
+        return -1;
+    }
+    if (result.count != 10 || result.sum != 55 || n != 10 || strcmp(name, "c")) {
+        return -1;
+    }
+
+    /* arrays within a record are not mistaken for the stream */
+    jser_long_t v0 = 0, v1 = 0;
+    jser_t values[] = { MK_LONG(v0), MK_LONG(v1), };
+    jser_t nested[] = { MK_LONG(id), { .attr = "v", .type = JSER_ARRAY_E, .data.array = values, .length = ELEMENTS(values), .used = ELEMENTS(values), }, };
+    record.data.jser = nested;
+    record.length = record.used = ELEMENTS(nested);
+    result = (test_stream_t){ .sum = 0, .count = 0, };
+    static const char *i2 = "{\"records\":[{\"id\":1,\"v\":[1]},{\"id\":2,\"v\":[1,2]},{\"id\":3,\"v\":[]},{\"v\":[3],\"id\":4},{\"id\":5,\"v\":[1]}]}";
+    if (jser_deserialize_from_asciiz(js, ELEMENTS(js), t, ELEMENTS(t), i2) < 0) {
+        return -1;
+    }
+    return result.count == 5 && result.sum == 15 && v0 == 1 ? 0 : -1;
+}
+
+static int test_stream_next(jser_t *record, size_t index, void *param)
+{
+    assert(record);
+    UNUSED(param);
+    if (index >= 3) {
+        return 0;
+    }
+    *record->data.jser[0].data.ld = index + 1;
+    return 1;
+}
+
+typedef struct {
+    char out[256];
+    size_t used, flushes;
+} test_sink_t;
+
+static int test_sink_flush(void *param, const unsigned char *buf, size_t length)
+{
+    assert(param);
+    assert(buf);
+    test_sink_t *t = param;
+    if ((t->used + length) >= sizeof (t->out)) {
+        return -1;
+    }
+    memcpy(&t->out[t->used], buf, length);
+    t->used += length;
+    t->flushes++;
+    return 0;
+}
+
+static inline int test_jser_generator(void)
+{
+    jser_long_t id = 0;
+    jser_t fields[] = { MK_LONG(id), };
+    jser_t record = { .type = JSER_OBJECT_E, .data.jser = fields, .length = ELEMENTS(fields), .used = ELEMENTS(fields), };
+    jser_stream_t records = { .record = &record, .next = test_stream_next, };
+    unsigned char bytes[] = "HELLO, WORLD";
+    jser_buffer_t buf1 = { .length = sizeof bytes - 1, .used = sizeof bytes - 1, .buf = bytes, };
+    jser_t js[] = { MK_STREAM(records), MK_BUF(buf1), };
+
+    static const char *expect = "{\"records\":[{\"id\":1},{\"id\":2},{\"id\":3}],\"buf1\":\"SEVMTE8sIFdPUkxE\"}";
+    if (test_json_serializer(js, ELEMENTS(js), 0, expect) < 0) {
+        return -1;
+    }
+    if (test_json_length(js, ELEMENTS(js), 0, expect) < 0) {
+        return -1;
+    }
+
+    unsigned char stage[5] = { 0 }; /* forces the base64 string to be split up */
+    jser_buffer_t b = { .length = sizeof stage, .used = 0, .buf = stage, };
+    test_sink_t t = { .used = 0, };
+    const jser_sink_t sink = { .flush = test_sink_flush, .param = &t, };
+    if (jser_serialize_to_sink(js, ELEMENTS(js), 0, &b, &sink) < 0) {
+        return -1;
+    }
+    if (t.used != strlen(expect) || memcmp(t.out, expect, t.used) || t.flushes < 2) {
+        return -1;
+    }
+    return 0;
+}
+
+typedef struct {
+    unsigned char out[32];
+    size_t used, chunks;
+    bool done;
+} test_chunk_t;
+
+static int test_chunk(void *param, const unsigned char *buf, size_t length, bool last)
+{
+    assert(param);
+    assert(buf);
+    test_chunk_t *t = param;
+    if (t->done || (t->used + length) > sizeof (t->out)) {
+        return -1;
+    }
+    memcpy(&t->out[t->used], buf, length);
+    t->used += length;
+    t->chunks++;
+    t->done = last;
+    return 0;
+}
+
+static inline int test_jser_chunked(void)
+{
+    unsigned char scratch[4];
+    jser_buffer_t sb = { .length = sizeof scratch, .used = 0, .buf = scratch, };
+    test_chunk_t tt = { .used = 0, }, tb = { .used = 0, };
+    jser_chunked_t text = { .buf = &sb, .chunk = test_chunk, .param = &tt, .base64 = false, };
+    jser_chunked_t blob = { .buf = &sb, .chunk = test_chunk, .param = &tb, .base64 = true, };
+    jser_t js[] = { MK_CHUNKED(text), MK_CHUNKED(blob), };
+
+    static const char *i1 = "{\"text\":\"A\\tB\\u00e9\\ud83d\\ude00\\\"C\",\"blob\":\"SEVMTE8sIFdPUkxE\"}";
+    jsmntok_t t[8];
+    if (jser_deserialize_from_asciiz(js, ELEMENTS(js), t, ELEMENTS(t), i1) < 0) {
+        return -1;
+    }
+    static const unsigned char expect[] = "A\tB\xC3\xA9\xF0\x9F\x98\x80\"C";
+    if (!tt.done || tt.used != (sizeof expect - 1) || memcmp(tt.out, expect, tt.used) || tt.chunks < 3) {
+        return -1;
+    }
+    if (!tb.done || tb.used != 12 || memcmp(tb.out, "HELLO, WORLD", 12) || tb.chunks < 4) {
+        return -1;
+    }
+    return 0;
+}
+
+typedef struct {
+    const unsigned char *expect;
+    size_t used, chunks;
+    bool done;
+} test_bulk_t;
+
+static int test_bulk(void *param, const unsigned char *buf, size_t length, bool last)
+{
+    assert(param);
+    assert(buf);
+    test_bulk_t *t = param;
+    if (t->done || memcmp(&t->expect[t->used], buf, length)) {
+        return -1;
+    }
+    t->used += length;
+    t->chunks++;
+    t->done = last;
+    return 0;
+}
+
+static int test_decode_pieces(jser_decoder_t *d, const char *doc, const size_t length, const size_t size, const test_bulk_t *early)
+{
+    int r = 1;
+    for (size_t at = 0; r > 0 && at < length;) {
+        unsigned char *p = NULL;
+        size_t room = 0, n = length - at < size ? length - at : size;
+        if ((r = jser_decoder_space(d, &p, &room)) < 0) {
+            return r;
+        }
+        n = n < room ? n : room;
+        memcpy(p, &doc[at], n);
+        at += n;
+        if (at == length && (early->used == 0 || early->done)) { /* handed on as it arrived */
+            return -1;
+        }
+        r = jser_decoder_push(d, n);
+    }
+    return r > 0 ? jser_decoder_push(d, 0) : r;
+}
+
+static size_t test_append(char *doc, const size_t at, const char *s)
+{
+    const size_t n = strlen(s);
+    memcpy(&doc[at], s, n);
+    return at + n;
+}
+
+static inline int test_jser_chunked_stream(void)
+{
+    static char doc[2 * 102400 + 64];
+    static unsigned char text[102400], blob[76800];
+    size_t length = 0, tlength = 0;
+    length = test_append(doc, length, "{\"up\":\"");
+    for (size_t k = 0; length < 102400; k++) { /* escapes and surrogate pairs fall across every boundary */
+        if ((k % 97) == 5) {
+            length = test_append(doc, length, "\\u00e9");
+            memcpy(&text[tlength], "\xC3\xA9", 2);
+            tlength += 2;
+        } else if ((k % 101) == 7) {
+            length = test_append(doc, length, "\\ud83d\\ude00");
+            memcpy(&text[tlength], "\xF0\x9F\x98\x80", 4);
+            tlength += 4;
+        } else {
+            doc[length++] = text[tlength++] = 'a' + (k % 26);
+        }
+    }
+    length = test_append(doc, length, "\",\"o\":{\"blob\":\"");
+    for (size_t k = 0; k < sizeof blob; k++) {
+        blob[k] = (k * 7) % 251;
+    }
+    size_t olen = sizeof doc - length;
+    if (jser_base64_encode(blob, sizeof blob, (unsigned char *)&doc[length], &olen) < 0) {
+        return -1;
+    }
+    length += olen;
+    length = test_append(doc, length, "\"},\"n\":7}");
+
+    unsigned char scratch[512];
+    jser_buffer_t sb = { .length = sizeof scratch, .used = 0, .buf = scratch, };
+    test_bulk_t tt = { .expect = text, }, tb = { .expect = blob, };
+    jser_chunked_t up = { .buf = &sb, .chunk = test_bulk, .param = &tt, .base64 = false, };
+    jser_chunked_t bl = { .buf = &sb, .chunk = test_bulk, .param = &tb, .base64 = true, };
+    jser_long_t n = 0;
+    jser_t o[] = { MK_NAMED_CHUNKED(bl, "blob"), };
+    jser_t js[] = { MK_CHUNKED(up), MK_OBJECT(o), MK_LONG(n), };
+    unsigned char window[4096];
+    jser_buffer_t w = { .length = sizeof window, .used = 0, .buf = window, };
+    jsmntok_t t[16];
+    jser_frame_t frames[4];
+    jser_decoder_t d;
+    if (jser_decoder_init(&d, js, ELEMENTS(js), t, ELEMENTS(t), &w, frames, ELEMENTS(frames)) < 0) {
+        return -1;
+    }
+    if (test_decode_pieces(&d, doc, length, 777, &tb) != JSER_OK) {
+        return -1;
+    }
+    if (!tt.done || tt.used != tlength || tt.chunks < (tlength / sizeof scratch)) {
+        return -1;
+    }
+    if (!tb.done || tb.used != sizeof blob || tb.chunks < (sizeof blob / sizeof scratch) || n != 7) {
+        return -1;
+    }
+
+    const jser_limits_t limits = { .string = 50000, };
+    tt = (test_bulk_t){ .expect = text, };
+    if (jser_decoder_init(&d, js, ELEMENTS(js), t, ELEMENTS(t), &w, frames, ELEMENTS(frames)) < 0 || jser_decoder_limit(&d, &limits) < 0) {
+        return -1;
+    }
+    if (test_decode_pieces(&d, doc, length, 777, &tt) != JSER_ERR_LIMIT || tt.done) { /* still limited, though it never all fits */
+        return -1;
+    }
+    return 0;
+}
+
+typedef struct {
+    unsigned char arena[512];
+    size_t used, calls;
+} test_arena_t;
+
+static void *test_grow(void *param, void *ptr, size_t new_size)
+{
+    assert(param);
+    test_arena_t *a = param;
+    if (new_size > (sizeof (a->arena) - a->used)) {
+        return NULL;
+    }
+    unsigned char *r = &a->arena[a->used];
+    if (ptr) { /* it is always the last allocation that is grown */
+        memmove(r, ptr, (unsigned char*)r - (unsigned char *)ptr);
+    }
+    a->used += new_size;
+    a->calls++;
+    return r;
+}
+
+static inline int test_jser_grow(void)
+{
+    jser_long_t l1 = -123456789;
+    char str1[] = "a string that is longer than the initial allocation of sixty four bytes";
+    jser_t js[] = { MK_LONG(l1), MK_ASCIIZ(str1), };
+    static const char *expect = "{\"l1\":-123456789,\"str1\":\"a string that is longer than the initial allocation of sixty four bytes\"}";
+
+    test_arena_t a = { .used = 0, };
+    const jser_sink_t sink = { .grow = test_grow, .param = &a, };
+    jser_buffer_t b = { .length = 0, .used = 0, .buf = NULL, };
+    if (jser_serialize_to_sink(js, ELEMENTS(js), 0, &b, &sink) < 0) {
+        return -1;
+    }
+    if (b.used != strlen(expect) || memcmp(b.buf, expect, b.used) || a.calls != 2 || b.length != 128) {
+        return -1;
+    }
+    return 0;
+}
+
+static inline int test_jser_snapshot(void)
+{
+    jser_long_t l1 = -1, l2[3] = { 1, 2, 3 };
+    bool b1 = true;
+    char s1[8] = "abc";
+    unsigned char bytes[4] = { 1, 2, 3, 0 };
+    jser_buffer_t buf1 = { .length = sizeof bytes, .used = 3, .buf = bytes, };
+    jser_t nested[] = { MK_BOOL(b1), MK_BUF(buf1), };
+    jser_t js[] = {
+        MK_LONG(l1),
+        { .attr = "l2", .type = JSER_LONG_E, .data.ld = l2, .is_array = true, .length = ELEMENTS(l2), .used = 2, },
+        { .attr = "s1", .type = JSER_ASCIIZ_E, .data.asciiz = s1, .length = sizeof s1, },
+        MK_OBJECT(nested),
+    };
+
+    unsigned char image[256];
+    jser_buffer_t img = { .length = 0, .used = 0, .buf = NULL, };
+    if (jser_snapshot_save(js, ELEMENTS(js), 42, &img) < 0 || img.used > sizeof image) {
+        return -1;
+    }
+    const size_t needed = img.used;
+    img.buf = image;
+    img.length = sizeof image;
+    if (jser_snapshot_save(js, ELEMENTS(js), 42, &img) < 0 || img.used != needed) {
+        return -1;
+    }
+
+    l1 = 0; l2[0] = 0; l2[1] = 0; b1 = false; s1[0] = '\0'; buf1.used = 0; bytes[1] = 0;
+    js[1].used = 0;
+    if (jser_snapshot_load(js, ELEMENTS(js), 43, &img) != 0) { /* different JSON */
+        return -1;
+    }
+    if (jser_snapshot_load(js, ELEMENTS(js), 42, &img) != 1) {
+        return -1;
+    }
+    if (l1 != -1 || l2[0] != 1 || l2[1] != 2 || js[1].used != 2 || !b1 || strcmp(s1, "abc") || buf1.used != 3 || bytes[1] != 2) {
+        return -1;
+    }
+
+    unsigned char again[sizeof image];
+    jser_buffer_t img2 = { .length = sizeof again, .used = 0, .buf = again, };
+    memset(image, 0x5A, sizeof image); /* padding in the header must not show through */
+    memset(again, 0xA5, sizeof again);
+    if (jser_snapshot_save(js, ELEMENTS(js), 42, &img) < 0 || jser_snapshot_save(js, ELEMENTS(js), 42, &img2) < 0) {
+        return -1;
+    }
+    if (img.used != img2.used || memcmp(image, again, img.used)) {
+        return -1;
+    }
+
+    nested[0].attr = "b2"; /* an attribute renamed */
+    if (jser_snapshot_load(js, ELEMENTS(js), 42, &img) != 0) {
+        return -1;
+    }
+    nested[0].attr = "b1";
+
+    char s2[2] = "";
+    js[2].data.asciiz = s2; /* schema changed */
+    js[2].length = sizeof s2;
+    if (jser_snapshot_load(js, ELEMENTS(js), 42, &img) != 0) {
+        return -1;
+    }
+
+    jser_variant_t variants[] = { { .tag = NULL, .jser = nested, .length = ELEMENTS(nested), }, };
+    jser_union_t un = { .attr = "type", .variants = variants, .length = ELEMENTS(variants), };
+    jser_t tagless[] = { MK_UNION(un), };
+    return jser_snapshot_save(tagless, ELEMENTS(tagless), 42, &img) == JSER_ERR_CONFIG ? 0 : -1;
+}
+
+static inline int test_jser_depth(void)
+{
+    jser_long_t v = 0;
+    jser_t l3[] = { MK_LONG(v), };
+    jser_t l2[] = { MK_OBJECT(l3), };
+    jser_t l1[] = { MK_OBJECT(l2), };
+    jser_t js[] = { MK_OBJECT(l1), };
+
+    char i1[] = "{\"x\":[[[[[[[[1]]]]]]]],\"l1\":{\"l2\":{\"l3\":{\"v\":5}}}}";
+    jser_buffer_t b = { .length = sizeof (i1) - 1, .used = sizeof (i1) - 1, .buf = (unsigned char *)i1, };
+    jsmntok_t t[32];
+    jser_frame_t stack[4];
+    if (jser_deserialize_with_stack(js, ELEMENTS(js), t, ELEMENTS(t), &b, stack, 3) != JSER_ERR_DEPTH) {
+        return -1;
+    }
+    if (jser_deserialize_with_stack(js, ELEMENTS(js), t, ELEMENTS(t), &b, stack, 4) < 0 || v != 5) {
+        return -1; /* skipped values use no frames */
+    }
+
+    /* without a stack from the caller nesting is not limited by 'JSER_STACK_DEPTH' */
+    jser_t deep[JSER_STACK_DEPTH * 2 + 1];
+    char i2[(JSER_STACK_DEPTH * 2 + 1) * 8 + 16] = "";
+    size_t at = 0;
+    for (size_t i = 0; i < ELEMENTS(deep) - 1; i++) {
+        deep[i] = (jser_t){ .attr = "o", .type = JSER_OBJECT_E, .data.jser = &deep[i + 1], .length = 1, .used = 1, };
+        memcpy(&i2[at], "{\"o\":", 5);
+        at += 5;
+    }
+    deep[ELEMENTS(deep) - 1] = (jser_t)MK_LONG(v);
+    memcpy(&i2[at], "{\"v\":7", 6);
+    at += 6;
+    for (size_t i = 0; i < ELEMENTS(deep); i++) {
+        i2[at++] = '}';
+    }
+    jsmntok_t t2[ELEMENTS(deep) * 2 + 2];
+    b = (jser_buffer_t){ .length = at, .used = at, .buf = (unsigned char *)i2, };
+    if (jser_deserialize_from_buffer(deep, 1, t2, ELEMENTS(t2), &b) < 0 || v != 7) {
+        return -1;
+    }
+    jser_limits_t limits = { .depth = ELEMENTS(deep) - 1, };
+    return jser_deserialize_with_limits(deep, 1, t2, ELEMENTS(t2), &b, &limits) == JSER_ERR_LIMIT ? 0 : -1;
+}
+
+static inline int test_jser_numbers(void)
+{
+    jser_long_t l1 = 0;
+    jser_ulong_t u1 = 0;
+    jser_t js[] = { MK_LONG(l1), MK_ULONG(u1), };
+    jsmntok_t t[16];
+    static const struct {
+        const char *json;
+        int error;
+        jser_long_t l1;
+        jser_ulong_t u1;
+    } ts[] = {
+        { "{\"l1\":-12,\"u1\":34}",                   JSER_OK,         -12, 34, },
+        { "{\"l2\":1,\"l1\":0,\"u1\":007}",              JSER_OK,         0,   7,  },
+        { "{\"u1\":18446744073709551616}",             JSER_ERR_NUMBER, 0,   0,  },
+        { "{\"u1\":-0}",                               JSER_ERR_NUMBER, 0,   0,  },
+        { "{\"l1\":1.5}",                              JSER_ERR_NUMBER, 0,   0,  },
+        { "{\"l1\":-}",                                JSER_ERR_NUMBER, 0,   0,  },
+        { "{\"l1\":true}",                             JSER_ERR_TYPE,   0,   0,  },
+    };
+    for (size_t i = 0; i < ELEMENTS(ts); i++) {
+        l1 = 0;
+        u1 = 0;
+        const int r = jser_deserialize_from_asciiz(js, ELEMENTS(js), t, ELEMENTS(t), ts[i].json);
+        if (r != ts[i].error) {
+            return -1;
+        }
+        if (r == JSER_OK && (l1 != ts[i].l1 || u1 != ts[i].u1)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static inline int test_jser_segments(void)
+{
+    jser_long_t l1 = 0, a1[3] = { 0 };
+    bool b1 = false;
+    char s1[32] = "";
+    jser_ulong_t u1 = 0;
+    jser_t arr[] = {
+        { .type = JSER_LONG_E, .data.ld = &a1[0], }, { .type = JSER_LONG_E, .data.ld = &a1[1], }, { .type = JSER_LONG_E, .data.ld = &a1[2], },
+    };
+    jser_t nested[] = { MK_ULONG(u1), MK_BOOL(b1), };
+    jser_t js[] = {
+        MK_LONG(l1), MK_ARRAY(arr), MK_OBJECT(nested),
+        { .attr = "s1", .type = JSER_ASCIIZ_E, .data.asciiz = s1, .length = sizeof s1, },
+    };
+    static char in[] = "{\"l1\":-1234567,\"arr\":[1,22,333],\"skip\":{\"x\":[true]},\"nested\":{\"u1\":98765,\"b1\":true},\"s1\":\"straddling\"}";
+    const size_t len = sizeof (in) - 1;
+    unsigned char bounce[32];
+    jser_buffer_t b = { .length = sizeof bounce, .used = 0, .buf = bounce, };
+    jsmntok_t t[32];
+
+    for (size_t i = 0; i <= len; i++) {
+        const size_t k = i + 3 < len ? i + 3 : len;
+        jser_buffer_t segs[] = {
+            { .length = i,       .used = i,       .buf = (unsigned char *)in,       },
+            { .length = k - i,   .used = k - i,   .buf = (unsigned char *)&in[i],   },
+            { .length = len - k, .used = len - k, .buf = (unsigned char *)&in[k],   },
+        };
+        l1 = 0; a1[0] = 0; a1[1] = 0; a1[2] = 0; u1 = 0; b1 = false; s1[0] = '\0';
+        if (jser_deserialize_from_segments(js, ELEMENTS(js), t, ELEMENTS(t), segs, ELEMENTS(segs), &b) < 0) {
+            return -1;
+        }
+        if (l1 != -1234567 || a1[0] != 1 || a1[1] != 22 || a1[2] != 333 || u1 != 98765 || !b1 || strcmp(s1, "straddling")) {
+            return -1;
+        }
+    }
+
+    static char in2[] = "{\"s1\":\"a value longer than the bounce\"}";
+    jser_buffer_t segs[] = {
+        { .length = 16, .used = 16, .buf = (unsigned char *)in2, },
+        { .length = sizeof (in2) - 17, .used = sizeof (in2) - 17, .buf = (unsigned char *)&in2[16], },
+    };
+    if (jser_deserialize_from_segments(js, ELEMENTS(js), t, ELEMENTS(t), segs, ELEMENTS(segs), &b) != JSER_ERR_SPACE) {
+        return -1;
+    }
+    return 0;
+}
+
+static int test_many_next(jser_t *record, size_t index, void *param)
+{
+    assert(record);
+    UNUSED(param);
+    if (index >= 200) {
+        return 0;
+    }
+    *record->data.jser[0].data.ld = index + 1;
+    return 1;
+}
+
+typedef struct {
+    unsigned char out[8192];
+    size_t used, read, ends;
+} test_pipe_t;
+
+static int test_pipe_flush(void *param, const unsigned char *buf, size_t length)
+{
+    assert(param);
+    assert(buf);
+    test_pipe_t *t = param;
+    if (t->ends || (t->used + length) > sizeof (t->out)) {
+        return -1;
+    }
+    memcpy(&t->out[t->used], buf, length);
+    t->used += length;
+    t->ends += length == 0;
+    return 0;
+}
+
+static int test_pipe_read(void *param, unsigned char *buf, size_t *length)
+{
+    assert(param);
+    assert(buf);
+    assert(length);
+    test_pipe_t *t = param;
+    size_t n = t->used - t->read;
+    n = n < 7 ? n : 7; /* dribble it out */
+    n = n < *length ? n : *length;
+    memcpy(buf, &t->out[t->read], n);
+    t->read += n;
+    *length = n;
+    return 0;
+}
+
+/* Compress a stream on the way out, then inflate and deserialize it through
+ * a window much smaller than the document */
+static inline int test_jser_compress(void)
+{
+    jser_long_t id = 0;
+    char name[8] = "record";
+    jser_t fields[] = { MK_LONG(id), { .attr = "name", .type = JSER_ASCIIZ_E, .data.asciiz = name, .length = sizeof name, }, };
+    jser_t record = { .type = JSER_OBJECT_E, .data.jser = fields, .length = ELEMENTS(fields), .used = ELEMENTS(fields), };
+    test_stream_t result = { .sum = 0, .count = 0, };
+    jser_stream_t records = { .record = &record, .next = test_many_next, .each = test_stream_each, .param = &result, };
+    jser_t js[] = { MK_STREAM(records), };
+
+    size_t plain = 0;
+    if (jser_serialized_length(js, ELEMENTS(js), 0, &plain) < 0) {
+        return -1;
+    }
+    static test_pipe_t pipe;
+    memset(&pipe, 0, sizeof pipe);
+    static jser_lz_t lz;
+    const jser_sink_t sink = { .flush = test_pipe_flush, .param = &pipe, };
+    jser_sink_t compress;
+    if (jser_lz_encoder(&lz, &sink, &compress) < 0) {
+        return -1;
+    }
+    unsigned char stage[32], window[64];
+    jser_buffer_t b = { .length = sizeof stage, .used = 0, .buf = stage, };
+    if (jser_serialize_to_sink(js, ELEMENTS(js), 0, &b, &compress) < 0) {
+        return -1;
+    }
+    if (pipe.ends != 1 || pipe.used >= (plain / 2)) {
+        return -1;
+    }
+
+    const jser_source_t source = { .read = test_pipe_read, .param = &pipe, };
+    jser_source_t decompress;
+    if (jser_lz_decoder(&lz, &source, &decompress) < 0) {
+        return -1;
+    }
+    jser_buffer_t w = { .length = sizeof window, .buf = window, };
+    jsmntok_t t[16];
+    if (jser_deserialize_from_source(js, ELEMENTS(js), t, ELEMENTS(t), &decompress, &w) < 0) {
+        return -1;
+    }
+    if (result.count != 200 || result.sum != 20100 || strcmp(name, "record")) {
+        return -1;
+    }
+
+    pipe.read = 0; /* the window cannot hold a single element */
+    if (jser_lz_decoder(&lz, &source, &decompress) < 0) {
+        return -1;
+    }
+    w.length = 16;
+    if (jser_deserialize_from_source(js, ELEMENTS(js), t, ELEMENTS(t), &decompress, &w) != JSER_ERR_SPACE) {
+        return -1;
+    }
+#if JSER_ENABLE_ZLIB
+    static jser_zlib_t zs;
+    memset(&pipe, 0, sizeof pipe);
+    if (jser_zlib_encoder(&zs, Z_DEFAULT_COMPRESSION, &sink, &compress) < 0) {
+        return -1;
+    }
+    const int r = jser_serialize_to_sink(js, ELEMENTS(js), 0, &b, &compress);
+    (void)jser_zlib_end(&zs);
+    if (r < 0 || pipe.ends != 1 || pipe.used >= (plain / 2)) {
+        return -1;
+    }
+    if (jser_zlib_decoder(&zs, &source, &decompress) < 0) {
+        return -1;
+    }
+    result.count = 0;
+    result.sum = 0;
+    w.length = sizeof window;
+    const int d = jser_deserialize_from_source(js, ELEMENTS(js), t, ELEMENTS(t), &decompress, &w);
+    (void)jser_zlib_end(&zs);
+    if (d < 0 || result.count != 200 || result.sum != 20100) {
+        return -1;
+    }
+#endif
+    return 0;
+}
+
+/* The checksum worked out whilst serializing and deserializing must match
+ * one taken over the whole output, which is larger than a block */
+static inline int test_jser_digest(void)
+{
+    unsigned long crc = 0;
+    if (jser_crc32c((const unsigned char *)"123456789", 9, &crc) < 0 || crc != 0xE3069283ul) {
+        return -1;
+    }
+
+    jser_long_t id = 0;
+    char name[8] = "record";
+    jser_t fields[] = { MK_LONG(id), { .attr = "name", .type = JSER_ASCIIZ_E, .data.asciiz = name, .length = sizeof name, }, };
+    jser_t record = { .type = JSER_OBJECT_E, .data.jser = fields, .length = ELEMENTS(fields), .used = ELEMENTS(fields), };
+    test_stream_t result = { .sum = 0, .count = 0, };
+    jser_stream_t records = { .record = &record, .next = test_many_next, .each = test_stream_each, .param = &result, };
+    jser_t js[] = { MK_STREAM(records), };
+
+    static unsigned char out[8192];
+    jser_buffer_t b = { .length = sizeof out, .used = 0, .buf = out, };
+    unsigned long fused = 0, whole = 0;
+    if (jser_serialize_with_digest(js, ELEMENTS(js), 0, &b, NULL, &fused) < 0) {
+        return -1;
+    }
+    if (b.used <= JSER_DIGEST_BLOCK || jser_crc32c(out, b.used, &whole) < 0 || fused != whole) {
+        return -1;
+    }
+
+    static test_pipe_t pipe;
+    memset(&pipe, 0, sizeof pipe);
+    const jser_sink_t sink = { .flush = test_pipe_flush, .param = &pipe, };
+    unsigned char stage[32];
+    jser_buffer_t sb = { .length = sizeof stage, .used = 0, .buf = stage, };
+    if (jser_serialize_with_digest(js, ELEMENTS(js), 0, &sb, &sink, &fused) < 0) {
+        return -1;
+    }
+    whole = 0;
+    if (jser_crc32c(pipe.out, pipe.used, &whole) < 0 || fused != whole) {
+        return -1;
+    }
+
+    jsmntok_t t[16];
+    whole = 0;
+    if (jser_crc32c(out, b.used, &whole) < 0) {
+        return -1;
+    }
+    if (jser_deserialize_with_digest(js, ELEMENTS(js), t, ELEMENTS(t), &b, &fused) < 0 || fused != whole) {
+        return -1;
+    }
+    if (result.count != 200 || result.sum != 20100) {
+        return -1;
+    }
+    return 0;
+}
+
+static inline int test_jser_canonical(void)
+{
+    jser_long_t z = 1, a = -2, y = 3, x = 4;
+    bool b = true;
+    jser_t nested[] = { MK_LONG(y), MK_BOOL(b), };
+    jser_t fields[] = { MK_LONG(x), MK_NAMED_LONG(a, "alpha"), };
+    jser_variant_t variants[] = { MK_VARIANT("v", fields), };
+    jser_union_t un = { .attr = "type", .variants = variants, .length = ELEMENTS(variants), .selected = 0, };
+    jser_t js[] = { MK_LONG(z), MK_LONG(a), MK_OBJECT(nested), MK_UNION(un), };
+
+    jser_canonical_t c = { .orders = NULL, };
+    if (jser_canonical_prepare(js, ELEMENTS(js), &c) < 0 || c.used != 3 || c.iused != 9) {
+        return -1;
+    }
+    jser_order_t orders[3];
+    size_t indices[9];
+    c = (jser_canonical_t){ .orders = orders, .length = ELEMENTS(orders), .indices = indices, .ilength = ELEMENTS(indices) - 1, };
+    if (jser_canonical_prepare(js, ELEMENTS(js), &c) != JSER_ERR_SPACE) {
+        return -1;
+    }
+    c.ilength = ELEMENTS(indices);
+    if (jser_canonical_prepare(js, ELEMENTS(js), &c) < 0) {
+        return -1;
+    }
+    static const char *expect = "{\"a\":-2,\"nested\":{\"b\":true,\"y\":3},\"un\":{\"alpha\":-2,\"type\":\"v\",\"x\":4},\"z\":1}";
+    char out[128];
+    jser_buffer_t ob = { .length = sizeof out - 1, .used = 0, .buf = (unsigned char *)out, };
+    if (jser_serialize_canonical(js, ELEMENTS(js), &c, &ob, NULL) < 0) {
+        return -1;
+    }
+    out[ob.used] = '\0';
+    if (strcmp(out, expect)) {
+        return -1;
+    }
+    jser_t other[] = { MK_LONG(a), MK_LONG(y), }; /* not prepared */
+    ob.used = 0;
+    if (jser_serialize_canonical(other, ELEMENTS(other), &c, &ob, NULL) != JSER_ERR_CONFIG) {
+        return -1;
+    }
+
+    /* a table met twice, apart, gets one order */
+    jser_t twice[] = {
+        { .attr = "p", .type = JSER_OBJECT_E, .data.jser = nested, .length = ELEMENTS(nested), .used = ELEMENTS(nested), },
+        MK_LONG(z),
+        { .attr = "q", .type = JSER_OBJECT_E, .data.jser = nested, .length = ELEMENTS(nested), .used = ELEMENTS(nested), },
+    };
+    c = (jser_canonical_t){ .orders = orders, .length = ELEMENTS(orders), .indices = indices, .ilength = ELEMENTS(indices), };
+    if (jser_canonical_prepare(twice, ELEMENTS(twice), &c) < 0 || c.used != 2) {
+        return -1;
+    }
+    ob.used = 0;
+    if (jser_serialize_canonical(twice, ELEMENTS(twice), &c, &ob, NULL) < 0) {
+        return -1;
+    }
+    out[ob.used] = '\0';
+    if (strcmp(out, "{\"p\":{\"b\":true,\"y\":3},\"q\":{\"b\":true,\"y\":3},\"z\":1}")) {
+        return -1;
+    }
+    c.indices = NULL; /* storage for the orders but not their indices */
+    return jser_canonical_prepare(twice, ELEMENTS(twice), &c) == JSER_ERR_CONFIG ? 0 : -1;
+}
+
+static inline int test_jser_delta(void)
+{
+    jser_long_t a = 0, b = 0;
+    bool on = false;
+    jser_t nested[] = { MK_BOOL(on), };
+    jser_t js[] = { MK_LONG(a), MK_OBJECT(nested), MK_LONG(b), };
+    jser_delta_t d = { .slots = NULL, };
+    if (jser_delta_prepare(js, ELEMENTS(js), &d) < 0 || d.used != 3 || d.tused != 3 * DELTA_NUMBER) {
+        return -1;
+    }
+    jser_slot_t slots[4];
+    char text[128];
+    unsigned char changed[1];
+    d = (jser_delta_t){ .slots = slots, .length = ELEMENTS(slots), .text = text, .tlength = 2 * DELTA_NUMBER, .changed = changed, .clength = sizeof changed, };
+    if (jser_delta_prepare(js, ELEMENTS(js), &d) != JSER_ERR_SPACE) {
+        return -1;
+    }
+    d.tlength = sizeof text;
+    if (jser_delta_prepare(js, ELEMENTS(js), &d) < 0) {
+        return -1;
+    }
+    char in[64] = "{\"a\":1,\"nested\":{\"on\":true},\"b\":-2}";
+    jser_buffer_t ib = { .length = sizeof in, .used = strlen(in), .buf = (unsigned char *)in, };
+    jsmntok_t t[16];
+    if (jser_deserialize_delta(js, ELEMENTS(js), t, ELEMENTS(t), &ib, &d) < 0 || changed[0] != 7 || a != 1 || !on || b != -2) {
+        return -1;
+    }
+    a = 10; /* not restored as its text is the same */
+    strcpy(in, "{\"a\":1,\"nested\":{\"on\":true},\"b\":3}");
+    ib.used = strlen(in);
+    if (jser_deserialize_delta(js, ELEMENTS(js), t, ELEMENTS(t), &ib, &d) < 0 || changed[0] != 4 || a != 10 || b != 3) {
+        return -1;
+    }
+    if (jser_delta_changed(&d, &js[2]) != 1 || jser_delta_changed(&d, &nested[0]) != 0 || jser_delta_changed(&d, &js[1]) >= 0) {
+        return -1;
+    }
+
+    char name[8] = "", data[8] = "";
+    jser_buffer_t buf = { .length = sizeof data, .buf = (unsigned char *)data, };
+    jser_t values[] = { MK_LONG(a), { .attr = "name", .type = JSER_ASCIIZ_E, .data.asciiz = name, .length = sizeof name, }, MK_BUF(buf), };
+    d = (jser_delta_t){ .slots = slots, .length = ELEMENTS(slots), .text = text, .tlength = sizeof text, .changed = changed, .clength = sizeof changed, };
+    if (jser_delta_prepare(values, ELEMENTS(values), &d) < 0 || d.tused != DELTA_NUMBER + 7 + 12) {
+        return -1;
+    }
+    strcpy(in, "{\"a\":40189,\"name\":\"abc\",\"buf\":\"AQID\"}");
+    ib.used = strlen(in);
+    if (jser_deserialize_delta(values, ELEMENTS(values), t, ELEMENTS(t), &ib, &d) < 0 || changed[0] != 7 || a != 40189 || buf.used != 3) {
+        return -1;
+    }
+    strcpy(in, "{\"a\":797186,\"name\":\"abd\",\"buf\":\"AQID\"}"); /* 40189 and 797186 have the same 32-bit FNV-1a hash */
+    ib.used = strlen(in);
+    if (jser_deserialize_delta(values, ELEMENTS(values), t, ELEMENTS(t), &ib, &d) < 0 || changed[0] != 3 || a != 797186 || strcmp(name, "abd")) {
+        return -1;
+    }
+    data[0] = 9; /* like numbers, storage altered since is not restored */
+    strcpy(name, "xyz");
+    if (jser_deserialize_delta(values, ELEMENTS(values), t, ELEMENTS(t), &ib, &d) < 0 || changed[0] != 0 || data[0] != 9 || strcmp(name, "xyz")) {
+        return -1;
+    }
+    strcpy(in, "{\"a\":\"797186\",\"name\":\"abd\",\"buf\":\"AQIE\"}"); /* the same text as a string is not the same value */
+    ib.used = strlen(in);
+    if (jser_deserialize_delta(values, ELEMENTS(values), t, ELEMENTS(t), &ib, &d) != JSER_ERR_TYPE) {
+        return -1;
+    }
+    strcpy(in, "{\"a\":797186,\"name\":\"abd\",\"buf\":\"AQIE\"}");
+    ib.used = strlen(in);
+    if (jser_deserialize_delta(values, ELEMENTS(values), t, ELEMENTS(t), &ib, &d) < 0 || changed[0] != 5 || data[2] != 4 || a != 797186) {
+        return -1;
+    }
+    return 0;
 }
 
-static inline int test_json_length(jser_t *j, const size_t jlen, const int pretty, const char *expected)
-{
-    assert(j);
-    assert(expected);
-    size_t sz = 0;
-    if (jser_serialized_length(j, jlen, pretty, &sz) < 0) {
+static inline int test_jser_lookup(void)
+{
+    jser_long_t a = 0, b = 0, c = 0, e = 0, x = 0, y = 0;
+    jser_t nested[] = { MK_LONG(x), MK_LONG(y), };
+    jser_t js[] = { MK_LONG(a), MK_LONG(b), MK_LONG(c), MK_OBJECT(nested), MK_LONG(e), };
+    jser_lookup_t l = { .tables = NULL, };
+    if (jser_lookup_prepare(js, ELEMENTS(js), &l) < 0 || l.used != 2 || l.iused != 3 * 7) {
+        return -1;
+    }
+    jser_probe_t tables[2];
+    size_t indices[3 * 7];
+    l = (jser_lookup_t){ .tables = tables, .length = ELEMENTS(tables), .indices = indices, .ilength = ELEMENTS(indices), .learn = true, };
+    if (jser_lookup_prepare(js, ELEMENTS(js), &l) < 0) {
+        return -1;
+    }
+    char in[] = "{\"e\":5,\"nested\":{\"y\":2,\"x\":1}}";
+    jser_buffer_t ib = { .length = sizeof in, .used = strlen(in), .buf = (unsigned char *)in, };
+    jsmntok_t t[16];
+    if (jser_deserialize_adaptive(js, ELEMENTS(js), t, ELEMENTS(t), &ib, &l) < 0 || e != 5 || x != 1 || y != 2) {
+        return -1;
+    }
+    if (l.lookups != 4 || l.probes != 5 + 4 + 2 + 1) {
+        return -1;
+    }
+    const jser_probe_t *top = tables[0].j == js ? &tables[0] : &tables[1], *inner = top == tables ? &tables[1] : &tables[0]; /* sorted by address */
+    if (jser_lookup_learn(&l) < 0 || l.lookups != 0 || top->order[0] != 4 || top->order[1] != 3 || top->order[2] != 0 || inner->order[0] != 1) {
+        return -1;
+    }
+    e = 0;
+    x = 0;
+    y = 0;
+    l.learn = false;
+    if (jser_deserialize_adaptive(js, ELEMENTS(js), t, ELEMENTS(t), &ib, &l) < 0 || e != 5 || x != 1 || y != 2) {
+        return -1;
+    }
+    if (l.lookups != 4 || l.probes != 4) {
+        return -1;
+    }
+    if (jser_lookup_learn(&l) < 0 || top->order[0] != 4) { /* nothing learnt, nothing changes */
+        return -1;
+    }
+
+    jser_long_t v[6] = { 0 }; /* records with the same layout share one order */
+    jser_t r0[] = { MK_NAMED_LONG(v[0], "x"), MK_NAMED_LONG(v[1], "y"), };
+    jser_t r1[] = { MK_NAMED_LONG(v[2], "x"), MK_NAMED_LONG(v[3], "y"), };
+    jser_t r2[] = { MK_NAMED_LONG(v[4], "x"), MK_NAMED_LONG(v[5], "y"), };
+    jser_t recs[] = {
+        { .type = JSER_OBJECT_E, .data.jser = r0, .length = ELEMENTS(r0), .used = ELEMENTS(r0), },
+        { .type = JSER_OBJECT_E, .data.jser = r1, .length = ELEMENTS(r1), .used = ELEMENTS(r1), },
+        { .type = JSER_OBJECT_E, .data.jser = r2, .length = ELEMENTS(r2), .used = ELEMENTS(r2), },
+    };
+    jser_t rs[] = { MK_ARRAY(recs), };
+    l = (jser_lookup_t){ .tables = NULL, };
+    if (jser_lookup_prepare(rs, ELEMENTS(rs), &l) < 0 || l.used != 4 || l.iused != 3 * 1 + 3 * 2) {
         return -1;
     }
-    const size_t elen = strlen(expected);
-    if (sz != elen) {
+    jser_probe_t shared[4];
+    l = (jser_lookup_t){ .tables = shared, .length = ELEMENTS(shared), .indices = indices, .ilength = 3 * 1 + 3 * 2, .learn = true, };
+    if (jser_lookup_prepare(rs, ELEMENTS(rs), &l) < 0) {
         return -1;
     }
-    return 0;
+    char rin[] = "{\"recs\":[{\"y\":2,\"x\":1},{\"y\":4,\"x\":3}]}";
+    ib = (jser_buffer_t){ .length = sizeof rin, .used = strlen(rin), .buf = (unsigned char *)rin, };
+    if (jser_deserialize_adaptive(rs, ELEMENTS(rs), t, ELEMENTS(t), &ib, &l) < 0 || v[0] != 1 || v[3] != 4 || l.used != 4 || jser_lookup_learn(&l) < 0) {
+        return -1;
+    }
+    for (size_t i = 0; i < l.used; i++) { /* the third record learns from the first two */
+        if (shared[i].j == r2 && shared[i].order[0] != 1) {
+            return -1;
+        }
+    }
+    l.indices = NULL; /* storage for the tables but not their indices */
+    return jser_lookup_prepare(rs, ELEMENTS(rs), &l) == JSER_ERR_CONFIG ? 0 : -1;
 }
 
-static inline int test_json_serializer(jser_t *j, size_t jlen, const int pretty, const char *expected)
+/* Every kernel gives the same answers as the portable ones */
+static inline int test_jser_kernels(void)
 {
-    assert(j);
-    assert(expected);
-    char t[512] = { 0 };
-    if (strlen(expected) > ((sizeof t) - 1)) {
+    unsigned char buf[80];
+    for (size_t i = 0; i < sizeof buf; i++) {
+        buf[i] = (unsigned char)('a' + (i * 7) % 26);
+    }
+    const jser_kernels_t *best = jser_kernel(), *portable = &kernels_portable;
+    if (best->crc32c(0, buf, sizeof buf) != portable->crc32c(0, buf, sizeof buf)) {
         return -1;
     }
-    if (test_json_element(j, jlen, pretty, t, sizeof t) < 0) {
-        return -2;
+    static const unsigned char stops[] = { '"', '\\', '\n', 0, 0x1F, };
+    for (size_t i = 0; i < sizeof buf; i++) {
+        for (size_t k = 0; k < sizeof stops; k++) {
+            unsigned char s[80];
+            memcpy(s, buf, sizeof s);
+            s[i] = stops[k];
+            if (best->string(s, sizeof s) != i || portable->string(s, sizeof s) != i) {
+                return -1;
+            }
+            memset(s, stops[k] == '\n' ? '\t' : ' ', sizeof s);
+            s[i] = 'x';
+            if (best->space(s, sizeof s) != i || portable->space(s, sizeof s) != i) {
+                return -1;
+            }
+        }
     }
-    return strcmp(expected, t) ? -3 : 0;
+    unsigned long version = 0;
+    if (jser_force_portable(1) < 0 || jser_version(&version) < 0 || ((version >> 24) & 0xC0u) || jser_kernel() != portable) {
+        (void)jser_force_portable(0);
+        return -1;
+    }
+    return jser_force_portable(0) < 0 || jser_kernel() != best ? -1 : 0;
 }
 
-static inline int test_json_serialization(void)
+static inline int test_jser_encoder(void)
 {
-    int r = 0;
-
-    typedef struct {
-        jser_t *element;
-        const char *expect;
-        int pretty;
-    } test_t;
-
-    jser_long_t l1 = 123, l2 = 0, l3 = -123;
-    char str1[] = "HELLO", str2[] = "";
-    jser_buffer_t buf1 = { .length = sizeof str1, .used = sizeof str1, .buf = (unsigned char *)str1};
-    jser_buffer_t buf2 = { .length = 0, .used = 0, .buf = NULL };
-
-    test_t tests[] = {
-        {  &(jser_t)MK_LONG(l1),     "{\"l1\":123}",             0,  },
-        {  &(jser_t)MK_LONG(l2),     "{\"l2\":0}",               0,  },
-        {  &(jser_t)MK_LONG(l3),     "{\"l3\":-123}",            0,  },
-        {  &(jser_t)MK_BUF(buf1),    "{\"buf1\":\"SEVMTE8A\"}",  0,  },
-        {  &(jser_t)MK_BUF(buf2),    "{\"buf2\":\"\"}",          0,  },
-        {  &(jser_t)MK_ASCIIZ(str2), "{\"str2\":\"\"}",          0,  },
-        {  &(jser_t)MK_ASCIIZ(str1), "{\"str1\":\"HELLO\"}",     0,  },
+    jser_long_t id = 0, x = 7, l1 = -42, a1[] = { 3, -1, };
+    jser_ulong_t u1 = 18446744073709551615ull;
+    bool b1 = true;
+    char s1[16] = "abc d"; /* only escaped on the way out if escaping is built in */
+    if (JSER_ENABLE_ESCAPE) {
+        strcpy(s1, "a\"b\\c\td");
+    }
+    const char *raw = JSER_ENABLE_ESCAPE ? "a\\\"b\\\\c\\td" : "abc d"; /* as bound, escapes are kept */
+    unsigned char bytes[] = "HELLO, WORLD!";
+    jser_buffer_t buf1 = { .length = sizeof bytes - 1, .used = sizeof bytes - 1, .buf = bytes, };
+    jser_t fields[] = { MK_LONG(id), };
+    jser_t record = { .type = JSER_OBJECT_E, .data.jser = fields, .length = ELEMENTS(fields), .used = ELEMENTS(fields), };
+    jser_stream_t records = { .record = &record, .next = test_stream_next, };
+    jser_t point[] = { MK_LONG(x), };
+    jser_variant_t variants[] = { MK_VARIANT("point", point), };
+    jser_union_t shape = { .attr = "type", .variants = variants, .length = ELEMENTS(variants), .selected = 0, };
+    jser_t js[] = {
+        MK_LONG(l1), MK_ULONG(u1), MK_BOOL(b1), MK_ASCIIZ(s1), MK_BUF(buf1),
+        { .attr = "a1", .type = JSER_LONG_E, .data.ld = a1, .length = ELEMENTS(a1), .used = ELEMENTS(a1), .is_array = true, },
+        MK_UNION(shape), MK_STREAM(records),
     };
-
-    for (size_t i = 0; i < ELEMENTS(tests); i++) {
-        test_t *t = &tests[i];
-        jser_t *ele = t->element;
-        const char *exp = t->expect;
-        if (test_json_serializer(ele, 1, t->pretty, exp) < 0) {
-            r = -1;
+    unsigned char whole[256] = { 0 }, out[256] = { 0 }, piece[8] = { 0 };
+    jser_buffer_t wb = { .length = sizeof whole, .used = 0, .buf = whole, };
+    if (jser_serialize_to_buffer(js, ELEMENTS(js), 0, &wb) < 0) {
+        return -1;
+    }
+    jser_level_t stack[4];
+    for (size_t size = 1; size <= sizeof piece; size++) { /* the same output, however it is split up */
+        jser_encoder_t w;
+        if (jser_encoder_init(&w, js, ELEMENTS(js), stack, ELEMENTS(stack)) < 0) {
+            return -1;
         }
-        if (test_json_length(ele, 1, t->pretty, exp) < 0) {
-            r = -1;
+        size_t used = 0;
+        for (int r = 1; r > 0;) {
+            jser_buffer_t b = { .length = size, .used = 0, .buf = piece, };
+            if ((r = jser_encode(&w, &b)) < 0 || (used + b.used) > sizeof out) {
+                return -1;
+            }
+            memcpy(&out[used], piece, b.used);
+            used += b.used;
+        }
+        if (used != wb.used || w.written != used || memcmp(out, whole, used)) {
+            return -1;
         }
     }
-
-    /* some minimal path retrieval tests as well...*/
-    jser_t *found = NULL;
-    if (jser_retrieve_node(tests[0].element, 1, &found, "l1") != 1) {
+    jser_encoder_t w;
+    jser_buffer_t ob = { .length = sizeof out, .used = 0, .buf = out, };
+    if (jser_encoder_init(&w, js, ELEMENTS(js), stack, 1) < 0 || jser_encode(&w, &ob) != JSER_ERR_DEPTH) {
         return -1;
     }
 
-    if (jser_retrieve_node(tests[0].element, 1, &found, "l2") == 1) {
+    jser_long_t l2 = 0;
+    char s2[16] = { 0 };
+    unsigned char bytes2[16] = { 0 };
+    jser_buffer_t buf2 = { .length = sizeof bytes2, .used = 0, .buf = bytes2, };
+    jser_t js2[] = {
+        MK_NAMED_LONG(l2, "l1"), MK_NAMED_BUF(buf2, "buf1"),
+        { .attr = "s1", .type = JSER_ASCIIZ_E, .data.asciiz = s2, .length = sizeof s2, },
+    };
+    unsigned char window[256] = { 0 };
+    jser_buffer_t wd = { .length = sizeof window, .used = 0, .buf = window, };
+    jsmntok_t t[32];
+    jser_frame_t frames[4];
+    for (size_t size = 1; size <= 7; size++) {
+        jser_decoder_t d;
+        if (jser_decoder_init(&d, js2, ELEMENTS(js2), t, ELEMENTS(t), &wd, frames, ELEMENTS(frames)) < 0) {
+            return -1;
+        }
+        l2 = 0;
+        int r = 1;
+        for (size_t at = 0; r > 0;) {
+            unsigned char *p = NULL;
+            size_t room = 0, n = wb.used - at < size ? wb.used - at : size;
+            if (jser_decoder_space(&d, &p, &room) < 0) {
+                return -1;
+            }
+            n = n < room ? n : room;
+            memcpy(p, &whole[at], n);
+            at += n;
+            r = jser_decoder_push(&d, n);
+        }
+        if (r < 0 || l2 != l1 || strcmp(s2, raw) || buf2.used != buf1.used || memcmp(bytes, bytes2, buf2.used)) {
+            return -1;
+        }
+        if (jser_decoder_push(&d, 0) != JSER_OK) {
+            return -1;
+        }
+    }
+    jser_decoder_t d;
+    unsigned char *p = NULL;
+    size_t room = 0;
+    if (jser_decoder_init(&d, js2, ELEMENTS(js2), t, ELEMENTS(t), &wd, frames, ELEMENTS(frames)) < 0 || jser_decoder_space(&d, &p, &room) < 0) {
         return -1;
     }
-
-    return r;
+    memcpy(p, "{\"l1\":", 6);
+    if (jser_decoder_push(&d, 6) != 1 || jser_decoder_push(&d, 0) != JSER_ERR_MORE_DAT) {
+        return -1;
+    }
+    return 0;
 }
 
-static inline int test_json_deserialization(void)
+static inline int test_jser_budget(void)
 {
-
-    jser_long_t a = 0, b = 0, c = 0;
-
-    jser_t j[] = { MK_LONG(a), MK_LONG(b), MK_LONG(c), };
-
-    jsmntok_t t[16];
-
-    static const char *i1 = "{\"a\":1,\"b\":2,\"c\":3}";
-    if (jser_deserialize_from_asciiz(j, ELEMENTS(j), t, ELEMENTS(t), i1) < 0) {
+    jser_long_t a[6] = { 0 }, x = 0, y = 0;
+    jser_t as[] = {
+        { .type = JSER_LONG_E, .data.ld = &a[0], }, { .type = JSER_LONG_E, .data.ld = &a[1], }, { .type = JSER_LONG_E, .data.ld = &a[2], },
+        { .type = JSER_LONG_E, .data.ld = &a[3], }, { .type = JSER_LONG_E, .data.ld = &a[4], }, { .type = JSER_LONG_E, .data.ld = &a[5], },
+    };
+    jser_t o[] = { MK_LONG(x), MK_LONG(y), };
+    char s[8] = { 0 };
+    jser_t js[] = { MK_NAMED_ARRAY(as, "a"), MK_OBJECT(o), { .attr = "s", .type = JSER_ASCIIZ_E, .data.asciiz = s, .length = sizeof s, }, };
+    static const char *doc = "{\"a\":[1,2,3,4,5,6],\"o\":{\"x\":-1,\"y\":2},\"s\":\"abc\"}";
+    const size_t length = strlen(doc), budget = 4;
+    unsigned char in[64] = { 0 }, out[64] = { 0 };
+    jser_buffer_t b = { .length = sizeof in, .used = 0, .buf = in, };
+    jsmntok_t t[24];
+    jser_frame_t frames[4];
+    jser_decoder_t d;
+    jser_progress_t p = { .bytes = 0, };
+    if (jser_decoder_init(&d, js, ELEMENTS(js), t, ELEMENTS(t), &b, frames, ELEMENTS(frames)) < 0) {
         return -1;
     }
-
-    if (a != 1 || b != 2 || c != 3) {
+    memcpy(in, doc, length); /* already in the window */
+    size_t calls = 0, last = 0, bound = 0;
+    int r = jser_decoder_step(&d, length, budget, &p);
+    for (; r == 2; calls++) {
+        if ((p.bytes - last) > (budget + 5) || p.tokens > p.total || p.tokens < bound || (p.tokens - bound) > budget) { /* plus any token it stopped within */
+            return -1;
+        }
+        last  = p.bytes;
+        bound = p.tokens;
+        r = jser_decoder_step(&d, 0, budget, &p);
+    }
+    if (r != JSER_OK || calls < (length / budget) || p.bytes != length || p.tokens != p.total) {
         return -1;
     }
-
-    static const char *i2 = "{}";
-    if (jser_deserialize_from_asciiz(j, ELEMENTS(j), t, ELEMENTS(t), i2) < 0) {
+    if (a[0] != 1 || a[5] != 6 || x != -1 || y != 2 || strcmp(s, "abc")) {
         return -1;
     }
 
-    if (a != 1 || b != 2 || c != 3) {
+    static char big[2048 + 16], text[2048 + 1]; /* a string far longer than the budget is only checked once */
+    jser_t one[] = { { .attr = "s", .type = JSER_ASCIIZ_E, .data.asciiz = text, .length = sizeof text, }, };
+    memcpy(big, "{\"s\":\"", 6);
+    memset(&big[6], 'x', 2048);
+    memcpy(&big[6 + 2048], "\"}", 2);
+    jser_buffer_t bb = { .length = sizeof big, .used = 0, .buf = (unsigned char *)big, };
+    if (jser_decoder_init(&d, one, ELEMENTS(one), t, ELEMENTS(t), &bb, frames, ELEMENTS(frames)) < 0) {
         return -1;
     }
-
-    static const char *i3 = "{\"a\":4"; /* an invalid string */
-    if (jser_deserialize_from_asciiz(j, ELEMENTS(j), t, ELEMENTS(t), i3) == 0) { /* should fail */
+    size_t checked = 6;
+    calls = 0;
+    for (r = jser_decoder_step(&d, 6 + 2048 + 2, 64, &p); r == 2; calls++) {
+        if (!d.binding && (d.jp.partial != 5 || (size_t)d.jp.checked <= checked || ((size_t)d.jp.checked - checked) > 64)) {
+            return -1; /* each call carries on from where the last stopped */
+        }
+        checked = d.jp.checked;
+        r = jser_decoder_step(&d, 0, 64, &p);
+    }
+    if (r != JSER_OK || calls < (2048 / 64) - 1 || calls > (2048 / 64) + 2 || strlen(text) != 2048 || text[2047] != 'x') {
         return -1;
     }
 
-    if (a != 1 || b != 2 || c != 3) { /* variables are untouched */
+    static char zeros[2 * 10000 + 32]; /* the value of an unknown attribute is skipped within the budget too */
+    static jsmntok_t many[10000 + 8];
+    jser_long_t one_a = 0;
+    jser_t known[] = { { .attr = "a", .type = JSER_LONG_E, .data.ld = &one_a, }, };
+    size_t zl = 0;
+    memcpy(zeros, "{\"zz\":[", 7);
+    for (zl = 7; zl < (7 + 2 * 10000); zl += 2) {
+        memcpy(&zeros[zl], "0,", 2);
+    }
+    memcpy(&zeros[zl - 1], "],\"a\":1}", 9);
+    zl += 8;
+    jser_buffer_t zb = { .length = sizeof zeros, .used = 0, .buf = (unsigned char *)zeros, };
+    if (jser_decoder_init(&d, known, ELEMENTS(known), many, ELEMENTS(many), &zb, frames, ELEMENTS(frames)) < 0) {
+        return -1;
+    }
+    calls = 0;
+    bound = 0;
+    for (r = jser_decoder_step(&d, zl, 64, &p); r == 2; calls++) {
+        if (p.tokens < bound || (p.tokens - bound) > 64) {
+            return -1;
+        }
+        bound = p.tokens;
+        r = jser_decoder_step(&d, 0, 64, &p);
+    }
+    if (r != JSER_OK || one_a != 1 || p.tokens != p.total || calls < (10000 / 64)) {
         return -1;
     }
 
-    static const char *i4 = "{\"a\":4}";
-    if (jser_deserialize_from_asciiz(j, ELEMENTS(j), t, ELEMENTS(t), i4) < 0) {
+    jser_level_t levels[4];
+    jser_encoder_t w;
+    jser_buffer_t ob = { .length = sizeof out, .used = 0, .buf = out, };
+    if (jser_encoder_init(&w, js, ELEMENTS(js), levels, ELEMENTS(levels)) < 0) {
         return -1;
     }
-    if (a != 4 || b != 2 || c != 3) { /* only 'a' has been changed */
+    calls = 0;
+    for (r = 1; r == 1; calls++) {
+        const size_t used = ob.used;
+        if ((r = jser_encode_step(&w, &ob, budget, &p)) < 0 || (ob.used - used) > budget || p.bytes != ob.used) {
+            return -1;
+        }
+    }
+    if (ob.used != length || memcmp(out, doc, length) || calls < (length / budget)) {
         return -1;
     }
-
     return 0;
 }
 
-static inline int test_jser_complex(void)
+static int test_limited(jser_t *j, const size_t jlen, const char *doc, const jser_limits_t *l)
 {
-    jser_long_t l1 = 123, l2 = -456, l3 = -1;
-    jser_ulong_t lu1 = 123, lu2 = 456, ul3 = 0, ul4 = 999;
-
-    char str1[] = "HI";
-    char str2[] = "BYE";
-    char str3[] = "ABC";
-    char str4[] = "A\tB\n\rC\\  \" escaped";
-
-    bool b1 = true, b2 = false, b3 = false;
-    unsigned char buffer[512] = { 0 };
-    jser_buffer_t b = { .length = sizeof buffer, .used = 0, .buf = buffer, };
-
-    jser_t jnested[] = {
-        MK_ULONG(ul3),
-        MK_ULONG(ul4),
-        {  .attr  =  "l2",    .type  =  JSER_LONG_E,    .data.ld      =  &l3   },
-        MK_ASCIIZ(str3),
-    };
-
-    jser_t jarray[] = { MK_ULONG(lu1), MK_ULONG(lu2), MK_LONG(l2), MK_ASCIIZ(str3), };
-
-    unsigned char bstr1[] = "HELLO";
-    jser_buffer_t buf1 = { .used = sizeof (bstr1) - 1, .length = sizeof (bstr1), .buf = bstr1, };
-
-    jser_t js[] = {
-        MK_ULONG(lu1),
-        {  .attr  =  "lu2",   .type  =  JSER_ULONG_E,   .data.lu      =  &lu2      },
-        {  .attr  =  "ld1",   .type  =  JSER_LONG_E,    .data.ld      =  &l1       },
-        {  .attr  =  "ld2",   .type  =  JSER_LONG_E,    .data.ld      =  &l2       },
-        {  .attr  =  "j1",    .type  =  JSER_OBJECT_E,  .data.jser    =  jnested,  .length  =  ELEMENTS(jnested),  .used  =  ELEMENTS(jnested)  },
-        {  .attr  =  "s1",    .type  =  JSER_ASCIIZ_E,  .data.asciiz  =  str1      },
-        {  .attr  =  "s2",    .type  =  JSER_ASCIIZ_E,  .data.asciiz  =  str2      },
-        {  .attr  =  "a1",    .type  =  JSER_ARRAY_E,   .data.array   =  jarray,   .length  =  ELEMENTS(jarray),   .used  =  ELEMENTS(jarray),  },
-        {  .attr  =  "b1",    .type  =  JSER_BOOL_E,    .data.b       =  &b1       },
-        {  .attr  =  "b2",    .type  =  JSER_BOOL_E,    .data.b       =  &b2       },
-        {  .attr  =  "b3",    .type  =  JSER_BOOL_E,    .data.b       =  &b3       },
-        {  .attr  =  "s4",    .type  =  JSER_ASCIIZ_E,  .data.asciiz  =  str4      },
-        {  .attr  =  "buf1",  .type  =  JSER_BUFFER_E,  .data.buf     =  &buf1     },
-    };
+    jsmntok_t t[32];
+    jser_buffer_t b = { .length = strlen(doc), .used = strlen(doc), .buf = (unsigned char *)doc, };
+    return jser_deserialize_with_limits(j, jlen, t, ELEMENTS(t), &b, l);
+}
 
-    size_t nodes = ELEMENTS(js);
-    if (jser_node_count(js, &nodes) < 0) {
+static inline int test_jser_limits(void)
+{
+    jser_long_t a[3] = { 0 }, q = 0;
+    jser_t as[] = { { .type = JSER_LONG_E, .data.ld = &a[0], }, { .type = JSER_LONG_E, .data.ld = &a[1], }, { .type = JSER_LONG_E, .data.ld = &a[2], }, };
+    jser_t p[] = { MK_LONG(q), };
+    jser_t o[] = { MK_OBJECT(p), };
+    char s[8] = { 0 };
+    jser_t js[] = { MK_NAMED_ARRAY(as, "a"), { .attr = "s", .type = JSER_ASCIIZ_E, .data.asciiz = s, .length = sizeof s, }, MK_OBJECT(o), };
+    static const char *doc = "{\"a\":[1,2,3],\"s\":\"hello\",\"o\":{\"p\":{\"q\":1}}}"; /* 14 tokens */
+    const jser_limits_t fits = { .bytes = strlen(doc), .tokens = 14, .string = 5, .array = 3, .depth = 3, };
+    if (test_limited(js, ELEMENTS(js), doc, &fits) < 0 || q != 1 || a[2] != 3) {
         return -1;
     }
+    for (size_t i = 0; i < 5; i++) { /* each limit just too small */
+        jser_limits_t l = fits;
+        size_t *f[] = { &l.bytes, &l.tokens, &l.string, &l.array, &l.depth, };
+        (*f[i])--;
+        if (test_limited(js, ELEMENTS(js), doc, &l) != JSER_ERR_LIMIT) {
+            return -1;
+        }
+    }
 
-    if (nodes != (ELEMENTS(js) + ELEMENTS(jarray) + ELEMENTS(jnested))) {
+    jser_long_t id = 0, n = 0;
+    jser_t fields[] = { MK_LONG(id), };
+    jser_t record = { .type = JSER_OBJECT_E, .data.jser = fields, .length = ELEMENTS(fields), .used = ELEMENTS(fields), };
+    test_stream_t result = { .sum = 0, .count = 0, };
+    jser_stream_t records = { .record = &record, .each = test_stream_each, .param = &result, };
+    jser_t st[] = { MK_LONG(n), MK_STREAM(records), };
+    static const char *i1 = "{\"records\":[{\"id\":1},{\"id\":2},{\"id\":3}],\"n\":3}";
+    const jser_limits_t two = { .array = 2, }, three = { .array = 3, };
+    if (test_limited(st, ELEMENTS(st), i1, &two) != JSER_ERR_LIMIT || result.count != 2) {
         return -1;
     }
-
-    if (jser_serialize_to_buffer(js, ELEMENTS(js), 0, &b) < 0) {
+    result.count = 0;
+    if (test_limited(st, ELEMENTS(st), i1, &three) < 0 || result.count != 3 || n != 3) {
         return -1;
     }
 
-    static const char result[] = "{\"lu1\":123,\"lu2\":456,\"\
-ld1\":123,\"ld2\":-456,\"j1\":{\"ul3\":0,\"ul4\":999,\"\
-l2\":-1,\"str3\":\"ABC\"},\"s1\":\"HI\",\"s2\":\"BYE\",\
-\"a1\":[123,456,-456,\"ABC\"],\"b1\":true,\"b2\":false,\
-\"b3\":false,\"s4\":\"A\\tB\\n\\rC\\\\  \\\" escaped\",\
-\"buf1\":\"SEVMTE8=\"}";
+    jser_long_t v[1] = { 0 }; /* arrays within records count towards their own length, not the stream's */
+    jser_t vs[] = { { .type = JSER_LONG_E, .data.ld = &v[0], }, };
+    jser_t nested[] = { MK_LONG(id), MK_NAMED_ARRAY(vs, "v"), };
+    record = (jser_t){ .type = JSER_OBJECT_E, .data.jser = nested, .length = ELEMENTS(nested), .used = ELEMENTS(nested), };
+    static const char *i2 = "{\"records\":[{\"id\":1,\"v\":[1]},{\"id\":2,\"v\":[1]},{\"id\":3,\"v\":[1]},{\"id\":4,\"v\":[1]},{\"id\":5,\"v\":[1]}],\"n\":5}";
+    result.count = 0;
+    if (test_limited(st, ELEMENTS(st), i2, &two) != JSER_ERR_LIMIT || result.count != 2) {
+        return -1;
+    }
+    const jser_limits_t five = { .array = 5, };
+    result.count = 0;
+    if (test_limited(st, ELEMENTS(st), i2, &five) < 0 || result.count != 5 || n != 5 || v[0] != 1) {
+        return -1;
+    }
 
-    if (memcmp(result, buffer, sizeof (result) - 1)) {
+    unsigned char window[64] = { 0 };
+    jser_buffer_t w = { .length = sizeof window, .used = 0, .buf = window, };
+    jsmntok_t t[32];
+    jser_frame_t frames[4];
+    jser_decoder_t d;
+    const jser_limits_t small = { .bytes = 8, };
+    if (jser_decoder_init(&d, js, ELEMENTS(js), t, ELEMENTS(t), &w, frames, ELEMENTS(frames)) < 0 || jser_decoder_limit(&d, &small) < 0) {
+        return -1;
+    }
+    memcpy(window, doc, 9);
+    if (jser_decoder_push(&d, 5) != 1 || jser_decoder_push(&d, 4) != JSER_ERR_LIMIT) {
         return -1;
     }
+    return 0;
+}
 
-    static const char *new_data = "{\n\
-	\"lu1\" : 888,\n\
-	\"lu2\" : 111,\n\
-	\"not-found\"  : { \"ul3\" : 222 }\n\
-	\"also-not-found\" : 111,\n\
-	\"j1\"  : { \"ul3\" : 222 }\n\
-}";
+static inline int test_jser_batch(void)
+{
+    jser_long_t id = 0;
+    jser_t js[] = { MK_LONG(id), };
+    unsigned char out[64];
+    jser_buffer_t b = { .length = sizeof out, .used = 0, .buf = out, };
+    size_t offsets[3];
+    jser_batch_t w = { .b = &b, .offsets = offsets, .length = ELEMENTS(offsets), };
+    for (id = 1; id <= 3; id++) {
+        if (jser_batch_append(&w, js, ELEMENTS(js)) < 0) {
+            return -1;
+        }
+    }
+    if (jser_batch_append(&w, js, ELEMENTS(js)) != JSER_ERR_SPACE || jser_batch_finish(&w) < 0) {
+        return -1;
+    }
+    static const char *lines = "{\"id\":1}\n{\"id\":2}\n{\"id\":3}\n";
+    if (b.used != strlen(lines) || memcmp(out, lines, b.used) || offsets[0] != 0 || offsets[1] != 9 || offsets[2] != 18) {
+        return -1;
+    }
 
-    jsmntok_t tokens[16] = { { 0 }, };
-    if (jser_deserialize_from_asciiz(js, ELEMENTS(js), tokens, ELEMENTS(tokens), new_data) < 0) {
+    b = (jser_buffer_t){ .length = 14, .used = 0, .buf = out, }; /* a record that does not fit leaves nothing behind */
+    w = (jser_batch_t){ .b = &b, };
+    id = 1;
+    if (jser_batch_append(&w, js, ELEMENTS(js)) < 0) {
+        return -1;
+    }
+    id = 2;
+    if (jser_batch_append(&w, js, ELEMENTS(js)) != JSER_ERR_SPACE || b.used != 9 || w.used != 1 || memcmp(out, lines, 9)) {
         return -1;
     }
 
-    if (lu1 != 888  || lu2 != 111 || ul3 != 222) {
+    static test_pipe_t pipe; /* records that do not fit after the last push out what is before them */
+    memset(&pipe, 0, sizeof pipe);
+    const jser_sink_t sink = { .flush = test_pipe_flush, .param = &pipe, };
+    b = (jser_buffer_t){ .length = 16, .used = 0, .buf = out, };
+    w = (jser_batch_t){ .b = &b, .sink = &sink, .offsets = offsets, .length = ELEMENTS(offsets), .prefixed = true, };
+    for (id = 7; id <= 9; id++) {
+        if (jser_batch_append(&w, js, ELEMENTS(js)) < 0) {
+            return -1;
+        }
+    }
+    if (jser_batch_finish(&w) < 0 || pipe.ends != 1 || pipe.used != 36 || w.flushed != 36) {
+        return -1;
+    }
+    if (memcmp(&pipe.out[24], "\0\0\0\x08{\"id\":9}", 12) || offsets[1] != 12 || offsets[2] != 24) {
         return -1;
     }
+    return 0;
+}
 
-    jser_t *found = NULL;
-    const int st = jser_retrieve_node(js, ELEMENTS(js), &found, "j1/ul3");
-    if (st != 1) {
+static inline int test_jser_lint(void)
+{
+    static const struct { const char *in, *minified; int error; } ts[] = {
+        { " [ 1 , 2.5e-3 , -0 , true,null ,\"a\\u00e9 \" ] ", "[1,2.5e-3,-0,true,null,\"a\\u00e9 \"]", JSER_OK, },
+        { "{ \"a\" : { \"b\" : [ ] } ,\n\t\"c\" : \"x y z w v u t s\" }", "{\"a\":{\"b\":[]},\"c\":\"x y z w v u t s\"}", JSER_OK, },
+        { "[1,]",        NULL, JSER_ERR_PARSE, },
+        { "[01]",        NULL, JSER_ERR_PARSE, },
+        { "{\"a\"}",     NULL, JSER_ERR_PARSE, },
+        { "\"a\tb\"",    NULL, JSER_ERR_PARSE, },
+        { "[\"\\x\"]",   NULL, JSER_ERR_PARSE, },
+        { "1 2",         NULL, JSER_ERR_PARSE, },
+        { "[1",          NULL, JSER_ERR_MORE_DAT, },
+        { "\"abcdefghi", NULL, JSER_ERR_MORE_DAT, },
+        { "tru",         NULL, JSER_ERR_MORE_DAT, },
+    };
+    for (size_t i = 0; i < ELEMENTS(ts); i++) {
+        unsigned char buf[64];
+        const size_t n = strlen(ts[i].in);
+        memcpy(buf, ts[i].in, n);
+        jser_buffer_t b = { .length = n, .used = n, .buf = buf, };
+        if (jser_validate(&b) != ts[i].error) {
+            return -1;
+        }
+        if (jser_minify(&b, &b) != ts[i].error) { /* in place */
+            return -1;
+        }
+        if (ts[i].minified && (b.used != strlen(ts[i].minified) || memcmp(buf, ts[i].minified, b.used))) {
+            return -1;
+        }
+    }
+    static const char *in = "{\"a\":[1,{}],\"b\":true}";
+    static const char *pretty = "{\n\t\"a\": [\n\t\t1,\n\t\t{}\n\t],\n\t\"b\": true\n}";
+    unsigned char out[64];
+    jser_buffer_t ib = { .length = strlen(in), .used = strlen(in), .buf = (unsigned char *)in, };
+    jser_buffer_t ob = { .length = sizeof out, .used = 0, .buf = out, };
+    if (jser_prettify(&ib, &ob) < 0 || ob.used != strlen(pretty) || memcmp(out, pretty, ob.used)) {
+        return -1;
+    }
+    ob.length = 8;
+    if (jser_prettify(&ib, &ob) != JSER_ERR_SPACE) {
+        return -1;
+    }
+    char deep[JSER_LINT_DEPTH + 2];
+    memset(deep, '[', sizeof deep);
+    jser_buffer_t db = { .length = sizeof deep, .used = sizeof deep, .buf = (unsigned char *)deep, };
+    if (jser_validate(&db) != JSER_ERR_DEPTH) {
         return -1;
     }
+    return 0;
+}
 
+static inline int test_jser_format(void)
+{
+    jser_long_t a = 1, x = 1, y = 2;
+    bool q = true;
+    jser_t arr[] = { MK_LONG(x), MK_LONG(y), };
+    jser_t p[] = { MK_BOOL(q), };
+    jser_t o[] = { MK_OBJECT(p), };
+    jser_t js[] = { MK_LONG(a), MK_ARRAY(arr), MK_OBJECT(o), };
+
+    char slab[6]; /* too small for the deepest line, which takes more than one copy */
+    jser_format_t f = { .indent = "  ", .newline = "\r\n", .colon_space = false, .compact_arrays = true, };
+    if (jser_format_prepare(&f, slab, 3) != JSER_ERR_SPACE || jser_format_prepare(&f, slab, sizeof slab) < 0 || f.levels != 2) {
+        return -1;
+    }
+    static const char *expect = "{\r\n  \"a\":1,\r\n  \"arr\":[1,2],\r\n  \"o\":\r\n  {\r\n    \"p\":\r\n    {\r\n      \"q\":true\r\n    }\r\n  }\r\n}";
+    char out[128];
+    jser_buffer_t b = { .length = sizeof out, .used = 0, .buf = (unsigned char *)out, };
+    if (jser_serialize_formatted(js, ELEMENTS(js), &f, &b, NULL) < 0 || b.used != strlen(expect) || memcmp(out, expect, b.used)) {
+        return -1;
+    }
     return 0;
 }
 
 int jser_tests(void)
 {
+	int r = 0;
 	if (JSER_ENABLE_TESTS) {
-		test_json_serialization();
-		test_json_deserialization();
-		test_jser_complex();
+		r |= test_json_serialization();
+		r |= test_json_deserialization();
+		r |= test_jser_complex();
+		r |= test_jser_union();
+		r |= test_jser_stream();
+		r |= test_jser_generator();
+		r |= test_jser_chunked();
+		r |= test_jser_chunked_stream();
+		r |= test_jser_grow();
+		r |= test_jser_snapshot();
+		r |= test_jser_depth();
+		r |= test_jser_numbers();
+		r |= test_jser_segments();
+		r |= test_jser_compress();
+		r |= test_jser_digest();
+		r |= test_jser_kernels();
+		r |= test_jser_canonical();
+		r |= test_jser_delta();
+		r |= test_jser_encoder();
+		r |= test_jser_budget();
+		r |= test_jser_limits();
+		r |= test_jser_lookup();
+		r |= test_jser_batch();
+		r |= test_jser_lint();
+		r |= test_jser_format();
 	}
-	return 0;
+	return r < 0 ? -1 : 0;
 }
 
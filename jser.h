@@ -17,8 +17,15 @@ extern "C" {
 #include <stddef.h>
 #include <stdbool.h>
 
+#ifdef JSER_IMPLEMENTATION /* single header mode, see the end of this file */
+#define JSMN_STATIC
+#else
 #define JSMN_HEADER
+#endif
 #define JSMN_PARENT_LINKS
+#define JSMN_ELEMENT_CALLBACK
+#define JSMN_SEGMENTS
+#define JSMN_LIMITS
 #include "jsmn.h"
 
 #ifndef JSER_LONG_T
@@ -37,6 +44,9 @@ typedef enum {
     JSER_BUFFER_E,  /**< a binary buffer, serialized to a base64 encoded string */
     JSER_OBJECT_E,  /**< a JSON object */
     JSER_ARRAY_E,   /**< a JSON array */
+    JSER_UNION_E,   /**< a JSON object whose members depend on the value of a tag attribute */
+    JSER_STREAM_E,  /**< a JSON array of records, processed one element at a time */
+    JSER_CHUNKED_E, /**< a string or base64 buffer, handed to a callback in pieces as it is decoded */
 } jser_type_e; /**< type of value we want to serialize/deserialize*/
 
 typedef struct {
@@ -48,6 +58,33 @@ typedef struct {
 struct jser;
 typedef struct jser jser_t;
 
+typedef struct {
+    const char *tag;     /**< value of the tag attribute that selects this variant */
+    jser_t *jser;        /**< members of the object when this variant is selected */
+    size_t length;       /**< number of elements in 'jser' */
+} jser_variant_t; /**< one arm of a discriminated union */
+
+typedef struct {
+    const char *attr;         /**< name of the tag attribute, for example "type" */
+    jser_variant_t *variants; /**< table of tag values and their schemas */
+    size_t length;            /**< number of elements in 'variants' */
+    size_t selected;          /**< variant to serialize, set to the variant found on deserialization */
+} jser_union_t; /**< a discriminated union, serialized as a single JSON object */
+
+typedef struct {
+    jser_t *record; /**< node that each element is bound into, reused for every element */
+    int (*each)(jser_t *record, size_t index, void *param); /**< called after each element is deserialized, negative aborts */
+    int (*next)(jser_t *record, size_t index, void *param); /**< fills in 'record' for serialization, 1 = element produced, 0 = end, negative aborts */
+    void *param;    /**< passed to the callbacks */
+} jser_stream_t; /**< an array that is processed with callbacks instead of being held in memory */
+
+typedef struct {
+    jser_buffer_t *buf; /**< scratch space values are decoded into, at least four bytes long */
+    int (*chunk)(void *param, const unsigned char *buf, size_t length, bool last); /**< consume a decoded piece, negative aborts */
+    void *param;        /**< passed to 'chunk' */
+    bool base64;        /**< value is base64 encoded binary data, otherwise it is an escaped string */
+} jser_chunked_t; /**< a value too large to be held in memory in one go */
+
 typedef union {
     jser_long_t *ld;
     jser_ulong_t *lu;
@@ -56,8 +93,50 @@ typedef union {
     jser_buffer_t *buf;
     jser_t *jser;
     jser_t *array;
+    jser_union_t *un;
+    jser_stream_t *stream;
+    jser_chunked_t *chunked;
 } jser_type_u; /**< union of pointers to all data types we can handle */
 
+typedef struct {
+    int (*flush)(void *param, const unsigned char *buf, size_t length); /**< consume 'length' bytes of output, negative on error */
+    void *(*grow)(void *param, void *ptr, size_t new_size); /**< resize output buffer, like 'realloc', used if 'flush' is NULL */
+    void *param;    /**< passed to the callbacks */
+} jser_sink_t; /**< destination for serialized output that does not fit into a single buffer, a zero length flush ends it */
+
+typedef struct {
+    int (*read)(void *param, unsigned char *buf, size_t *length); /**< read up to '*length' bytes, setting it to the number read, 0 at end of input, negative on error */
+    void *param;    /**< passed to the callback */
+} jser_source_t; /**< input that is read a piece at a time */
+
+#ifndef JSER_LZ_WINDOW
+#define JSER_LZ_WINDOW (4096) /**< how far back the LZ codec looks for matches, must be the same for both ends */
+#endif
+
+typedef struct { /**< built in LZ compression stage, the fields are private */
+    const jser_sink_t *sink;     /**< where compressed output goes, when encoding */
+    const jser_source_t *source; /**< where compressed input comes from, when decoding */
+    unsigned char history[2 * JSER_LZ_WINDOW];
+    size_t hlen;
+    unsigned short table[1024];  /**< encoder; last position of each hashed 4 byte sequence, plus one */
+    unsigned char io[512];       /**< compressed data waiting to be written or consumed */
+    size_t ilen, ipos;
+    size_t literals, match, offset;
+    int state;
+} jser_lz_t;
+
+#if defined(JSER_ENABLE_ZLIB) && JSER_ENABLE_ZLIB
+#include <zlib.h>
+
+typedef struct { /**< zlib compression stage, the fields are private */
+    z_stream z;
+    const jser_sink_t *sink;
+    const jser_source_t *source;
+    unsigned char io[512];
+    bool eof;
+} jser_zlib_t;
+#endif
+
 struct jser { /**< The main jser object used for serialization */
     const char *attr;      /**< attribute of this element, must be set unless member is part of an array */
     size_t length, used;   /**< length of data we are pointing to, and amount we have actually used */
@@ -66,18 +145,207 @@ struct jser { /**< The main jser object used for serialization */
     bool is_array;         /**< do we actually have an array of 'jser_type_u'? */
 };
 
+typedef struct {
+    const jser_t *j;   /**< object table the order is for... */
+    size_t length;     /**< ...its length... */
+    const char *tag;   /**< ...and the union tag attribute sorted in with its attributes, or NULL */
+    size_t *order;     /**< indices into 'j' in output order, 'length' stands for the tag */
+} jser_order_t;
+
+typedef struct {
+    jser_order_t *orders; /**< one for each object table in a tree, NULL to find out how many are needed */
+    size_t length, used;
+    size_t *indices;      /**< storage for 'order' of each of them */
+    size_t ilength, iused;
+} jser_canonical_t; /**< attribute orders for canonical output, see 'jser_canonical_prepare' */
+
+typedef struct {
+    const char *indent;   /**< added for each level of nesting, for example "\t" or "  " */
+    const char *newline;  /**< "\n" or "\r\n" */
+    bool colon_space;     /**< put a space after the colon of each attribute */
+    bool compact_arrays;  /**< put arrays of numbers, booleans and strings on one line */
+    const char *slab;     /**< a newline followed by indentation, set by 'jser_format_prepare' */
+    size_t nlen, ilen, levels; /**< lengths of the newline and indent, and levels held in 'slab' */
+} jser_format_t; /**< how to lay out pretty printed output */
+
+typedef struct {
+    jser_buffer_t *b;              /**< output, or a staging area for 'sink' */
+    const jser_sink_t *sink;       /**< where output goes as 'b' fills up, may be NULL */
+    const jser_canonical_t *canon; /**< attribute orders to write records canonically, may be NULL */
+    size_t *offsets;               /**< where each record starts in the output, may be NULL */
+    size_t length, used;           /**< elements in 'offsets', records written so far */
+    size_t flushed;                /**< bytes passed on to 'sink' so far */
+    bool prefixed;                 /**< records have a 4 byte big endian length before them, instead of a newline after */
+} jser_batch_t; /**< many records written back to back, see 'jser_batch_append' */
+
+typedef struct {
+    const jser_t *e;          /**< value this slot is for, NULL if free */
+    size_t offset, capacity;  /**< where its text is kept in 'text', and the most that can be kept */
+    size_t used;              /**< length of the text last bound */
+    int type;                 /**< token type of the text last bound */
+    bool bound;               /**< the text is set */
+    size_t index;             /**< its bit in 'changed' */
+} jser_slot_t;
+
+typedef struct {
+    jser_slot_t *slots;     /**< hash table, its length a power of two greater than 'used'; NULL to count values */
+    size_t length, used;
+    char *text;             /**< the text of each value last bound... */
+    size_t tlength, tused;  /**< ...its length and the bytes needed, which are counted with the values */
+    unsigned char *changed; /**< one bit per value, set when a value is changed by 'jser_deserialize_delta' */
+    size_t clength;         /**< bytes in 'changed' */
+} jser_delta_t; /**< the text of the values last bound, see 'jser_delta_prepare'; a value is only converted
+                   and written when its text differs, storage altered by anything else is not restored */
+
+typedef struct {
+    const jser_t *j;   /**< object table, or union variant, the order is for... */
+    size_t length;     /**< ...and its length */
+    size_t *order;     /**< indices into 'j' in the order keys are compared with them */
+    size_t *sum;       /**< for each attribute, the sum of the positions its key arrived at... */
+    size_t *seen;      /**< ...and the number of times it arrived */
+} jser_probe_t;
+
+typedef struct {
+    jser_probe_t *tables; /**< one for each object table in a tree, sorted by table; NULL to find out how many are needed */
+    size_t length, used;
+    size_t *indices;      /**< storage for 'order', 'sum' and 'seen' of each of them, three for each attribute */
+    size_t ilength, iused;
+    bool learn;           /**< note where each key arrives, for 'jser_lookup_learn' */
+    unsigned long lookups, probes; /**< keys looked up, and attributes compared with them, since the last 'jser_lookup_learn' */
+} jser_lookup_t; /**< the order attributes are looked up in, see 'jser_lookup_prepare' */
+
+typedef struct { /**< binder state for one level of nesting, see 'jser_deserialize_with_stack' */
+    jser_t *e;              /**< object, array, union or stream being bound */
+    const jsmntok_t *token; /**< its token */
+    jser_t *j;              /**< attributes of an object, or of the variant selected */
+    size_t jlen;
+    size_t k;               /**< elements bound so far, or the variant selected */
+    jser_probe_t *probe;    /**< lookup order for 'j', may be NULL */
+    size_t keys, next;      /**< keys looked up so far, and where in the order to start the next lookup */
+} jser_frame_t;
+
+typedef struct {
+    const jser_t *e;   /**< object, array, union or stream being written, NULL for the root */
+    const jser_t *j;   /**< its attributes or elements */
+    size_t jlen;
+    size_t k;          /**< next attribute, element or value to write */
+    size_t n;          /**< items written so far, all but the first have a comma before them */
+} jser_level_t; /**< encoder state for one level of nesting */
+
+typedef struct {
+    const unsigned char *p;
+    size_t n;
+    int mode;          /**< copied, escaped or base64 encoded */
+} jser_run_t; /**< output the encoder has yet to write */
+
+typedef struct { /**< resumable serializer, see 'jser_encoder_init'; the fields are private */
+    jser_level_t *stack;
+    size_t depth, top;
+    jser_run_t runs[16];
+    size_t head, count;
+    unsigned char carry[4]; /**< an escape or base64 group split over two buffers */
+    size_t clen, cpos;
+    char number[65];
+    size_t written;    /**< bytes output so far */
+    int error;
+} jser_encoder_t;
+
+typedef struct {
+    size_t bytes;  /**< of input */
+    size_t tokens; /**< produced by the tokenizer, counting those of stream elements handed back */
+    size_t string; /**< length of a string or attribute, as it is in the input */
+    size_t array;  /**< elements of an array or stream, or attributes of an object */
+    size_t depth;  /**< nesting of objects and arrays */
+} jser_limits_t; /**< what untrusted input may use, checked as it is deserialized; 0 is no limit */
+
+typedef struct { /**< resumable deserializer, see 'jser_decoder_init'; the fields are private */
+    jser_t *j;
+    size_t jlen;
+    jsmntok_t *t;
+    size_t tokens;
+    jser_buffer_t *window;
+    jser_frame_t *stack;
+    size_t depth;
+    jsmn_parser jp;
+    const jser_limits_t *limits;
+    jsmnint_t start;       /**< streaming state, kept between calls */
+    jser_stream_t *stream;
+    size_t index;
+    size_t read;           /**< bytes input so far... */
+    size_t pending;        /**< ...of which these are still to be tokenized */
+    size_t scanned;        /**< bytes tokenized so far */
+    jsmnint_t chunk;       /**< offset of a chunked value being handed on, -1 if none... */
+    size_t drained;        /**< ...and the bytes of it handed on so far */
+    jser_t root;           /**< binder state, once the document has been tokenized */
+    jser_t *next;
+    size_t pos, top;
+    jsmnint_t skip;        /**< end of a value being skipped, 0 if none */
+    bool binding;
+    bool spill;            /**< bind beyond 'depth' frames, on the C stack */
+    int result;            /**< 1 until the document is complete */
+} jser_decoder_t;
+
+typedef struct {
+    size_t bytes;  /**< output written, or input tokenized, so far */
+    size_t tokens; /**< tokens bound so far... */
+    size_t total;  /**< ...out of this many, 0 until all of the input has been tokenized */
+} jser_progress_t; /**< how far 'jser_encode_step' or 'jser_decoder_step' has got */
+
 /* all function return 0 on success, negative on failure */
 int jser_base64_decode(const unsigned char *ibuf, const size_t ilen, unsigned char *obuf, size_t *olen);
 int jser_base64_encode(const unsigned char *ibuf, size_t ilen, unsigned char *obuf, size_t *olen);
 int jser_serialize_to_buffer(const jser_t *j, size_t jlen, int pretty, jser_buffer_t *b);
 int jser_serialize_to_asciiz(const jser_t *j, size_t jlen, int pretty, char *asciiz, size_t length); /* NUL terminates 'asciiz' on success */
+int jser_serialize_to_sink(const jser_t *j, size_t jlen, int pretty, jser_buffer_t *b, const jser_sink_t *sink); /* 'b' is a staging buffer, or grown to fit */
+int jser_serialize_with_digest(const jser_t *j, size_t jlen, int pretty, jser_buffer_t *b, const jser_sink_t *sink, unsigned long *crc); /* 'sink' may be NULL, 'crc' is of the output */
+int jser_canonical_prepare(const jser_t *j, size_t jlen, jser_canonical_t *c); /* once per tree, 'c->orders' == NULL only sizes it */
+int jser_serialize_canonical(const jser_t *j, size_t jlen, const jser_canonical_t *c, jser_buffer_t *b, const jser_sink_t *sink); /* 'sink' may be NULL */
+int jser_batch_append(jser_batch_t *w, const jser_t *j, size_t jlen);
+int jser_batch_finish(jser_batch_t *w); /* flushes what is left to the sink */
+int jser_format_prepare(jser_format_t *f, char *slab, size_t length); /* 'slab' is used to hold the indentation */
+int jser_serialize_formatted(const jser_t *j, size_t jlen, const jser_format_t *f, jser_buffer_t *b, const jser_sink_t *sink); /* 'sink' may be NULL */
 int jser_serialized_length(const jser_t *j, size_t jlen, int pretty, size_t *sz); /* excludes NUL terminator */
 int jser_deserialize_from_buffer(jser_t *j, size_t jlen, jsmntok_t *t, size_t tokens, jser_buffer_t *b);
 int jser_deserialize_from_asciiz(jser_t *j, size_t jlen, jsmntok_t *t, size_t tokens, const char *asciiz);
+int jser_deserialize_with_digest(jser_t *j, size_t jlen, jsmntok_t *t, size_t tokens, jser_buffer_t *b, unsigned long *crc); /* 'crc' is of all of the input */
+int jser_deserialize_from_segments(jser_t *j, size_t jlen, jsmntok_t *t, size_t tokens, const jser_buffer_t *segments, size_t count, jser_buffer_t *bounce); /* 'bounce' holds values split between segments */
+int jser_deserialize_with_stack(jser_t *j, size_t jlen, jsmntok_t *t, size_t tokens, jser_buffer_t *b, jser_frame_t *stack, size_t depth); /* 'depth' frames limit nesting, a NULL 'stack' does not */
+int jser_deserialize_with_limits(jser_t *j, size_t jlen, jsmntok_t *t, size_t tokens, jser_buffer_t *b, const jser_limits_t *limits);
+int jser_deserialize_from_source(jser_t *j, size_t jlen, jsmntok_t *t, size_t tokens, const jser_source_t *source, jser_buffer_t *window); /* input is read into 'window' as it is needed */
+int jser_encoder_init(jser_encoder_t *w, const jser_t *j, size_t jlen, jser_level_t *stack, size_t depth); /* 'depth' levels limit nesting */
+int jser_encode(jser_encoder_t *w, jser_buffer_t *b); /* appends to 'b'; 1 = 'b' is full, 0 = done, <0 = failure */
+int jser_encode_step(jser_encoder_t *w, jser_buffer_t *b, size_t budget, jser_progress_t *progress); /* writes at most 'budget' bytes; 'progress' may be NULL */
+int jser_decoder_init(jser_decoder_t *d, jser_t *j, size_t jlen, jsmntok_t *t, size_t tokens, jser_buffer_t *window, jser_frame_t *stack, size_t depth);
+int jser_decoder_limit(jser_decoder_t *d, const jser_limits_t *limits); /* before any input is pushed */
+int jser_decoder_space(jser_decoder_t *d, unsigned char **buf, size_t *length); /* where to put the next input */
+int jser_decoder_push(jser_decoder_t *d, size_t n); /* 'n' bytes were put there, 0 = end of input; 1 = want more, 0 = done, <0 = failure */
+int jser_decoder_step(jser_decoder_t *d, size_t n, size_t budget, jser_progress_t *progress); /* like push, but 'n' = 0 is no new input; 2 = 'budget' used up */
+int jser_delta_prepare(const jser_t *j, size_t jlen, jser_delta_t *d); /* once per tree, 'd->slots' == NULL only counts values and text */
+int jser_deserialize_delta(jser_t *j, size_t jlen, jsmntok_t *t, size_t tokens, jser_buffer_t *b, jser_delta_t *d); /* only converts values that changed */
+int jser_delta_changed(const jser_delta_t *d, const jser_t *e); /* 1 = changed by the last call, 0 = not, <0 = not a value */
+int jser_lookup_prepare(const jser_t *j, size_t jlen, jser_lookup_t *l); /* once per tree, 'l->tables' == NULL only sizes it */
+int jser_deserialize_adaptive(jser_t *j, size_t jlen, jsmntok_t *t, size_t tokens, jser_buffer_t *b, jser_lookup_t *l); /* keys are looked up in the orders in 'l' */
+int jser_lookup_learn(jser_lookup_t *l); /* reorders each table by where its keys have arrived */
+int jser_lz_encoder(jser_lz_t *lz, const jser_sink_t *next, jser_sink_t *stage);       /* 'stage' compresses into 'next' */
+int jser_lz_decoder(jser_lz_t *lz, const jser_source_t *next, jser_source_t *stage);   /* 'stage' decompresses from 'next' */
+#if defined(JSER_ENABLE_ZLIB) && JSER_ENABLE_ZLIB
+int jser_zlib_encoder(jser_zlib_t *zs, int level, const jser_sink_t *next, jser_sink_t *stage);
+int jser_zlib_decoder(jser_zlib_t *zs, const jser_source_t *next, jser_source_t *stage);
+int jser_zlib_end(jser_zlib_t *zs); /* frees memory held by zlib */
+#endif
+int jser_validate(const jser_buffer_t *b); /* is 'b' a single valid JSON value? */
+int jser_minify(const jser_buffer_t *in, jser_buffer_t *out);   /* 'out' may be 'in' */
+int jser_prettify(const jser_buffer_t *in, jser_buffer_t *out); /* 'out' must not overlap 'in' */
 int jser_retrieve_node(const jser_t *j, size_t jlen, jser_t **const found, const char *path);  /* 1 = found, 0 = not found, <0 = failure */
 int jser_walk_tree(const jser_t *j, size_t jlen, int (*fn)(const jser_t *e, void *param), void *param);
 int jser_copy(const jser_t *src, const size_t slen, jser_t *pool, size_t *plen);
 int jser_node_count(const jser_t *j, size_t *jlen);
+int jser_crc32c(const unsigned char *buf, size_t length, unsigned long *crc); /* updates a running CRC32C, which starts at zero */
+int jser_hash(const unsigned char *buf, size_t length, unsigned long *hash); /* 32-bit FNV-1a */
+int jser_fingerprint(const jser_t *j, size_t jlen, unsigned long long *fp); /* hash of the schema and ABI */
+int jser_snapshot_save(const jser_t *j, size_t jlen, unsigned long hash, jser_buffer_t *image); /* 'image->buf' == NULL computes the size */
+int jser_snapshot_load(jser_t *j, size_t jlen, unsigned long hash, const jser_buffer_t *image); /* 1 = loaded, 0 = stale, <0 = failure */
+int jser_force_portable(int on); /* 1 = only use the portable kernels, 0 = the best the CPU has */
 int jser_version(unsigned long *version); /* version in x.y.z format, LSB = z, MSB = options */
 int jser_tests(void);
 
@@ -88,6 +356,11 @@ int jser_tests(void);
 #define MK_BUF(X)    { .attr = (#X), .type = JSER_BUFFER_E, .data.buf    = &(X), }
 #define MK_ARRAY(X)  { .attr = (#X), .type = JSER_ARRAY_E,  .data.array  =  (X), .length = ELEMENTS((X)), .used = ELEMENTS((X)), }
 #define MK_OBJECT(X) { .attr = (#X), .type = JSER_OBJECT_E, .data.jser   =  (X), .length = ELEMENTS((X)), .used = ELEMENTS((X)), }
+#define MK_UNION(X)  { .attr = (#X), .type = JSER_UNION_E,  .data.un     = &(X), }
+#define MK_STREAM(X) { .attr = (#X), .type = JSER_STREAM_E, .data.stream = &(X), }
+#define MK_CHUNKED(X) { .attr = (#X), .type = JSER_CHUNKED_E, .data.chunked = &(X), }
+
+#define MK_VARIANT(TAG, X) { .tag = (TAG), .jser = (X), .length = ELEMENTS((X)), }
 
 #define MK_NAMED_LONG(X, NAME)   { .attr = (NAME), .type = JSER_LONG_E,   .data.ld     = &(X), }
 #define MK_NAMED_ULONG(X, NAME)  { .attr = (NAME), .type = JSER_ULONG_E,  .data.lu     = &(X), }
@@ -96,8 +369,20 @@ int jser_tests(void);
 #define MK_NAMED_BUF(X, NAME)    { .attr = (NAME), .type = JSER_BUFFER_E, .data.buf    = &(X), }
 #define MK_NAMED_ARRAY(X, NAME)  { .attr = (NAME), .type = JSER_ARRAY_E,  .data.array  =  (X), .length = ELEMENTS((X)), .used = ELEMENTS((X)), }
 #define MK_NAMED_OBJECT(X, NAME) { .attr = (NAME), .type = JSER_OBJECT_E, .data.jser   =  (X), .length = ELEMENTS((X)), .used = ELEMENTS((X)), }
+#define MK_NAMED_UNION(X, NAME)  { .attr = (NAME), .type = JSER_UNION_E,  .data.un     = &(X), }
+#define MK_NAMED_STREAM(X, NAME) { .attr = (NAME), .type = JSER_STREAM_E, .data.stream = &(X), }
+#define MK_NAMED_CHUNKED(X, NAME) { .attr = (NAME), .type = JSER_CHUNKED_E, .data.chunked = &(X), }
 
 #ifdef __cplusplus
 }
 #endif
 #endif
+
+/* Defining JSER_IMPLEMENTATION before including this header in one file
+ * compiles the library into that file, so calls into it can be inlined and
+ * constant tables folded; 'jser.c' and 'jsmn.h' must be alongside, or use
+ * the single file made by 'make jser_single.h'. */
+#if defined(JSER_IMPLEMENTATION) && !defined(JSER_IMPLEMENTED)
+#define JSER_IMPLEMENTED
+#include "jser.c"
+#endif
@@ -0,0 +1,858 @@
+/* Author:  Richard James Howe
+ * Project: JSON Serialization Routines
+ * License: MIT (for 'jsmn.h'), Proprietary for everything else.
+ *
+ * C++17 interface to 'jser.h'. A structure is described once, with
+ * 'JSER_DESCRIBE', and from that description come both 'jser_t' tables for
+ * the C functions and serializers and deserializers specialized for that
+ * structure at compile time, which need no tables at all; the attributes,
+ * types and member offsets are constants and there is no dispatch on the
+ * type of each value as the C library does.
+ *
+ *	struct point { jser_long_t x, y; bool on; char name[16]; };
+ *	JSER_DESCRIBE(point, x, y, on, name)
+ *
+ *	point p = { 1, 2, true, "origin" };
+ *	jserpp::serialize(p, &b);    // {"x":1,"y":2,"on":true,"name":"origin"}
+ *	jserpp::deserialize(p, &b);
+ *
+ * Members may be 'jser_long_t', 'jser_ulong_t', 'bool', 'char[N]' (an ASCIIZ
+ * string), 'jser_buffer_t', another described structure, or a fixed size
+ * array of any of these but 'char[N]'. The output and the errors returned
+ * are the same as the C library gives for the equivalent table, including
+ * its leniency about commas and colons, except that a number too large for
+ * a 'jser_long_t' is an error instead of wrapping, values are skipped only
+ * to a depth of 64, and two things its tokenizer lets through are errors:
+ * an attribute with no value before the end of its object (which would take
+ * the next value after it) and a stray closing bracket after the document.
+ *
+ * Compiled as C++20 it also has coroutines that stream through the
+ * resumable encoder and decoder, 'async_serialize' and 'async_deserialize'. */
+#ifndef JSER_HPP
+#define JSER_HPP
+
+#include "jser.h"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#include <coroutine>
+#include <exception>
+#define JSER_COROUTINES (1) /* C++20, see 'async_serialize' */
+#endif
+#endif
+
+#ifndef JSER_ENABLE_ESCAPE
+#define JSER_ENABLE_ESCAPE (1) /* must match the library */
+#endif
+
+namespace jserpp {
+
+/* the same values as returned by the C library */
+constexpr int ok           =   0;
+constexpr int err_depth    =  -2;
+constexpr int err_base64   =  -3;
+constexpr int err_space    =  -4;
+constexpr int err_parse    =  -6;
+constexpr int err_more     =  -7;
+constexpr int err_type     =  -8;
+constexpr int err_number   =  -9;
+constexpr int err_config   = -11;
+constexpr int err_length   = -12;
+constexpr int err_callback = -13;
+constexpr int err_limit    = -14;
+
+template <typename T>
+struct describe; /* specialized by 'JSER_DESCRIBE' */
+
+template <typename S, typename M>
+struct field {
+    std::string_view name; /**< attribute */
+    M S::*member;
+};
+
+template <typename S, typename M>
+constexpr field<S, M> make_field(const char *name, M S::*member)
+{
+    return field<S, M>{ name, member };
+}
+
+template <typename T, typename = void>
+struct is_described : std::false_type {};
+
+template <typename T>
+struct is_described<T, std::void_t<decltype(describe<T>::fields)>> : std::true_type {};
+
+template <typename T>
+struct is_list : std::false_type {}; /* arrays, but not strings */
+
+template <typename T, std::size_t N>
+struct is_list<T[N]> : std::bool_constant<!std::is_same_v<T, char>> {};
+
+template <typename T>
+constexpr bool is_value_v =
+    std::is_same_v<T, jser_long_t> || std::is_same_v<T, jser_ulong_t> || std::is_same_v<T, bool> ||
+    std::is_same_v<T, jser_buffer_t> || (std::is_array_v<T> && std::is_same_v<std::remove_extent_t<T>, char>);
+
+template <typename T>
+constexpr bool is_supported_v = is_value_v<T> || is_described<T>::value ||
+    (is_list<T>::value && (is_value_v<std::remove_extent_t<T>> || is_described<std::remove_extent_t<T>>::value) &&
+     !std::is_array_v<std::remove_extent_t<T>>);
+
+/* ~~~ Tables for the C library ~~~ */
+
+template <typename T>
+constexpr std::size_t fields_v = std::tuple_size_v<std::decay_t<decltype(describe<T>::fields)>>;
+
+/* Number of 'jser_t' nodes a value of type 'T' needs, besides its own */
+template <typename T>
+constexpr std::size_t below()
+{
+    if constexpr (is_described<T>::value) {
+        return std::apply([](auto... f) { return (fields_v<T> + ... + below<std::remove_reference_t<decltype(std::declval<T&>().*(f.member))>>()); }, describe<T>::fields);
+    } else if constexpr (is_list<T>::value) {
+        return std::extent_v<T> * (1 + below<std::remove_extent_t<T>>());
+    } else {
+        return 0;
+    }
+}
+
+template <typename T>
+constexpr std::size_t nodes_v = below<T>(); /* every node of the table for 'T' */
+
+template <typename M>
+void node(jser_t &e, const char *attr, M &m, jser_t *&spare);
+
+template <typename T>
+void nodes(T &v, jser_t *table, jser_t *&spare)
+{
+    std::size_t i = 0;
+    std::apply([&](auto... f) { ((node(table[i++], f.name.data(), v.*(f.member), spare)), ...); }, describe<T>::fields);
+}
+
+template <typename M>
+void node(jser_t &e, const char *attr, M &m, jser_t *&spare)
+{
+    static_assert(is_supported_v<M>, "jser: member type not supported");
+    e = jser_t{};
+    e.attr = attr;
+    if constexpr (std::is_same_v<M, jser_long_t>) {
+        e.type = JSER_LONG_E;
+        e.data.ld = &m;
+    } else if constexpr (std::is_same_v<M, jser_ulong_t>) {
+        e.type = JSER_ULONG_E;
+        e.data.lu = &m;
+    } else if constexpr (std::is_same_v<M, bool>) {
+        e.type = JSER_BOOL_E;
+        e.data.b = &m;
+    } else if constexpr (std::is_same_v<M, jser_buffer_t>) {
+        e.type = JSER_BUFFER_E;
+        e.data.buf = &m;
+    } else if constexpr (is_described<M>::value) {
+        e.type = JSER_OBJECT_E;
+        e.data.jser = spare;
+        e.length = e.used = fields_v<M>;
+        spare += fields_v<M>;
+        nodes(m, e.data.jser, spare);
+    } else if constexpr (is_list<M>::value) {
+        e.type = JSER_ARRAY_E;
+        e.data.array = spare;
+        e.length = e.used = std::extent_v<M>;
+        spare += std::extent_v<M>;
+        for (std::size_t i = 0; i < std::extent_v<M>; i++) {
+            node(e.data.array[i], nullptr, m[i], spare);
+        }
+    } else {
+        e.type = JSER_ASCIIZ_E;
+        e.data.asciiz = m;
+        e.length = std::extent_v<M>;
+    }
+}
+
+/* The 'jser_t' table for a described structure, for the functions of the
+ * C library that have no specialized equivalent. It points into 'v', so it
+ * must not outlive it. */
+template <typename T>
+struct table {
+    static_assert(is_described<T>::value, "jser: type not described");
+    jser_t nodes[nodes_v<T>]; /**< 'size()' for the root object, then those below them */
+
+    explicit table(T &v)
+    {
+        jser_t *spare = &nodes[fields_v<T>];
+        jserpp::nodes(v, nodes, spare);
+    }
+    jser_t *data() { return nodes; }
+    static constexpr std::size_t size() { return fields_v<T>; }
+};
+
+/* ~~~ Serialization ~~~ */
+
+class writer {
+    jser_buffer_t *b;
+public:
+    explicit writer(jser_buffer_t *out) : b(out) {}
+
+    bool put(char ch)
+    {
+        if (b->used >= b->length) {
+            return false;
+        }
+        b->buf[b->used++] = static_cast<unsigned char>(ch);
+        return true;
+    }
+
+    bool put(const char *s, std::size_t n)
+    {
+        if ((b->length - b->used) < n) {
+            return false;
+        }
+        std::memcpy(&b->buf[b->used], s, n);
+        b->used += n;
+        return true;
+    }
+
+    bool key(std::string_view name)
+    {
+        return put('"') && put(name.data(), name.size()) && put("\":", 2);
+    }
+
+    bool number(std::uint64_t u, bool negative)
+    {
+        char s[24];
+        std::size_t i = sizeof s;
+        do {
+            s[--i] = static_cast<char>('0' + (u % 10));
+            u /= 10;
+        } while (u);
+        if (negative) {
+            s[--i] = '-';
+        }
+        return put(&s[i], sizeof s - i);
+    }
+
+    bool string(const char *s, std::size_t length)
+    {
+        if (!put('"')) {
+            return false;
+        }
+        std::size_t i = 0, run = 0; /* plain characters are copied a run at a time */
+        for (; i < length && s[i]; i++) {
+            char esc = 0;
+            switch (s[i]) {
+            case '\b': esc = 'b'; break;
+            case '\f': esc = 'f'; break;
+            case '\n': esc = 'n'; break;
+            case '\r': esc = 'r'; break;
+            case '\t': esc = 't'; break;
+            case '\\': case '"': esc = s[i]; break;
+            default: break;
+            }
+            if (JSER_ENABLE_ESCAPE && esc) {
+                if (!(put(&s[run], i - run) && put('\\') && put(esc))) {
+                    return false;
+                }
+                run = i + 1;
+            }
+        }
+        return put(&s[run], i - run) && put('"');
+    }
+
+    bool base64(const jser_buffer_t &v)
+    {
+        if (!put('"')) {
+            return false;
+        }
+        std::size_t n = b->length - b->used;
+        if (jser_base64_encode(v.buf, v.used, &b->buf[b->used], &n) < 0) {
+            return false;
+        }
+        b->used += n;
+        return put('"');
+    }
+};
+
+template <typename M>
+bool write(writer &w, const M &m);
+
+template <typename T>
+bool write_object(writer &w, const T &v)
+{
+    bool first = true;
+    const bool r = w.put('{') && std::apply([&](auto... f) {
+        return ((((first ? (first = false, true) : w.put(',')) && w.key(f.name) && write(w, v.*(f.member)))) && ...);
+    }, describe<T>::fields);
+    return r && w.put('}');
+}
+
+template <typename M>
+bool write(writer &w, const M &m)
+{
+    static_assert(is_supported_v<M>, "jser: member type not supported");
+    if constexpr (std::is_same_v<M, jser_long_t>) {
+        return w.number(m < 0 ? 0 - static_cast<std::uint64_t>(m) : static_cast<std::uint64_t>(m), m < 0);
+    } else if constexpr (std::is_same_v<M, jser_ulong_t>) {
+        return w.number(m, false);
+    } else if constexpr (std::is_same_v<M, bool>) {
+        return m ? w.put("true", 4) : w.put("false", 5);
+    } else if constexpr (std::is_same_v<M, jser_buffer_t>) {
+        return w.base64(m);
+    } else if constexpr (is_described<M>::value) {
+        return write_object(w, m);
+    } else if constexpr (is_list<M>::value) {
+        if (!w.put('[')) {
+            return false;
+        }
+        for (std::size_t i = 0; i < std::extent_v<M>; i++) {
+            if ((i && !w.put(',')) || !write(w, m[i])) {
+                return false;
+            }
+        }
+        return w.put(']');
+    } else {
+        return w.string(m, std::extent_v<M>);
+    }
+}
+
+/* Like 'jser_serialize_to_buffer' without pretty printing, appending to 'b' */
+template <typename T>
+int serialize(const T &v, jser_buffer_t *b)
+{
+    static_assert(is_described<T>::value, "jser: type not described");
+    writer w(b);
+    const std::size_t used = b->used;
+    if (!write_object(w, v)) {
+        b->used = used;
+        return err_space;
+    }
+    return ok;
+}
+
+/* ~~~ Deserialization ~~~ */
+
+class reader {
+    const char *p, *end;
+public:
+    int error = ok;
+
+    reader(const char *in, std::size_t length) : p(in), end(in + length) {}
+
+    bool fail(int e)
+    {
+        if (error == ok) {
+            error = e;
+        }
+        return false;
+    }
+
+    /* Input ends at its length or a NUL, as it does for the tokenizer */
+    bool over() const
+    {
+        return p >= end || *p == '\0';
+    }
+
+    void space()
+    {
+        for (; p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'); p++)
+            ;
+    }
+
+    /* Commas and colons are passed over like white space, the tokenizer of
+     * the C library is not strict about them and only the order of the
+     * values within an object or array is seen when binding */
+    void gap()
+    {
+        for (; p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r' || *p == ',' || *p == ':'); p++)
+            ;
+    }
+
+    bool expect(char ch)
+    {
+        space();
+        if (over()) {
+            return fail(err_more);
+        }
+        return *p++ == ch || fail(err_parse);
+    }
+
+    bool peek(char ch)
+    {
+        gap();
+        if (!over() && *p == ch) {
+            p++;
+            return true;
+        }
+        return false;
+    }
+
+    bool at_end()
+    {
+        gap();
+        return over();
+    }
+
+    /* The rest of a string from the escape at 'p', checking each escape as
+     * the tokenizer does, kept out of the way of strings without them */
+    bool escapes()
+    {
+        for (; p < end && *p != '"' && *p != '\0'; p++) {
+            if (*p == '\\' && (p + 1) < end && !escape()) {
+                return false;
+            }
+        }
+        p--; /* left on the last character scanned, like the caller's loop */
+        return true;
+    }
+
+    /* Check the escape at 'p', leaving 'p' on its last character */
+    bool escape()
+    {
+        switch (*++p) {
+        case '"': case '/': case '\\': case 'b': case 'f': case 'r': case 'n': case 't':
+            return true;
+        case 'u':
+            for (int i = 0; i < 4 && (p + 1) < end && p[1] != '\0'; i++, p++) {
+                const char h = p[1];
+                if (!((h >= '0' && h <= '9') || (h >= 'A' && h <= 'F') || (h >= 'a' && h <= 'f'))) {
+                    return fail(err_parse);
+                }
+            }
+            return true;
+        default:
+            return fail(err_parse);
+        }
+    }
+
+    /* The contents of a string, escapes are checked but left as they are */
+    bool string(std::string_view &s)
+    {
+        if (!expect('"')) {
+            return false;
+        }
+        const char *start = p;
+        for (; p < end && *p != '"' && *p != '\0'; p++) {
+            if (*p == '\\' && !escapes()) {
+                break;
+            }
+        }
+        if (error != ok) {
+            return false;
+        }
+        if (over()) {
+            return fail(err_more);
+        }
+        s = std::string_view(start, static_cast<std::size_t>(p++ - start));
+        return true;
+    }
+
+    /* The text of anything unquoted, up to white space or a separator */
+    bool primitive(std::string_view &s)
+    {
+        space();
+        const char *start = p;
+        for (; !over() && *p != ',' && *p != '}' && *p != ']' && *p != ':' && *p != ' ' && *p != '\t' && *p != '\n' && *p != '\r'; p++) {
+            if (static_cast<unsigned char>(*p) < 32 || static_cast<unsigned char>(*p) >= 127) {
+                return fail(err_parse);
+            }
+        }
+        if (p == start) {
+            return fail(over() ? err_more : err_parse);
+        }
+        s = std::string_view(start, static_cast<std::size_t>(p - start));
+        return true;
+    }
+
+    char next()
+    {
+        gap();
+        return over() ? '\0' : *p;
+    }
+
+    /* Skip a value nothing is bound to, nested up to 64 levels; the
+     * members of an object are skipped as values whether keys or not */
+    bool skip()
+    {
+        std::uint64_t objects = 0; /* a bit for each level, set for objects */
+        unsigned depth = 0;
+        for (;;) {
+            std::string_view s;
+            const char ch = next();
+            if (ch == '{' || ch == '[') {
+                p++;
+                if (depth == 64) {
+                    return fail(err_depth);
+                }
+                objects = (objects << 1) | (ch == '{');
+                depth++;
+                continue;
+            }
+            if (ch == '}' || ch == ']') {
+                if (depth == 0 || (ch == '}') != (objects & 1)) { /* unmatched */
+                    return fail(err_parse);
+                }
+                p++;
+                objects >>= 1;
+                depth--;
+            } else if (ch == '\0') {
+                return fail(err_more);
+            } else if (!(ch == '"' ? string(s) : primitive(s))) {
+                return false;
+            }
+            if (depth == 0) {
+                return true;
+            }
+        }
+    }
+
+    /* Check the rest of the input as the tokenizer would, whatever the
+     * values are bound to */
+    bool rest()
+    {
+        while (!at_end()) {
+            if (!skip()) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+template <typename M>
+bool read(reader &r, M &m);
+
+template <typename T>
+bool read_object(reader &r, T &v)
+{
+    if (!r.expect('{')) {
+        return false;
+    }
+    for (;;) {
+        if (r.peek('}')) {
+            return true;
+        }
+        std::string_view key;
+        const char ch = r.next();
+        if (ch != '"') { /* only strings can be attributes */
+            return r.fail(ch == '\0' ? err_more : err_parse);
+        }
+        if (!r.string(key)) {
+            return false;
+        }
+        const char after = r.next();
+        if (after == '}' || after == ']') { /* an attribute without a value */
+            return r.fail(err_length);
+        }
+        bool found = false, good = true;
+        std::apply([&](auto... f) {
+            ((!found && key == f.name ? (found = true, good = read(r, v.*(f.member))) : false), ...);
+        }, describe<T>::fields);
+        if (!(found ? good : r.skip())) {
+            return false;
+        }
+    }
+}
+
+/* Bind an unquoted value in the same way as the C library, by its first
+ * character */
+template <typename M>
+bool read_primitive(reader &r, M &m)
+{
+    std::string_view s;
+    if (!r.primitive(s)) {
+        return false;
+    }
+    switch (s[0]) {
+    case 'n': /* 'null' not supported */
+        return r.fail(err_type);
+    case 't':
+    case 'f':
+        if constexpr (std::is_same_v<M, bool>) {
+            const std::string_view want = s[0] == 't' ? "true" : "false";
+            if (s.substr(0, want.size()) != want) {
+                return r.fail(err_type);
+            }
+            m = s[0] == 't';
+            return true;
+        }
+        return r.fail(err_type);
+    case '-': case '0': case '1': case '2': case '3': case '4': case '5': case '6': case '7': case '8': case '9':
+        break;
+    default:
+        return r.fail(err_parse);
+    }
+    if constexpr (std::is_same_v<M, jser_long_t> || std::is_same_v<M, jser_ulong_t>) {
+        const bool negative = s[0] == '-';
+        std::uint64_t u = 0;
+        if (s.size() == negative) {
+            return r.fail(err_number);
+        }
+        for (std::size_t i = negative; i < s.size(); i++) {
+            const unsigned d = static_cast<unsigned>(s[i] - '0');
+            if (d > 9 || u > (UINT64_MAX - d) / 10) {
+                return r.fail(err_number);
+            }
+            u = (u * 10) + d;
+        }
+        if constexpr (std::is_same_v<M, jser_ulong_t>) {
+            if (negative || u > std::numeric_limits<M>::max()) {
+                return r.fail(err_number);
+            }
+            m = static_cast<M>(u);
+        } else {
+            const std::uint64_t max = static_cast<std::uint64_t>(std::numeric_limits<M>::max());
+            if (u > max + negative) {
+                return r.fail(err_number);
+            }
+            m = negative ? static_cast<M>(0 - u) : static_cast<M>(u);
+        }
+        return true;
+    }
+    return r.fail(err_type);
+}
+
+template <typename M>
+bool read(reader &r, M &m)
+{
+    static_assert(is_supported_v<M>, "jser: member type not supported");
+    const char ch = r.next();
+    if (ch == '\0') {
+        return r.fail(err_more);
+    }
+    if constexpr (is_described<M>::value) {
+        if (ch == '{') {
+            return read_object(r, m);
+        }
+    } else if constexpr (is_list<M>::value) {
+        if (ch == '[') {
+            r.expect('[');
+            for (std::size_t i = 0;; i++) {
+                if (r.peek(']')) {
+                    return true;
+                }
+                if (r.at_end()) {
+                    return r.fail(err_more);
+                }
+                if (i >= std::extent_v<M>) {
+                    return r.fail(err_space);
+                }
+                if (!read(r, m[i])) {
+                    return false;
+                }
+            }
+        }
+    } else if constexpr (std::is_same_v<M, jser_buffer_t> || std::is_array_v<M>) {
+        if (ch == '"') {
+            std::string_view s;
+            if (!r.string(s)) {
+                return false;
+            }
+            if constexpr (std::is_same_v<M, jser_buffer_t>) {
+                std::size_t n = m.length;
+                m.used = 0;
+                if (jser_base64_decode(reinterpret_cast<const unsigned char *>(s.data()), s.size(), m.buf, &n) < 0) {
+                    return r.fail(err_base64);
+                }
+                m.used = n;
+            } else {
+                if (s.size() >= std::extent_v<M>) {
+                    return r.fail(err_type);
+                }
+                std::memcpy(m, s.data(), s.size());
+                m[s.size()] = '\0';
+            }
+            return true;
+        }
+    }
+    if (ch == '{' || ch == '[' || ch == '"') {
+        return r.fail(err_type);
+    }
+    return read_primitive(r, m);
+}
+
+/* Like 'jser_deserialize_from_buffer', but needing no tokens. The C library
+ * tokenizes all of the input before binding any of it, so when binding fails
+ * the rest is checked in case the tokenizer would have failed first. */
+template <typename T>
+int deserialize(T &v, const jser_buffer_t *b)
+{
+    static_assert(is_described<T>::value, "jser: type not described");
+    const char *in = reinterpret_cast<const char *>(b->buf);
+    reader r(in, b->used);
+    if (r.at_end()) {
+        return err_more;
+    }
+    if (r.next() == '{' && read_object(r, v)) {
+        return r.rest() ? ok : r.error;
+    }
+    const int e = r.error != ok ? r.error : err_parse;
+    reader check(in, b->used);
+    return check.rest() ? e : check.error;
+}
+
+/* ~~~ Coroutines ~~~ */
+
+#ifdef JSER_COROUTINES
+
+/* These drive the resumable encoder and decoder of the C library from a
+ * coroutine, which suspends whenever output has to be drained or input has
+ * to be waited for, so each connection of a server can stream through its
+ * own small buffers without a thread for each. The buffers belong to the
+ * caller and nothing is allocated but the coroutine frames. */
+
+/* A coroutine returning a 'T', which does not start until it is awaited (or
+ * 'start' is called) and resumes whatever awaited it when it finishes */
+template <typename T>
+class task {
+public:
+    struct promise_type {
+        T value{};
+        std::coroutine_handle<> next = std::noop_coroutine();
+
+        task get_return_object() noexcept { return task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        auto final_suspend() noexcept
+        {
+            struct resume_next {
+                bool await_ready() noexcept { return false; }
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept { return h.promise().next; }
+                void await_resume() noexcept {}
+            };
+            return resume_next{};
+        }
+        void return_value(T v) noexcept { value = v; }
+        void unhandled_exception() noexcept { std::terminate(); }
+    };
+
+    task(task &&o) noexcept : h(std::exchange(o.h, {})) {}
+    task(const task &) = delete;
+    task &operator=(const task &) = delete;
+    ~task()
+    {
+        if (h) {
+            h.destroy();
+        }
+    }
+
+    bool await_ready() const noexcept { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) noexcept
+    {
+        h.promise().next = awaiter;
+        return h;
+    }
+    T await_resume() noexcept { return h.promise().value; }
+
+    void start() { h.resume(); } /* from outside of a coroutine, runs until it first suspends */
+    bool done() const noexcept { return h.done(); }
+    T result() const noexcept { return h.promise().value; }
+
+private:
+    explicit task(std::coroutine_handle<promise_type> h) noexcept : h(h) {}
+    std::coroutine_handle<promise_type> h;
+};
+
+/* Write the output of 'w' through 'b', awaiting 'drain(b)' each time it
+ * fills up and once more at the end; 'drain' takes what it can, usually all
+ * of it, and moves anything left over to the front of 'b'. */
+template <typename Drain>
+task<int> async_serialize(jser_encoder_t &w, jser_buffer_t &b, Drain drain)
+{
+    for (;;) {
+        const int r = jser_encode(&w, &b);
+        if (r < 0) {
+            co_return r;
+        }
+        if (b.used) {
+            co_await drain(b);
+        }
+        if (r == 0 && b.used == 0) {
+            co_return ok;
+        }
+        if (b.used == b.length) {
+            co_return err_callback; /* nothing was drained */
+        }
+    }
+}
+
+/* Feed input to 'd' as it arrives, awaiting 'fill(p, n)' each time it is
+ * wanted; 'fill' puts up to 'n' bytes at 'p' and gives back the number it
+ * put there, 0 at the end of the input. Finishes once the document is
+ * complete, which is usually before the end of the input. */
+template <typename Fill>
+task<int> async_deserialize(jser_decoder_t &d, Fill fill)
+{
+    for (;;) {
+        unsigned char *p = nullptr;
+        std::size_t n = 0;
+        if (const int r = jser_decoder_space(&d, &p, &n); r < 0) {
+            co_return r;
+        }
+        const std::size_t got = co_await fill(p, n);
+        if (got > n) {
+            co_return err_callback;
+        }
+        if (const int r = jser_decoder_push(&d, got); r <= 0) {
+            co_return r;
+        }
+    }
+}
+
+#endif
+
+/* ~~~ Describing structures ~~~ */
+
+#define JSER_PP_CAT(A, B) JSER_PP_CAT_(A, B)
+#define JSER_PP_CAT_(A, B) A ## B
+#define JSER_PP_COUNT(...) JSER_PP_COUNT_(__VA_ARGS__, 32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17, \
+        16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define JSER_PP_COUNT_(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16, _17, _18, _19, _20, \
+        _21, _22, _23, _24, _25, _26, _27, _28, _29, _30, _31, _32, N, ...) N
+#define JSER_PP_F(S, M) ::jserpp::make_field(#M, &S::M)
+#define JSER_PP_1(S, M)       JSER_PP_F(S, M)
+#define JSER_PP_2(S, M, ...)  JSER_PP_F(S, M), JSER_PP_1(S, __VA_ARGS__)
+#define JSER_PP_3(S, M, ...)  JSER_PP_F(S, M), JSER_PP_2(S, __VA_ARGS__)
+#define JSER_PP_4(S, M, ...)  JSER_PP_F(S, M), JSER_PP_3(S, __VA_ARGS__)
+#define JSER_PP_5(S, M, ...)  JSER_PP_F(S, M), JSER_PP_4(S, __VA_ARGS__)
+#define JSER_PP_6(S, M, ...)  JSER_PP_F(S, M), JSER_PP_5(S, __VA_ARGS__)
+#define JSER_PP_7(S, M, ...)  JSER_PP_F(S, M), JSER_PP_6(S, __VA_ARGS__)
+#define JSER_PP_8(S, M, ...)  JSER_PP_F(S, M), JSER_PP_7(S, __VA_ARGS__)
+#define JSER_PP_9(S, M, ...)  JSER_PP_F(S, M), JSER_PP_8(S, __VA_ARGS__)
+#define JSER_PP_10(S, M, ...) JSER_PP_F(S, M), JSER_PP_9(S, __VA_ARGS__)
+#define JSER_PP_11(S, M, ...) JSER_PP_F(S, M), JSER_PP_10(S, __VA_ARGS__)
+#define JSER_PP_12(S, M, ...) JSER_PP_F(S, M), JSER_PP_11(S, __VA_ARGS__)
+#define JSER_PP_13(S, M, ...) JSER_PP_F(S, M), JSER_PP_12(S, __VA_ARGS__)
+#define JSER_PP_14(S, M, ...) JSER_PP_F(S, M), JSER_PP_13(S, __VA_ARGS__)
+#define JSER_PP_15(S, M, ...) JSER_PP_F(S, M), JSER_PP_14(S, __VA_ARGS__)
+#define JSER_PP_16(S, M, ...) JSER_PP_F(S, M), JSER_PP_15(S, __VA_ARGS__)
+#define JSER_PP_17(S, M, ...) JSER_PP_F(S, M), JSER_PP_16(S, __VA_ARGS__)
+#define JSER_PP_18(S, M, ...) JSER_PP_F(S, M), JSER_PP_17(S, __VA_ARGS__)
+#define JSER_PP_19(S, M, ...) JSER_PP_F(S, M), JSER_PP_18(S, __VA_ARGS__)
+#define JSER_PP_20(S, M, ...) JSER_PP_F(S, M), JSER_PP_19(S, __VA_ARGS__)
+#define JSER_PP_21(S, M, ...) JSER_PP_F(S, M), JSER_PP_20(S, __VA_ARGS__)
+#define JSER_PP_22(S, M, ...) JSER_PP_F(S, M), JSER_PP_21(S, __VA_ARGS__)
+#define JSER_PP_23(S, M, ...) JSER_PP_F(S, M), JSER_PP_22(S, __VA_ARGS__)
+#define JSER_PP_24(S, M, ...) JSER_PP_F(S, M), JSER_PP_23(S, __VA_ARGS__)
+#define JSER_PP_25(S, M, ...) JSER_PP_F(S, M), JSER_PP_24(S, __VA_ARGS__)
+#define JSER_PP_26(S, M, ...) JSER_PP_F(S, M), JSER_PP_25(S, __VA_ARGS__)
+#define JSER_PP_27(S, M, ...) JSER_PP_F(S, M), JSER_PP_26(S, __VA_ARGS__)
+#define JSER_PP_28(S, M, ...) JSER_PP_F(S, M), JSER_PP_27(S, __VA_ARGS__)
+#define JSER_PP_29(S, M, ...) JSER_PP_F(S, M), JSER_PP_28(S, __VA_ARGS__)
+#define JSER_PP_30(S, M, ...) JSER_PP_F(S, M), JSER_PP_29(S, __VA_ARGS__)
+#define JSER_PP_31(S, M, ...) JSER_PP_F(S, M), JSER_PP_30(S, __VA_ARGS__)
+#define JSER_PP_32(S, M, ...) JSER_PP_F(S, M), JSER_PP_31(S, __VA_ARGS__)
+
+/* Describe the members of the structure 'S', up to 32 of them, in the order
+ * they are to be serialized; used at global scope with 'S' fully named */
+#define JSER_DESCRIBE(S, ...) \
+    template <> struct jserpp::describe<S> { \
+        static constexpr auto fields = std::make_tuple(JSER_PP_CAT(JSER_PP_, JSER_PP_COUNT(__VA_ARGS__))(S, __VA_ARGS__)); \
+    };
+
+} /* namespace jserpp */
+
+#endif
@@ -0,0 +1,700 @@
+/* Author:  Richard James Howe
+ * Project: JSON Serialization Routines
+ *
+ * A host tool that turns a JSON document into C source, so that a default
+ * configuration can be compiled into a program instead of being parsed
+ * every time the program starts. The generated source defines a variable
+ * for each value in the document, initialized to that value, and a 'jser_t'
+ * table describing them that can be used with the rest of the library, for
+ * example to apply overrides at run time.
+ *
+ * Types are inferred from the document, a descriptor file can be given to
+ * override them and to reserve more space for strings and buffers. Each
+ * line of the descriptor has the form:
+ *
+ *	path type [size]
+ *
+ * Where 'path' is a list of attributes (or array indices) separated by '/',
+ * a '*' matches any attribute or index, 'type' is one of 'long', 'ulong',
+ * 'bool', 'asciiz' or 'buffer' and 'size' is the number of bytes to reserve
+ * for a string or buffer. Blank lines and lines starting with '#' are
+ * ignored. A 'buffer' is a base64 encoded string in the document. Numbers
+ * must be integers within the range of a 'long' or 'unsigned long' on the
+ * host. */
+
+#define JSMN_STATIC
+#define JSMN_PARENT_LINKS
+#define JSMN_ELEMENT_CALLBACK
+#define JSMN_SEGMENTS
+#define JSMN_LIMITS
+#include "jsmn.h"
+#include "jser.h"
+#include <assert.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ELEMENTS(X)  (sizeof(X) / sizeof(X[0]))
+#define MAX_PATH     (256)
+#define MAX_RULES    (256)
+
+typedef struct {
+    char path[MAX_PATH];
+    jser_type_e type;
+    size_t size;
+} rule_t; /* a line from the descriptor file */
+
+typedef struct {
+    const char *json, *prefix, *name;
+    jsmntok_t *t;
+    size_t tokens;
+    rule_t rules[MAX_RULES];
+    size_t nrules;
+    char **ids;     /* identifiers generated so far, each followed by the path it is for */
+    size_t nids, cids;
+    FILE *out;
+    int writable, header;
+} jser2c_t;
+
+static void die(const char *fmt, ...)
+{
+    assert(fmt);
+    va_list ap;
+    va_start(ap, fmt);
+    (void)fputs("jser2c: ", stderr);
+    (void)vfprintf(stderr, fmt, ap);
+    (void)fputc('\n', stderr);
+    va_end(ap);
+    exit(1);
+}
+
+static char *slurp(const char *file, size_t *length)
+{
+    assert(file);
+    assert(length);
+    errno = 0;
+    FILE *f = fopen(file, "rb");
+    if (!f) {
+        die("failed to open '%s' for reading: %s", file, strerror(errno));
+    }
+    size_t sz = 0, cap = 4096;
+    char *r = malloc(cap + 1);
+    for (size_t n = 0; r && (n = fread(r + sz, 1, cap - sz, f)) > 0;) {
+        sz += n;
+        if (sz == cap) {
+            char *nr = realloc(r, (cap *= 2) + 1);
+            if (!nr) {
+                free(r);
+            }
+            r = nr;
+        }
+    }
+    if (!r) {
+        die("out of memory");
+    }
+    if (ferror(f) || fclose(f) < 0) {
+        die("failed to read '%s'", file);
+    }
+    r[sz] = '\0';
+    *length = sz;
+    return r;
+}
+
+static jser_type_e type_by_name(const char *name, const char *file, const int line)
+{
+    assert(name);
+    static const struct { const char *name; jser_type_e type; } types[] = {
+        { "long",   JSER_LONG_E,   },
+        { "ulong",  JSER_ULONG_E,  },
+        { "bool",   JSER_BOOL_E,   },
+        { "asciiz", JSER_ASCIIZ_E, },
+        { "buffer", JSER_BUFFER_E, },
+    };
+    for (size_t i = 0; i < ELEMENTS(types); i++) {
+        if (!strcmp(types[i].name, name)) {
+            return types[i].type;
+        }
+    }
+    die("%s:%d: unknown type '%s'", file, line, name);
+    return JSER_LONG_E;
+}
+
+static void descriptor(jser2c_t *j, const char *file)
+{
+    assert(j);
+    assert(file);
+    size_t length = 0;
+    char *d = slurp(file, &length), *next = NULL;
+    int line = 0;
+    for (char *l = d; l; l = next) {
+        char path[MAX_PATH], type[16];
+        unsigned long size = 0;
+        line++;
+        if ((next = strchr(l, '\n'))) {
+            *next++ = '\0';
+        }
+        while (isspace((unsigned char)*l)) {
+            l++;
+        }
+        if (*l == '\0' || *l == '#') {
+            continue;
+        }
+        const int n = sscanf(l, "%255s %15s %lu", path, type, &size);
+        if (n < 2) {
+            die("%s:%d: expected 'path type [size]'", file, line);
+        }
+        if (j->nrules >= ELEMENTS(j->rules)) {
+            die("%s:%d: too many rules", file, line);
+        }
+        rule_t *r = &j->rules[j->nrules++];
+        memcpy(r->path, path, sizeof path);
+        r->type = type_by_name(type, file, line);
+        r->size = size;
+    }
+    free(d);
+}
+
+/* Match a path against a rule, component by component */
+static int matches(const char *rule, const char *path)
+{
+    assert(rule);
+    assert(path);
+    for (;;) {
+        const size_t rl = strcspn(rule, "/"), pl = strcspn(path, "/");
+        if (!(rl == 1 && rule[0] == '*') && (rl != pl || memcmp(rule, path, rl))) {
+            return 0;
+        }
+        rule += rl;
+        path += pl;
+        if (*rule == '\0' || *path == '\0') {
+            return *rule == *path;
+        }
+        rule++;
+        path++;
+    }
+}
+
+static const rule_t *rule(const jser2c_t *j, const char *path)
+{
+    assert(j);
+    assert(path);
+    for (size_t i = 0; i < j->nrules; i++) {
+        if (matches(j->rules[i].path, path)) {
+            return &j->rules[i];
+        }
+    }
+    return NULL;
+}
+
+static size_t skip(const jser2c_t *j, size_t i)
+{
+    assert(j);
+    const jsmntok_t *t = &j->t[i];
+    for (i++; i < j->tokens && j->t[i].start < t->end; i++)
+        ;
+    return i;
+}
+
+static void join(char *r, const char *path, const char *key, const size_t kl)
+{
+    assert(r);
+    assert(path);
+    assert(key);
+    const size_t pl = strlen(path);
+    if ((pl + kl + 2) > MAX_PATH) {
+        die("path too long: %s/%.*s", path, (int)kl, key);
+    }
+    memcpy(r, path, pl);
+    if (pl) {
+        r[pl] = '/';
+    }
+    memcpy(&r[pl + !!pl], key, kl);
+    r[pl + !!pl + kl] = '\0';
+}
+
+/* The C identifier for a path */
+static void identifier(const jser2c_t *j, char *r, const char *path)
+{
+    assert(j);
+    assert(r);
+    assert(path);
+    const size_t pl = strlen(j->prefix);
+    memcpy(r, j->prefix, pl + 1);
+    if (*path == '\0') {
+        return;
+    }
+    r[pl] = '_';
+    size_t k = pl + 1;
+    for (; *path && k < (MAX_PATH * 2) - 1; path++) {
+        r[k++] = isalnum((unsigned char)*path) ? *path : '_';
+    }
+    r[k] = '\0';
+}
+
+/* Two paths can map onto the same identifier, for example "a_b" and "a/b",
+ * which would not compile, so each one generated is remembered */
+static void claim(jser2c_t *j, const char *id, const char *path)
+{
+    assert(j);
+    assert(id);
+    assert(path);
+    for (size_t i = 0; i < j->nids; i++) {
+        if (!strcmp(j->ids[i], id)) {
+            die("'%s' and '%s' both become '%s', rename one of them", j->ids[i] + strlen(id) + 1, path, id);
+        }
+    }
+    if (j->nids == j->cids) {
+        j->cids = j->cids ? j->cids * 2 : 64;
+        char **ids = realloc(j->ids, j->cids * sizeof (*ids));
+        if (!ids) {
+            die("out of memory");
+        }
+        j->ids = ids;
+    }
+    const size_t il = strlen(id) + 1, pl = strlen(path) + 1;
+    char *r = malloc(il + pl);
+    if (!r) {
+        die("out of memory");
+    }
+    memcpy(r, id, il);
+    memcpy(r + il, path, pl);
+    j->ids[j->nids++] = r;
+}
+
+/* Decode the JSON string escapes within a string token */
+static size_t unescape(const char *s, size_t length, unsigned char *r)
+{
+    assert(s);
+    assert(r);
+    size_t k = 0;
+    for (size_t i = 0; i < length; i++) {
+        if (s[i] != '\\') {
+            r[k++] = s[i];
+            continue;
+        }
+        switch (s[++i]) {
+        case 'b': r[k++] = '\b'; break;
+        case 'f': r[k++] = '\f'; break;
+        case 'n': r[k++] = '\n'; break;
+        case 'r': r[k++] = '\r'; break;
+        case 't': r[k++] = '\t'; break;
+        case 'u': {
+            unsigned long cp = strtoul((char[5]){ s[i + 1], s[i + 2], s[i + 3], s[i + 4], 0 }, NULL, 16);
+            i += 4;
+            if (cp >= 0xD800 && cp <= 0xDBFF && s[i + 1] == '\\' && s[i + 2] == 'u') {
+                const unsigned long lo = strtoul((char[5]){ s[i + 3], s[i + 4], s[i + 5], s[i + 6], 0 }, NULL, 16);
+                cp = 0x10000ul + ((cp - 0xD800ul) << 10) + (lo - 0xDC00ul);
+                i += 6;
+            }
+            if (cp < 0x80) {
+                r[k++] = cp;
+            } else if (cp < 0x800) {
+                r[k++] = 0xC0 | (cp >> 6);
+                r[k++] = 0x80 | (cp & 0x3F);
+            } else if (cp < 0x10000) {
+                r[k++] = 0xE0 | (cp >> 12);
+                r[k++] = 0x80 | ((cp >> 6) & 0x3F);
+                r[k++] = 0x80 | (cp & 0x3F);
+            } else {
+                r[k++] = 0xF0 | (cp >> 18);
+                r[k++] = 0x80 | ((cp >> 12) & 0x3F);
+                r[k++] = 0x80 | ((cp >> 6) & 0x3F);
+                r[k++] = 0x80 | (cp & 0x3F);
+            }
+            break;
+        }
+        default: r[k++] = s[i]; break; /* '"', '\\' and '/' */
+        }
+    }
+    return k;
+}
+
+static void quote(FILE *o, const unsigned char *s, const size_t length)
+{
+    assert(o);
+    assert(s);
+    fputc('"', o);
+    for (size_t i = 0; i < length; i++) {
+        if (s[i] == '"' || s[i] == '\\') {
+            fprintf(o, "\\%c", s[i]);
+        } else if (isprint(s[i])) {
+            fputc(s[i], o);
+        } else {
+            fprintf(o, "\\%03o", s[i]);
+        }
+    }
+    fputc('"', o);
+}
+
+/* Numbers must be integers that fit into a 'long' or an 'unsigned long' on
+ * the host, one that only fits into an 'unsigned long' is inferred to be
+ * one. The value is stored in whichever of 'ld' or 'lu' it fits in. */
+static jser_type_e integer(const char *path, const char *s, const int len, const rule_t *r, long *ld, unsigned long *lu)
+{
+    assert(path);
+    assert(s);
+    assert(ld);
+    assert(lu);
+    char n[32];
+    const int negative = len > 0 && s[0] == '-';
+    if (len <= negative || (size_t)len >= sizeof n || strspn(s + negative, "0123456789") != (size_t)(len - negative)) {
+        die("%s: '%.*s' is not an integer, only integers are supported", path, len, s);
+    }
+    if ((len - negative) > 1 && s[negative] == '0') {
+        die("%s: '%.*s' has a leading zero", path, len, s);
+    }
+    memcpy(n, s, len);
+    n[len] = '\0';
+    errno = 0;
+    if (negative) {
+        if (r && r->type == JSER_ULONG_E) {
+            die("%s: negative number for an 'ulong'", path);
+        }
+        *ld = strtol(n, NULL, 10);
+        if (errno == ERANGE) {
+            die("%s: '%s' is too small for a 'long'", path, n);
+        }
+        return JSER_LONG_E;
+    }
+    *lu = strtoul(n, NULL, 10);
+    if (errno == ERANGE) {
+        die("%s: '%s' is too large for an 'ulong'", path, n);
+    }
+    if (*lu > LONG_MAX) {
+        if (r && r->type == JSER_LONG_E) {
+            die("%s: '%s' is too large for a 'long'", path, n);
+        }
+        return JSER_ULONG_E;
+    }
+    *ld = (long)*lu;
+    return r ? r->type : JSER_LONG_E;
+}
+
+/* Work out the type of the value at token 'i', with any overrides */
+static jser_type_e kind(const jser2c_t *j, const size_t i, const char *path, size_t *size)
+{
+    assert(j);
+    assert(path);
+    assert(size);
+    const jsmntok_t *t = &j->t[i];
+    const rule_t *r = rule(j, path);
+    *size = r ? r->size : 0;
+    switch (t->type) {
+    case JSMN_OBJECT: return JSER_OBJECT_E;
+    case JSMN_ARRAY:  return JSER_ARRAY_E;
+    case JSMN_STRING:
+        if (r && r->type != JSER_ASCIIZ_E && r->type != JSER_BUFFER_E) {
+            die("%s: a string can only be an 'asciiz' or a 'buffer'", path);
+        }
+        return r ? r->type : JSER_ASCIIZ_E;
+    case JSMN_PRIMITIVE: {
+        const char c = j->json[t->start];
+        if (c == 't' || c == 'f') {
+            return JSER_BOOL_E;
+        }
+        if (c == 'n') {
+            die("%s: 'null' is not supported", path);
+        }
+        if (r && r->type != JSER_LONG_E && r->type != JSER_ULONG_E) {
+            die("%s: a number can only be a 'long' or an 'ulong'", path);
+        }
+        long ld = 0;
+        unsigned long lu = 0;
+        return integer(path, &j->json[t->start], t->end - t->start, r, &ld, &lu);
+    }
+    default:
+        break;
+    }
+    die("%s: unexpected token", path);
+    return JSER_LONG_E;
+}
+
+static const char *qualifier(const jser2c_t *j)
+{
+    assert(j);
+    return j->writable ? "" : "const ";
+}
+
+/* Define the variables for the value at token 'i', and all of its children,
+ * followed by a table for it if it is an object or array. Returns the token
+ * after the value. */
+static size_t define(jser2c_t *j, size_t i, const char *path)
+{
+    assert(j);
+    assert(path);
+    FILE *o = j->out;
+    const jsmntok_t *t = &j->t[i];
+    const int len = t->end - t->start;
+    const char *s = &j->json[t->start];
+    char id[MAX_PATH * 2];
+    identifier(j, id, path);
+    claim(j, id, path);
+    size_t size = 0;
+    const jser_type_e type = kind(j, i, path, &size);
+    const char *extrn = j->header ? "extern " : "";
+
+    switch (type) {
+    case JSER_LONG_E:
+    case JSER_ULONG_E: {
+        long ld = 0;
+        unsigned long lu = 0;
+        (void)integer(path, s, len, NULL, &ld, &lu);
+        fprintf(o, "%sjser_%slong_t %s", extrn, type == JSER_ULONG_E ? "u" : "", id);
+        if (j->header) {
+            fputs(";\n", o);
+        } else if (type == JSER_ULONG_E) {
+            fprintf(o, " = %luul;\n", lu);
+        } else if (ld == LONG_MIN) { /* the literal would be too large for a 'long' before it is negated */
+            fprintf(o, " = (%ldl - 1l);\n", ld + 1);
+        } else {
+            fprintf(o, " = %ldl;\n", ld);
+        }
+        return i + 1;
+    }
+    case JSER_BOOL_E:
+        fprintf(o, "%sbool %s", extrn, id);
+        if (!j->header) {
+            fprintf(o, " = %s", *s == 't' ? "true" : "false");
+        }
+        fputs(";\n", o);
+        return i + 1;
+    case JSER_ASCIIZ_E: {
+        unsigned char *u = malloc(len + 1);
+        if (!u) {
+            die("out of memory");
+        }
+        const size_t ul = unescape(s, len, u);
+        fprintf(o, "%schar %s[%lu]", extrn, id, (unsigned long)(ul + 1 > size ? ul + 1 : size));
+        if (!j->header) {
+            fputs(" = ", o);
+            quote(o, u, ul);
+        }
+        fputs(";\n", o);
+        free(u);
+        return i + 1;
+    }
+    case JSER_BUFFER_E: {
+        char bid[MAX_PATH * 2 + 4];
+        snprintf(bid, sizeof bid, "%s_buf", id);
+        claim(j, bid, path);
+        size_t ul = len;
+        unsigned char *u = malloc(len + 1);
+        if (!u) {
+            die("out of memory");
+        }
+        if (jser_base64_decode((const unsigned char *)s, len, u, &ul) < 0) {
+            die("%s: invalid base64", path);
+        }
+        const size_t cap = ul > size ? ul : size;
+        if (j->header) {
+            fprintf(o, "extern jser_buffer_t %s;\n", id);
+            free(u);
+            return i + 1;
+        }
+        fprintf(o, "static unsigned char %s_buf[%lu] = {", id, (unsigned long)(cap ? cap : 1));
+        for (size_t k = 0; k < ul; k++) {
+            fprintf(o, "%s0x%02x,", (k % 12) ? " " : "\n\t", u[k]);
+        }
+        fprintf(o, "\n};\njser_buffer_t %s = { .length = %lu, .used = %lu, .buf = %s_buf, };\n",
+                id, (unsigned long)cap, (unsigned long)ul, id);
+        free(u);
+        return i + 1;
+    }
+    case JSER_OBJECT_E:
+    case JSER_ARRAY_E: {
+        char child[MAX_PATH];
+        size_t k = i + 1, n = 0;
+        while (k < j->tokens && j->t[k].start < t->end) { /* children first */
+            if (type == JSER_OBJECT_E) {
+                const jsmntok_t *key = &j->t[k++];
+                join(child, path, &j->json[key->start], key->end - key->start);
+            } else {
+                char index[32];
+                join(child, path, index, snprintf(index, sizeof index, "%lu", (unsigned long)n));
+            }
+            k = define(j, k, child);
+            n++;
+        }
+        if (j->header) {
+            if (*path == '\0') {
+                fprintf(o, "extern %sjser_t %s[%lu];\n", qualifier(j), id, (unsigned long)n);
+            }
+            return k;
+        }
+        fprintf(o, "%s%sjser_t %s[%lu] = {\n", *path ? "static " : "", qualifier(j), id, (unsigned long)(n ? n : 1));
+        if (n == 0) {
+            fputs("\t{ 0 },\n", o);
+        }
+        size_t m = 0;
+        for (k = i + 1; k < j->tokens && j->t[k].start < t->end; m++) {
+            char cid[MAX_PATH * 2];
+            const char *attr = NULL;
+            int al = 0;
+            if (type == JSER_OBJECT_E) {
+                const jsmntok_t *key = &j->t[k++];
+                attr = &j->json[key->start];
+                al = key->end - key->start;
+                join(child, path, attr, al);
+            } else {
+                char index[32];
+                join(child, path, index, snprintf(index, sizeof index, "%lu", (unsigned long)m));
+            }
+            identifier(j, cid, child);
+            size_t csz = 0;
+            const jser_type_e ct = kind(j, k, child, &csz);
+            fputs("\t{ ", o);
+            if (attr) { /* as it is in the document, escapes and all, which is how keys are matched */
+                fputs(".attr = ", o);
+                quote(o, (const unsigned char *)attr, al);
+                fputs(", ", o);
+            }
+            switch (ct) {
+            case JSER_LONG_E:   fprintf(o, ".type = JSER_LONG_E, .data.ld = &%s, ", cid); break;
+            case JSER_ULONG_E:  fprintf(o, ".type = JSER_ULONG_E, .data.lu = &%s, ", cid); break;
+            case JSER_BOOL_E:   fprintf(o, ".type = JSER_BOOL_E, .data.b = &%s, ", cid); break;
+            case JSER_ASCIIZ_E: fprintf(o, ".type = JSER_ASCIIZ_E, .data.asciiz = %s, .length = sizeof (%s), ", cid, cid); break;
+            case JSER_BUFFER_E: fprintf(o, ".type = JSER_BUFFER_E, .data.buf = &%s, ", cid); break;
+            case JSER_OBJECT_E:
+            case JSER_ARRAY_E: {
+                const size_t cn = j->t[k].size;
+                fprintf(o, ".type = %s, .data.jser = (jser_t *)%s, .length = %lu, .used = %lu, ",
+                        ct == JSER_OBJECT_E ? "JSER_OBJECT_E" : "JSER_ARRAY_E", cid, (unsigned long)cn, (unsigned long)cn);
+                break;
+            }
+            default:
+                assert(0);
+            }
+            fputs("},\n", o);
+            k = skip(j, k);
+        }
+        fputs("};\n", o);
+        if (*path == '\0') {
+            fprintf(o, "const size_t %s_length = %lu;\n", id, (unsigned long)n);
+        }
+        return k;
+    }
+    default:
+        break;
+    }
+    die("%s: unhandled type", path);
+    return 0;
+}
+
+static int usage(FILE *o, const char *arg0)
+{
+    assert(o);
+    assert(arg0);
+    static const char *help = "\
+Turn a JSON document into C source containing variables initialized to\n\
+the values within it and a 'jser_t' table describing them.\n\n\
+Options:\n\n\
+-h\t\tprint this help and exit\n\
+-p prefix\tprefix for all generated names, default is 'config'\n\
+-d file\t\tdescriptor file, overriding types and sizes\n\
+-w\t\tmake the tables writable, needed to deserialize into them\n\
+-H\t\temit a header with declarations instead of definitions\n\
+-o file\t\twrite to file instead of standard out\n\n\
+Descriptor lines are of the form 'path type [size]', see 'jser2c.c'.\n\
+";
+    return fprintf(o, "Usage: %s [-wH] [-p prefix] [-d descriptor] [-o output] file.json\n\n%s", arg0, help);
+}
+
+int main(int argc, char **argv)
+{
+    static jser2c_t j = { .prefix = "config", };
+    const char *output = NULL;
+    int i = 1;
+    j.out = stdout;
+    for (; i < argc && argv[i][0] == '-'; i++) {
+        const char *opt = argv[i];
+        if (!strcmp(opt, "-h")) {
+            return usage(stdout, argv[0]) < 0;
+        } else if (!strcmp(opt, "-w")) {
+            j.writable = 1;
+        } else if (!strcmp(opt, "-H")) {
+            j.header = 1;
+        } else if (!strcmp(opt, "-p") && (i + 1) < argc) {
+            j.prefix = argv[++i];
+        } else if (!strcmp(opt, "-d") && (i + 1) < argc) {
+            descriptor(&j, argv[++i]);
+        } else if (!strcmp(opt, "-o") && (i + 1) < argc) {
+            output = argv[++i];
+        } else {
+            (void)usage(stderr, argv[0]);
+            return 1;
+        }
+    }
+    if ((i + 1) != argc) {
+        (void)usage(stderr, argv[0]);
+        return 1;
+    }
+    for (const char *c = j.prefix; *c; c++) {
+        if (!(isalpha((unsigned char)*c) || *c == '_' || (c != j.prefix && isdigit((unsigned char)*c)))) {
+            die("prefix '%s' is not a valid C identifier", j.prefix);
+        }
+    }
+    j.name = argv[i];
+    size_t length = 0;
+    j.json = slurp(j.name, &length);
+
+    jsmn_parser p;
+    jsmn_init(&p);
+    const jsmnint_t count = jsmn_parse(&p, j.json, length, NULL, 0);
+    if (count <= 0) {
+        die("%s: invalid JSON", j.name);
+    }
+    j.t = calloc(count, sizeof (*j.t));
+    if (!j.t) {
+        die("out of memory");
+    }
+    jsmn_init(&p);
+    if (jsmn_parse(&p, j.json, length, j.t, count) < 0) {
+        die("%s: invalid JSON", j.name);
+    }
+    j.tokens = p.toknext;
+    if (j.t[0].type != JSMN_OBJECT) {
+        die("%s: expected an object", j.name);
+    }
+
+    if (output) {
+        errno = 0;
+        j.out = fopen(output, "wb");
+        if (!j.out) {
+            die("failed to open '%s' for writing: %s", output, strerror(errno));
+        }
+    }
+    char guard[MAX_PATH * 2], length_id[MAX_PATH * 2];
+    identifier(&j, guard, "h");
+    for (char *g = guard; *g; g++) {
+        *g = toupper((unsigned char)*g);
+    }
+    identifier(&j, length_id, "length");
+    claim(&j, guard, "(include guard)");
+    claim(&j, length_id, "(table length)");
+    fprintf(j.out, "/* Generated by jser2c from '%s', do not edit. */\n", j.name);
+    if (j.header) {
+        fprintf(j.out, "#ifndef %s\n#define %s\n", guard, guard);
+    }
+    fputs("#include \"jser.h\"\n\n", j.out);
+    if (j.header) {
+        fprintf(j.out, "extern const size_t %s_length;\n", j.prefix);
+    }
+    (void)define(&j, 0, "");
+    if (j.header) {
+        fprintf(j.out, "#endif\n");
+    }
+    if (fclose(j.out) < 0) {
+        die("failed to write output");
+    }
+    for (size_t k = 0; k < j.nids; k++) {
+        free(j.ids[k]);
+    }
+    free(j.ids);
+    free(j.t);
+    free((char *)j.json);
+    return 0;
+}
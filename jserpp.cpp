@@ -0,0 +1,304 @@
+/* Author:  Richard James Howe
+ * Project: JSON Serialization Routines
+ * License: MIT (for 'jsmn.h'), Proprietary for everything else.
+ *
+ * Test driver for 'jser.hpp'; checks the specialized codecs against the C
+ * library and times both. */
+#include "jser.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+
+namespace {
+
+struct nested {
+    jser_ulong_t ul1, ul2;
+    jser_long_t l2;
+};
+
+struct message { /* the same as the benchmark in 'main.c' */
+    bool b1, b2;
+    jser_long_t l1;
+    jser_long_t a1[3];
+    nested j1;
+    char s1[32], s2[32];
+    jser_buffer_t buf1;
+};
+
+struct outer {
+    message m[2];
+    char tag[8];
+};
+
+}
+
+JSER_DESCRIBE(nested, ul1, ul2, l2)
+JSER_DESCRIBE(message, b1, b2, l1, a1, j1, s1, s2, buf1)
+JSER_DESCRIBE(outer, m, tag)
+
+static_assert(jserpp::table<message>::size() == 8, "root of the table");
+static_assert(jserpp::nodes_v<message> == 8 + 3 + 3, "nodes below arrays and objects");
+static_assert(jserpp::nodes_v<outer> == 2 + 2 * (1 + 14), "nodes below arrays of objects");
+
+namespace {
+
+unsigned char bstr1[32] = "HELLO";
+
+message example()
+{
+    message m = { true, false, -987, { 1, 2, 4 }, { 444, 111, 333 }, "benchmark", "a longer \"string\"\tvalue", {}, };
+    m.buf1 = jser_buffer_t{ sizeof bstr1, 5, bstr1, };
+    return m;
+}
+
+int deserialized(const char *json, message &m)
+{
+    jser_buffer_t b = { std::strlen(json), std::strlen(json), reinterpret_cast<unsigned char *>(const_cast<char *>(json)), };
+    return jserpp::deserialize(m, &b);
+}
+
+bool equal(const message &a, const message &b)
+{
+    return a.b1 == b.b1 && a.b2 == b.b2 && a.l1 == b.l1 && !std::memcmp(a.a1, b.a1, sizeof a.a1) &&
+        a.j1.ul1 == b.j1.ul1 && a.j1.ul2 == b.j1.ul2 && a.j1.l2 == b.j1.l2 &&
+        !std::strcmp(a.s1, b.s1) && !std::strcmp(a.s2, b.s2) && a.buf1.used == b.buf1.used &&
+        !std::memcmp(a.buf1.buf, b.buf1.buf, a.buf1.used);
+}
+
+/* Both ways of deserializing 'json' give the same result */
+int same(const char *json)
+{
+    message m = example(), c = example();
+    unsigned char b1[32] = { 0 }, b2[32] = { 0 };
+    m.buf1.buf = b1;
+    c.buf1.buf = b2;
+    const int r = deserialized(json, m);
+    jserpp::table<message> t(c);
+    jsmntok_t tokens[64];
+    const int rc = jser_deserialize_from_asciiz(t.data(), t.size(), tokens, sizeof tokens / sizeof tokens[0], json);
+    if (r != rc) {
+        std::fprintf(stderr, "%s: %d != %d\n", json, r, rc);
+        return -1;
+    }
+    if (r == jserpp::ok && !equal(m, c)) {
+        std::fprintf(stderr, "%s: differs\n", json);
+        return -1;
+    }
+    return 0;
+}
+
+#ifdef JSER_COROUTINES
+
+/* One end of a connection; a coroutine waiting on it is resumed by hand
+ * once there is room for its output, or input for it, as an event loop
+ * would do when a socket is ready */
+struct pipe {
+    std::coroutine_handle<> waiting;
+    unsigned char *p = nullptr;
+    std::size_t n = 0, got = 0;
+
+    struct ready {
+        pipe &c;
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> h) noexcept { c.waiting = h; }
+        std::size_t await_resume() const noexcept { return c.got; }
+    };
+
+    ready wait(unsigned char *at, std::size_t length)
+    {
+        p = at;
+        n = length;
+        return ready{ *this };
+    }
+};
+
+jserpp::task<int> round_trip(jser_encoder_t &w, jser_buffer_t &b, jser_decoder_t &d, pipe &out, pipe &in, int &sent)
+{
+    sent = co_await jserpp::async_serialize(w, b, [&out](jser_buffer_t &o) { return out.wait(o.buf, o.used); });
+    co_return co_await jserpp::async_deserialize(d, [&in](unsigned char *p, std::size_t n) { return in.wait(p, n); });
+}
+
+/* Serialize through a 7 byte buffer and deserialize what comes out 5 bytes
+ * at a time, with coroutines suspending at every step */
+int coroutines()
+{
+    message m = example(), c = example();
+    unsigned char bytes[32] = { 0 };
+    std::strcpy(m.s2, "no escapes"); /* the C library does not undo them */
+    c.buf1.buf = bytes;
+    c.l1 = 0;
+    jserpp::table<message> tm(m), tc(c);
+    unsigned char whole[512], wire[512], staging[7], window[256];
+    jser_buffer_t wb = { sizeof whole, 0, whole, }, b = { sizeof staging, 0, staging, }, win = { sizeof window, 0, window, };
+    if (jser_serialize_to_buffer(tm.data(), tm.size(), 0, &wb) < 0) {
+        return -1;
+    }
+    jser_level_t levels[4];
+    jser_frame_t frames[4];
+    jsmntok_t tokens[64];
+    jser_encoder_t w;
+    jser_decoder_t d;
+    if (jser_encoder_init(&w, tm.data(), tm.size(), levels, 4) < 0 ||
+            jser_decoder_init(&d, tc.data(), tc.size(), tokens, 64, &win, frames, 4) < 0) {
+        return -1;
+    }
+    pipe out, in;
+    int sent = -1;
+    std::size_t used = 0, at = 0, steps = 0;
+    jserpp::task<int> t = round_trip(w, b, d, out, in, sent);
+    for (t.start(); !t.done(); steps++) {
+        if (out.waiting) { /* take all the output */
+            if (used + out.n > sizeof wire) {
+                return -1;
+            }
+            std::memcpy(&wire[used], out.p, out.n);
+            used += out.n;
+            b.used = 0;
+            std::exchange(out.waiting, {}).resume();
+            continue;
+        }
+        if (!in.waiting) {
+            return -1;
+        }
+        in.got = std::min<std::size_t>({ in.n, used - at, 5 });
+        std::memcpy(in.p, &wire[at], in.got);
+        at += in.got;
+        std::exchange(in.waiting, {}).resume();
+    }
+    if (sent != jserpp::ok || t.result() != jserpp::ok || used != wb.used || std::memcmp(wire, whole, used)) {
+        return -1;
+    }
+    return equal(m, c) && steps > used / 5 ? 0 : -1;
+}
+
+#endif
+
+int tests()
+{
+    message m = example();
+    jserpp::table<message> t(m);
+    unsigned char o1[512], o2[512];
+    jser_buffer_t b1 = { sizeof o1, 0, o1, }, b2 = { sizeof o2, 0, o2, };
+    if (jserpp::serialize(m, &b1) < 0 || jser_serialize_to_buffer(t.data(), t.size(), 0, &b2) < 0) {
+        return -1;
+    }
+    if (b1.used != b2.used || std::memcmp(o1, o2, b1.used)) {
+        std::fprintf(stderr, "%.*s\n%.*s\n", (int)b1.used, o1, (int)b2.used, o2);
+        return -1;
+    }
+    b1 = { b2.used - 1, 0, o1, };
+    if (jserpp::serialize(m, &b1) != jserpp::err_space || b1.used != 0) {
+        return -1;
+    }
+    o2[b2.used] = '\0';
+    static const char *cases[] = {
+        "{\"b1\":false,\"l1\":-5,\"a1\":[7,8],\"j1\":{\"ul1\":9,\"l2\":-1},\"s1\":\"x\\\"y\",\"buf1\":\"AAEC\"}",
+        "{\"zz\":{\"a\":[1,{\"b\":[]},\"}\"],\"c\":{}},\"l1\":3,\"yy\":[[],[{}]],\"b2\":true}",
+        "{\"s1\":\"0123456789012345678901234567890123456789\"}",
+        "{\"j1\":{\"ul1\":-1}}",
+        "{\"l1\":1.5}",
+        "{\"l1\":true}",
+        "{\"b1\":1}",
+        "{\"a1\":[1,2,3,4]}",
+        "{\"j1\":[]}",
+        "{\"buf1\":\"!!!!\"}",
+        "",
+        "{\"l1\":1,",
+        "{\"s1\":\"a\\qb\"}",
+        "{\"zz\":\"\\u00zz\"}",
+        "{\"l1\":1}{",
+        "{\"l1\":1} [2]",
+        "{\"zz\":[1,,2]}",
+        "{\"l1\":1,}",
+        "{\"l1\" 2,\"a1\":[,1 2]}",
+        "{\"l1\":+1}",
+        "{\"s1\":x}",
+        "{\"b1\":truex}",
+        "{\"l1\":true,\"s1\":\"\\q\"}",
+        "{\"zz\":{\"a\":1]}",
+        "{\"l1\":1,\"zz\"}",
+    };
+    if (same(reinterpret_cast<const char *>(o2)) < 0) {
+        return -1;
+    }
+    for (const char *c : cases) {
+        if (same(c) < 0) {
+            return -1;
+        }
+    }
+    if (deserialized("{\"l1\":9223372036854775808}", m) != jserpp::err_number || deserialized("{\"l1\":-9223372036854775808}", m) < 0) {
+        return -1;
+    }
+#ifdef JSER_COROUTINES
+    if (coroutines() < 0) {
+        return -1;
+    }
+#endif
+    return 0;
+}
+
+double elapsed(const std::clock_t start, const unsigned long iterations)
+{
+    return (1e9 * (double)(std::clock() - start) / CLOCKS_PER_SEC) / iterations;
+}
+
+int benchmark(unsigned long iterations)
+{
+    message m = example();
+    jserpp::table<message> t(m);
+    unsigned char out[512];
+    jser_buffer_t b = { sizeof out, 0, out, };
+    std::clock_t start = std::clock();
+    for (unsigned long i = 0; i < iterations; i++) {
+        b.used = 0;
+        if (jser_serialize_to_buffer(t.data(), t.size(), 0, &b) < 0) {
+            return -1;
+        }
+    }
+    const double cs = elapsed(start, iterations);
+    start = std::clock();
+    for (unsigned long i = 0; i < iterations; i++) {
+        b.used = 0;
+        if (jserpp::serialize(m, &b) < 0) {
+            return -1;
+        }
+    }
+    const double ps = elapsed(start, iterations);
+    jsmntok_t tokens[64];
+    start = std::clock();
+    for (unsigned long i = 0; i < iterations; i++) {
+        if (jser_deserialize_from_buffer(t.data(), t.size(), tokens, sizeof tokens / sizeof tokens[0], &b) < 0) {
+            return -1;
+        }
+    }
+    const double cd = elapsed(start, iterations);
+    start = std::clock();
+    for (unsigned long i = 0; i < iterations; i++) {
+        if (jserpp::deserialize(m, &b) < 0) {
+            return -1;
+        }
+    }
+    const double pd = elapsed(start, iterations);
+    return std::printf("%.*s\nbytes: %u\nserialize:   C %.1f ns, C++ %.1f ns\ndeserialize: C %.1f ns, C++ %.1f ns\n",
+            (int)b.used, out, (unsigned)b.used, cs, ps, cd, pd) < 0 ? -1 : 0;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+    if (argc == 2 && !std::strcmp(argv[1], "-t")) {
+        const int r = tests();
+        if (r < 0) {
+            std::fprintf(stderr, "jser.hpp tests failed!\n");
+        }
+        return r < 0 ? 1 : 0;
+    }
+    if (argc == 2 && !std::strcmp(argv[1], "-b")) {
+        return benchmark(200000ul) < 0 ? 1 : 0;
+    }
+    std::fprintf(stderr, "usage: %s -t | -b\n", argv[0]);
+    return 1;
+}
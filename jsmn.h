@@ -24,12 +24,63 @@
 #ifndef JSMN_H
 #define JSMN_H
 
+#include <limits.h>
 #include <stddef.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+#if defined(JSMN_ELEMENT_CALLBACK) && !defined(JSMN_PARENT_LINKS)
+#error "JSMN_ELEMENT_CALLBACK requires JSMN_PARENT_LINKS"
+#endif
+
+/* Offsets, sizes and token indices are 'int' by default, keeping tokens
+ * small, defining JSMN_LARGE widens them so documents over 2GiB can be
+ * parsed. It must be defined the same way everywhere 'jsmn.h' is used. */
+#ifdef JSMN_LARGE
+typedef ptrdiff_t jsmnint_t;
+typedef size_t jsmnuint_t;
+#define JSMNINT_MAX PTRDIFF_MAX
+#else
+typedef int jsmnint_t;
+typedef unsigned int jsmnuint_t;
+#define JSMNINT_MAX INT_MAX
+#endif
+
+/* Defining JSMN_TOKEN_VALUES makes tokens carry a value worked out as they
+ * are scanned, so the input need not be read again; the FNV-1a hash of a
+ * string without escapes, or the magnitude of an integer primitive. */
+#ifdef JSMN_TOKEN_VALUES
+enum jsmnflags {
+  JSMN_VALUE = 1,   /* 'value' is set */
+  JSMN_NEGATIVE = 2 /* integer primitive has a leading '-' */
+};
+#endif
+
+/* Defining JSMN_LIMITS gives the parser limits on what it will accept,
+ * checked as it goes, for input that cannot be trusted; the number of
+ * tokens produced over the whole parse, the length of a string, the number
+ * of elements of an array or attributes of an object, and the depth of
+ * nesting. Zero is no limit, going over one is JSMN_ERROR_LIMIT. */
+#ifdef JSMN_LIMITS
+#define JSMN_OVER(max, n) ((max) != 0 && (size_t)(n) > (max))
+#endif
+
+/* Defining JSMN_SEGMENTS allows input to be parsed in pieces that are not
+ * contiguous, token offsets are relative to 'base' instead of 'js' and a
+ * primitive at the end of the input is incomplete if 'more' is set. How
+ * far an incomplete string or primitive was checked is kept, so the next
+ * call carries on from there instead of scanning it again from its start;
+ * set 'partial' to -1 if the input is moved, or move it and 'checked' with
+ * the input. */
+#ifdef JSMN_SEGMENTS
+#define JSMN_OFFSET(parser, pos) ((jsmnint_t)(pos) + (parser)->base)
+#else
+#define JSMN_OFFSET(parser, pos) ((jsmnint_t)(pos))
+#endif
+
 #ifdef JSMN_STATIC
 #define JSMN_API static
 #else
@@ -57,7 +108,9 @@ enum jsmnerr {
   /* Invalid character inside JSON string */
   JSMN_ERROR_INVAL = -2,
   /* The string is not a full JSON packet, more bytes expected */
-  JSMN_ERROR_PART = -3
+  JSMN_ERROR_PART = -3,
+  /* A limit set on the parser was exceeded */
+  JSMN_ERROR_LIMIT = -4
 };
 
 /**
@@ -68,11 +121,15 @@ enum jsmnerr {
  */
 typedef struct jsmntok {
   jsmntype_t type;
-  int start;
-  int end;
-  int size;
+  jsmnint_t start;
+  jsmnint_t end;
+  jsmnint_t size;
 #ifdef JSMN_PARENT_LINKS
-  int parent;
+  jsmnint_t parent;
+#endif
+#ifdef JSMN_TOKEN_VALUES
+  int flags;                /* JSMN_VALUE and JSMN_NEGATIVE */
+  unsigned long long value; /* string hash or integer magnitude */
 #endif
 } jsmntok_t;
 
@@ -81,9 +138,32 @@ typedef struct jsmntok {
  * the string being parsed now and current position in that string.
  */
 typedef struct jsmn_parser {
-  unsigned int pos;     /* offset in the JSON string */
-  unsigned int toknext; /* next token to allocate */
-  int toksuper;         /* superior token node, e.g. parent object or array */
+  jsmnuint_t pos;       /* offset in the JSON string */
+  jsmnuint_t toknext;   /* next token to allocate */
+  jsmnint_t toksuper;   /* superior token node, e.g. parent object or array */
+#ifdef JSMN_ELEMENT_CALLBACK
+  /* called when an element of the array 'tokens[array]' is complete, the
+   * element occupies the tokens from 'array + 1' up to 'toknext', the
+   * callback may release them by setting 'toknext' back to 'array + 1'. A
+   * negative return value stops the parse and is returned by jsmn_parse. */
+  int (*element)(struct jsmn_parser *parser, jsmntok_t *tokens, const jsmnint_t array);
+  void *param;          /* for use by 'element' */
+#endif
+#ifdef JSMN_SEGMENTS
+  jsmnint_t base;       /* offset of 'js' within the whole input */
+  int more;             /* more input follows 'js' */
+  jsmnint_t partial;    /* offset of an incomplete string or primitive, or -1... */
+  jsmnint_t checked;    /* ...and of the first byte of it not yet checked */
+#ifdef JSMN_TOKEN_VALUES
+  unsigned long long pvalue; /* its hash or magnitude so far... */
+  int pflags;                /* ...and flags, with bit 8 set if the magnitude is valid */
+#endif
+#endif
+#ifdef JSMN_LIMITS
+  size_t max_tokens, max_string, max_size, max_depth;
+  size_t total;         /* tokens produced so far */
+  size_t depth;         /* objects and arrays open */
+#endif
 } jsmn_parser;
 
 /**
@@ -96,8 +176,8 @@ JSMN_API void jsmn_init(jsmn_parser *parser);
  * describing
  * a single JSON object.
  */
-JSMN_API int jsmn_parse(jsmn_parser *parser, const char *js, const size_t len,
-                        jsmntok_t *tokens, const unsigned int num_tokens);
+JSMN_API jsmnint_t jsmn_parse(jsmn_parser *parser, const char *js, const size_t len,
+                        jsmntok_t *tokens, const jsmnuint_t num_tokens);
 
 #ifndef JSMN_HEADER
 /**
@@ -114,6 +194,10 @@ static jsmntok_t *jsmn_alloc_token(jsmn_parser *parser, jsmntok_t *tokens,
   tok->size = 0;
 #ifdef JSMN_PARENT_LINKS
   tok->parent = -1;
+#endif
+#ifdef JSMN_TOKEN_VALUES
+  tok->flags = 0;
+  tok->value = 0;
 #endif
   return tok;
 }
@@ -122,7 +206,7 @@ static jsmntok_t *jsmn_alloc_token(jsmn_parser *parser, jsmntok_t *tokens,
  * Fills token type and boundaries.
  */
 static void jsmn_fill_token(jsmntok_t *token, const jsmntype_t type,
-                            const int start, const int end) {
+                            const jsmnint_t start, const jsmnint_t end) {
   token->type = type;
   token->start = start;
   token->end = end;
@@ -136,9 +220,24 @@ static int jsmn_parse_primitive(jsmn_parser *parser, const char *js,
                                 const size_t len, jsmntok_t *tokens,
                                 const size_t num_tokens) {
   jsmntok_t *token;
-  int start;
+  jsmnint_t start;
+#ifdef JSMN_TOKEN_VALUES
+  unsigned long long value = 0;
+  int flags = js[parser->pos] == '-' ? JSMN_NEGATIVE : 0, valid = 1;
+#endif
 
   start = parser->pos;
+#ifdef JSMN_SEGMENTS
+  if (parser->partial == JSMN_OFFSET(parser, start) && parser->checked > parser->partial &&
+      (size_t)(parser->checked - parser->base) <= len) { /* carry on where the last call stopped */
+    parser->pos = parser->checked - parser->base;
+#ifdef JSMN_TOKEN_VALUES
+    value = parser->pvalue;
+    flags = parser->pflags & JSMN_NEGATIVE;
+    valid = (parser->pflags >> 8) & 1;
+#endif
+  }
+#endif
 
   for (; parser->pos < len && js[parser->pos] != '\0'; parser->pos++) {
     switch (js[parser->pos]) {
@@ -162,7 +261,29 @@ static int jsmn_parse_primitive(jsmn_parser *parser, const char *js,
       parser->pos = start;
       return JSMN_ERROR_INVAL;
     }
+#ifdef JSMN_TOKEN_VALUES
+    if (!(flags & JSMN_NEGATIVE) || parser->pos != (jsmnuint_t)start) {
+      const unsigned d = (unsigned char)js[parser->pos] - '0';
+      if (d < 10 && value <= (ULLONG_MAX - d) / 10) {
+        value = (value * 10) + d;
+      } else {
+        valid = 0;
+      }
+    }
+#endif
   }
+#ifdef JSMN_SEGMENTS
+  if (parser->more) { /* it may carry on in the next piece of input */
+    parser->partial = JSMN_OFFSET(parser, start);
+    parser->checked = JSMN_OFFSET(parser, parser->pos);
+#ifdef JSMN_TOKEN_VALUES
+    parser->pvalue = value;
+    parser->pflags = flags | (valid << 8);
+#endif
+    parser->pos = start;
+    return JSMN_ERROR_PART;
+  }
+#endif
 #ifdef JSMN_STRICT
   /* In strict mode primitive must be followed by a comma/object/array */
   parser->pos = start;
@@ -179,9 +300,15 @@ found:
     parser->pos = start;
     return JSMN_ERROR_NOMEM;
   }
-  jsmn_fill_token(token, JSMN_PRIMITIVE, start, parser->pos);
+  jsmn_fill_token(token, JSMN_PRIMITIVE, JSMN_OFFSET(parser, start), JSMN_OFFSET(parser, parser->pos));
 #ifdef JSMN_PARENT_LINKS
   token->parent = parser->toksuper;
+#endif
+#ifdef JSMN_TOKEN_VALUES
+  if (valid && (parser->pos - (jsmnuint_t)start) > (jsmnuint_t)(flags & JSMN_NEGATIVE ? 1 : 0)) {
+    token->flags = flags | JSMN_VALUE;
+    token->value = value;
+  }
 #endif
   parser->pos--;
   return 0;
@@ -195,13 +322,52 @@ static int jsmn_parse_string(jsmn_parser *parser, const char *js,
                              const size_t num_tokens) {
   jsmntok_t *token;
 
-  int start = parser->pos;
+  jsmnint_t start = parser->pos;
+#ifdef JSMN_TOKEN_VALUES
+  unsigned long long hash = 0x811C9DC5ull; /* 32-bit FNV-1a */
+  int flags = JSMN_VALUE;
+#endif
+#ifdef JSMN_SEGMENTS
+  jsmnuint_t mark; /* where the last complete character or escape ended */
+#ifdef JSMN_TOKEN_VALUES
+  unsigned long long mhash;
+  int mflags;
+#endif
+#endif
 
   parser->pos++;
+#ifdef JSMN_SEGMENTS
+  if (parser->partial == JSMN_OFFSET(parser, start) && parser->checked > parser->partial &&
+      (size_t)(parser->checked - parser->base) <= len) { /* carry on where the last call stopped */
+    parser->pos = parser->checked - parser->base;
+#ifdef JSMN_TOKEN_VALUES
+    hash = parser->pvalue;
+    flags = parser->pflags;
+#endif
+  }
+  mark = parser->pos;
+#ifdef JSMN_TOKEN_VALUES
+  mhash = hash;
+  mflags = flags;
+#endif
+#endif
 
   /* Skip starting quote */
   for (; parser->pos < len && js[parser->pos] != '\0'; parser->pos++) {
     char c = js[parser->pos];
+#ifdef JSMN_SEGMENTS
+    mark = parser->pos;
+#ifdef JSMN_TOKEN_VALUES
+    mhash = hash;
+    mflags = flags;
+#endif
+#endif
+#ifdef JSMN_LIMITS
+    if (JSMN_OVER(parser->max_string, parser->pos - (jsmnuint_t)start - 1)) {
+      parser->pos = start;
+      return JSMN_ERROR_LIMIT;
+    }
+#endif
 
     /* Quote: end of string */
     if (c == '\"') {
@@ -213,16 +379,26 @@ static int jsmn_parse_string(jsmn_parser *parser, const char *js,
         parser->pos = start;
         return JSMN_ERROR_NOMEM;
       }
-      jsmn_fill_token(token, JSMN_STRING, start + 1, parser->pos);
+      jsmn_fill_token(token, JSMN_STRING, JSMN_OFFSET(parser, start + 1), JSMN_OFFSET(parser, parser->pos));
 #ifdef JSMN_PARENT_LINKS
       token->parent = parser->toksuper;
+#endif
+#ifdef JSMN_TOKEN_VALUES
+      token->flags = flags;
+      token->value = flags ? hash : 0;
 #endif
       return 0;
     }
+#ifdef JSMN_TOKEN_VALUES
+    hash = ((hash ^ (unsigned char)c) * 0x01000193ull) & 0xFFFFFFFFull;
+#endif
 
     /* Backslash: Quoted symbol expected */
     if (c == '\\' && parser->pos + 1 < len) {
       int i;
+#ifdef JSMN_TOKEN_VALUES
+      flags = 0; /* the hash is only of strings without escapes */
+#endif
       parser->pos++;
       switch (js[parser->pos]) {
       /* Allowed escaped symbols */
@@ -258,19 +434,43 @@ static int jsmn_parse_string(jsmn_parser *parser, const char *js,
       }
     }
   }
+#ifdef JSMN_SEGMENTS
+  parser->partial = JSMN_OFFSET(parser, start);
+  parser->checked = JSMN_OFFSET(parser, mark);
+#ifdef JSMN_TOKEN_VALUES
+  parser->pvalue = mhash;
+  parser->pflags = mflags;
+#endif
+#endif
   parser->pos = start;
   return JSMN_ERROR_PART;
 }
 
+#ifdef JSMN_ELEMENT_CALLBACK
+/**
+ * Notify the user that a value has been parsed, if it is a member of an
+ * array.
+ */
+static int jsmn_element(jsmn_parser *parser, jsmntok_t *tokens) {
+  if (parser->element == NULL || tokens == NULL || parser->toksuper == -1) {
+    return 0;
+  }
+  if (tokens[parser->toksuper].type != JSMN_ARRAY) {
+    return 0;
+  }
+  return parser->element(parser, tokens, parser->toksuper);
+}
+#endif
+
 /**
  * Parse JSON string and fill tokens.
  */
-JSMN_API int jsmn_parse(jsmn_parser *parser, const char *js, const size_t len,
-                        jsmntok_t *tokens, const unsigned int num_tokens) {
+JSMN_API jsmnint_t jsmn_parse(jsmn_parser *parser, const char *js, const size_t len,
+                        jsmntok_t *tokens, const jsmnuint_t num_tokens) {
   int r;
-  int i;
+  jsmnint_t i;
   jsmntok_t *token;
-  int count = parser->toknext;
+  jsmnint_t count = parser->toknext;
 
   for (; parser->pos < len && js[parser->pos] != '\0'; parser->pos++) {
     char c;
@@ -288,6 +488,12 @@ JSMN_API int jsmn_parse(jsmn_parser *parser, const char *js, const size_t len,
       if (token == NULL) {
         return JSMN_ERROR_NOMEM;
       }
+#ifdef JSMN_LIMITS
+      if (JSMN_OVER(parser->max_tokens, ++parser->total) ||
+          JSMN_OVER(parser->max_depth, ++parser->depth)) {
+        return JSMN_ERROR_LIMIT;
+      }
+#endif
       if (parser->toksuper != -1) {
         jsmntok_t *t = &tokens[parser->toksuper];
 #ifdef JSMN_STRICT
@@ -297,12 +503,17 @@ JSMN_API int jsmn_parse(jsmn_parser *parser, const char *js, const size_t len,
         }
 #endif
         t->size++;
+#ifdef JSMN_LIMITS
+        if (JSMN_OVER(parser->max_size, t->size)) {
+          return JSMN_ERROR_LIMIT;
+        }
+#endif
 #ifdef JSMN_PARENT_LINKS
         token->parent = parser->toksuper;
 #endif
       }
       token->type = (c == '{' ? JSMN_OBJECT : JSMN_ARRAY);
-      token->start = parser->pos;
+      token->start = JSMN_OFFSET(parser, parser->pos);
       parser->toksuper = parser->toknext - 1;
       break;
     case '}':
@@ -321,8 +532,11 @@ JSMN_API int jsmn_parse(jsmn_parser *parser, const char *js, const size_t len,
           if (token->type != type) {
             return JSMN_ERROR_INVAL;
           }
-          token->end = parser->pos + 1;
+          token->end = JSMN_OFFSET(parser, parser->pos + 1);
           parser->toksuper = token->parent;
+#ifdef JSMN_LIMITS
+          parser->depth--;
+#endif
           break;
         }
         if (token->parent == -1) {
@@ -333,6 +547,12 @@ JSMN_API int jsmn_parse(jsmn_parser *parser, const char *js, const size_t len,
         }
         token = &tokens[token->parent];
       }
+#ifdef JSMN_ELEMENT_CALLBACK
+      r = jsmn_element(parser, tokens);
+      if (r < 0) {
+        return r;
+      }
+#endif
 #else
       for (i = parser->toknext - 1; i >= 0; i--) {
         token = &tokens[i];
@@ -341,7 +561,10 @@ JSMN_API int jsmn_parse(jsmn_parser *parser, const char *js, const size_t len,
             return JSMN_ERROR_INVAL;
           }
           parser->toksuper = -1;
-          token->end = parser->pos + 1;
+          token->end = JSMN_OFFSET(parser, parser->pos + 1);
+#ifdef JSMN_LIMITS
+          parser->depth--;
+#endif
           break;
         }
       }
@@ -367,6 +590,18 @@ JSMN_API int jsmn_parse(jsmn_parser *parser, const char *js, const size_t len,
       if (parser->toksuper != -1 && tokens != NULL) {
         tokens[parser->toksuper].size++;
       }
+#ifdef JSMN_LIMITS
+      if (tokens != NULL && (JSMN_OVER(parser->max_tokens, ++parser->total) ||
+          (parser->toksuper != -1 && JSMN_OVER(parser->max_size, tokens[parser->toksuper].size)))) {
+        return JSMN_ERROR_LIMIT;
+      }
+#endif
+#ifdef JSMN_ELEMENT_CALLBACK
+      r = jsmn_element(parser, tokens);
+      if (r < 0) {
+        return r;
+      }
+#endif
       break;
     case '\t':
     case '\r':
@@ -430,6 +665,18 @@ JSMN_API int jsmn_parse(jsmn_parser *parser, const char *js, const size_t len,
       if (parser->toksuper != -1 && tokens != NULL) {
         tokens[parser->toksuper].size++;
       }
+#ifdef JSMN_LIMITS
+      if (tokens != NULL && (JSMN_OVER(parser->max_tokens, ++parser->total) ||
+          (parser->toksuper != -1 && JSMN_OVER(parser->max_size, tokens[parser->toksuper].size)))) {
+        return JSMN_ERROR_LIMIT;
+      }
+#endif
+#ifdef JSMN_ELEMENT_CALLBACK
+      r = jsmn_element(parser, tokens);
+      if (r < 0) {
+        return r;
+      }
+#endif
       break;
 
 #ifdef JSMN_STRICT
@@ -460,6 +707,20 @@ JSMN_API void jsmn_init(jsmn_parser *parser) {
   parser->pos = 0;
   parser->toknext = 0;
   parser->toksuper = -1;
+#ifdef JSMN_ELEMENT_CALLBACK
+  parser->element = NULL;
+  parser->param = NULL;
+#endif
+#ifdef JSMN_SEGMENTS
+  parser->base = 0;
+  parser->more = 0;
+  parser->partial = -1;
+  parser->checked = 0;
+#endif
+#ifdef JSMN_LIMITS
+  parser->max_tokens = parser->max_string = parser->max_size = parser->max_depth = 0;
+  parser->total = parser->depth = 0;
+#endif
 }
 
 #endif /* JSMN_HEADER */
@@ -7,7 +7,9 @@
 #include <assert.h>
 #include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #define ELEMENTS(X)  (sizeof(X) / sizeof(X[0]))
 
@@ -138,6 +140,83 @@ static int examples(void)
     return r;
 }
 
+static double elapsed(clock_t start, unsigned long iterations)
+{
+    return ((double)(clock() - start) / CLOCKS_PER_SEC) * 1e9 / iterations;
+}
+
+/* Time serialization and deserialization of a small, shallow, message */
+static int benchmark(FILE *o, unsigned long iterations)
+{
+    assert(o);
+    bool b1 = true, b2 = false;
+    jser_long_t l1 = -987, l2 = 333, l3 = 1, l4 = 2, l5 = 4;
+    jser_ulong_t ul1 = 444, ul2 = 111;
+    char s1[32] = "benchmark", s2[32] = "a longer string value";
+    unsigned char bstr1[32] = "HELLO";
+    jser_buffer_t buf1 = { .used = 5, .length = sizeof bstr1, .buf = bstr1, };
+
+    jser_t array[]  = { MK_LONG(l3), MK_LONG(l4), MK_LONG(l5), };
+    jser_t nested[] = { MK_ULONG(ul1), MK_ULONG(ul2), MK_LONG(l2), };
+    jser_t object[] = {
+        MK_BOOL(b1), MK_BOOL(b2), MK_LONG(l1),
+        {  .attr  =  "a1",  .type  =  JSER_ARRAY_E,   .data.array  =  array,   .length  =  ELEMENTS(array),   .used  =  ELEMENTS(array),   },
+        {  .attr  =  "j1",  .type  =  JSER_OBJECT_E,  .data.jser   =  nested,  .length  =  ELEMENTS(nested),  .used  =  ELEMENTS(nested),  },
+        {  .attr  =  "s1",  .type  =  JSER_ASCIIZ_E,  .data.asciiz =  s1,      .length  =  sizeof s1,  },
+        {  .attr  =  "s2",  .type  =  JSER_ASCIIZ_E,  .data.asciiz =  s2,      .length  =  sizeof s2,  },
+        MK_BUF(buf1),
+    };
+
+    char json[512] = { 0 };
+    jsmntok_t tokens[64];
+    clock_t start = clock();
+    for (unsigned long i = 0; i < iterations; i++) {
+        if (jser_serialize_to_asciiz(object, ELEMENTS(object), 0, json, sizeof json) < 0) {
+            return -1;
+        }
+    }
+    const double ser = elapsed(start, iterations);
+    start = clock();
+    for (unsigned long i = 0; i < iterations; i++) {
+        if (jser_deserialize_from_asciiz(object, ELEMENTS(object), tokens, ELEMENTS(tokens), json) < 0) {
+            return -1;
+        }
+    }
+    const double des = elapsed(start, iterations);
+    if (fprintf(o, "%s\nbytes: %u\nserialize: %.1f ns\ndeserialize (tokenize and bind): %.1f ns\n", json, (unsigned)strlen(json), ser, des) < 0) {
+        return -1;
+    }
+
+    /* the same message from a producer that writes its keys the other way around */
+    char reversed[] = "{\"buf1\":\"SEVMTE8=\",\"s2\":\"a longer string value\",\"s1\":\"benchmark\","
+        "\"j1\":{\"l2\":333,\"ul2\":111,\"ul1\":444},\"a1\":[1,2,4],\"l1\":-987,\"b2\":false,\"b1\":true}";
+    jser_buffer_t rb = { .length = sizeof reversed, .used = strlen(reversed), .buf = (unsigned char *)reversed, };
+    jser_probe_t tables[2];
+    size_t indices[3 * (ELEMENTS(object) + ELEMENTS(nested))];
+    jser_lookup_t l = { .tables = tables, .length = ELEMENTS(tables), .indices = indices, .ilength = ELEMENTS(indices), };
+    if (jser_lookup_prepare(object, ELEMENTS(object), &l) < 0) {
+        return -1;
+    }
+    double probes[2] = { 0, }, times[2] = { 0, };
+    for (int pass = 0; pass < 2; pass++) {
+        start = clock();
+        for (unsigned long i = 0; i < iterations; i++) {
+            if (jser_deserialize_adaptive(object, ELEMENTS(object), tokens, ELEMENTS(tokens), &rb, &l) < 0) {
+                return -1;
+            }
+        }
+        times[pass]  = elapsed(start, iterations);
+        probes[pass] = (double)l.probes / l.lookups;
+        l.learn = true; /* learn from one message, then look keys up in the order they arrive */
+        if (jser_deserialize_adaptive(object, ELEMENTS(object), tokens, ELEMENTS(tokens), &rb, &l) < 0 || jser_lookup_learn(&l) < 0) {
+            return -1;
+        }
+        l.learn = false;
+    }
+    return fprintf(o, "reversed keys: %.2f probes per key, %.1f ns\nlearnt order:  %.2f probes per key, %.1f ns\n",
+            probes[0], times[0], probes[1], times[1]) < 0 ? -1 : 0;
+}
+
 typedef struct {
     bool b1, b2, b3;
     jser_long_t l1, l2, l3;
@@ -245,6 +324,74 @@ static int serdes(example_t *e, FILE *o, char *json, size_t length, int serializ
     return 0;
 }
 
+/* Read all of 'f' into a buffer allocated with 'realloc' */
+static int slurp(FILE *f, jser_buffer_t *b)
+{
+    assert(f);
+    assert(b);
+    b->used = 0;
+    for (;;) {
+        if (b->used == b->length) {
+            const size_t length = b->length ? b->length * 2 : 4096;
+            unsigned char *r = realloc(b->buf, length);
+            if (!r) {
+                return -1;
+            }
+            b->buf = r;
+            b->length = length;
+        }
+        const size_t n = fread(&b->buf[b->used], 1, b->length - b->used, f);
+        b->used += n;
+        if (n == 0) {
+            return ferror(f) ? -1 : 0;
+        }
+    }
+}
+
+/* Validate ('V'), minify ('m') or pretty print ('p') a file to 'o' */
+static int lint_file(FILE *o, const char *file, int mode)
+{
+    assert(o);
+    assert(file);
+    errno = 0;
+    FILE *f = fopen(file, "rb");
+    if (!f) {
+        fprintf(stderr, "failed to open file for reading: %s\n", strerror(errno));
+        return -1;
+    }
+    jser_buffer_t in = { .length = 0, .used = 0, .buf = NULL, }, out = { .length = 0, .used = 0, .buf = NULL, };
+    int r = slurp(f, &in);
+    if (fclose(f) < 0) {
+        r = -1;
+    }
+    if (r >= 0 && mode == 'V') {
+        r = jser_validate(&in);
+    } else if (r >= 0 && mode == 'm') {
+        r = jser_minify(&in, &in);
+        if (r >= 0 && fwrite(in.buf, 1, in.used, o) != in.used) {
+            r = -1;
+        }
+    } else if (r >= 0) {
+        out.length = (in.used * 2) + 64;
+        for (r = -1; (out.buf = realloc(out.buf, out.length)); out.length *= 2) {
+            if ((r = jser_prettify(&in, &out)) != -4) { /* try again with more space */
+                break;
+            }
+        }
+        if (r >= 0 && fwrite(out.buf, 1, out.used, o) != out.used) {
+            r = -1;
+        }
+    }
+    if (r < 0) {
+        fprintf(stderr, "%s: invalid (%d)\n", file, r);
+    } else if (mode != 'V' && fputc('\n', o) < 0) {
+        r = -1;
+    }
+    free(in.buf);
+    free(out.buf);
+    return r;
+}
+
 static int usage(FILE *o, const char *arg0)
 {
     assert(o);
@@ -266,10 +413,14 @@ library.\n\n\
 Options:\n\n\
 --\tstop processing command line options\n\
 -h\tprint this help and exit\n\
+-b\trun a benchmark of serialization and deserialization\n\
 -s\trun the serialization config example\n\
 -e\trun some examples\n\
 -t\trun the libraries internal tests and return pass (0) or failure\n\
 -x path\tsearch for node within example configuration\n\
+-V\tvalidate the files that follow instead\n\
+-m\tminify the files that follow to standard output instead\n\
+-p\tpretty print the files that follow to standard output instead\n\
 file\tread in JSON for the deserialization config example\n\
 \n\
 Non-zero is returned on failure, zero on success.\n\n\
@@ -284,7 +435,7 @@ Non-zero is returned on failure, zero on success.\n\n\
 
 int main(int argc, char **argv)
 {
-    int r = 0, no_opt = 0;
+    int r = 0, no_opt = 0, mode = 0;
     static char json[2048] = { 0 };
 
     for (int i = 1; i < argc; i++) {
@@ -305,6 +456,12 @@ int main(int argc, char **argv)
                     }
                     return 0;
                 case 'e': return examples();
+                case 'b':
+                    if (benchmark(stdout, 200000ul) < 0) {
+                        fprintf(stderr, "benchmark failed\n");
+                        return 1;
+                    }
+                    return 0;
                 case 't':
                     if (jser_tests() < 0) {
                         fprintf(stdout, "jser internal tests failed!\n");
@@ -314,11 +471,18 @@ int main(int argc, char **argv)
 
                 case 'x':
                     break;
+                case 'V': case 'm': case 'p':
+                    mode = ch;
+                    break;
                 default:
                     (void)usage(stderr, argv[0]);
                     return 1;
                 }
             }
+        } else if (mode) {
+            if (lint_file(stdout, argv[i], mode) < 0) {
+                r = 1;
+            }
         } else {
             errno = 0;
             FILE *f = fopen(argv[i], "rb");